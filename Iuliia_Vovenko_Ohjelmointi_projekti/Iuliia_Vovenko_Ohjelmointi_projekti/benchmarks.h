@@ -0,0 +1,645 @@
+#ifndef HOLY_DIVER_BENCHMARKS_H
+#define HOLY_DIVER_BENCHMARKS_H
+
+#include "headless.h"
+#include "regression_bench.h"
+
+// =====================
+// Benchmarks
+// =====================
+
+// Steps a batch of environments with random actions for a few seconds and
+// reports throughput.
+inline bool runGymBenchmark(const string& mapPath, const GameConfig& config, EventJournal* journal) {
+    LevelData level;
+    string error;
+    if (!LevelData::read(mapPath, level, error) || !level.validate(error)) {
+        cout << error << "\n";
+        return false;
+    }
+
+    const size_t envCount = 1024;
+    VectorEnv envs(level, envCount, config, 1);
+    envs.setJournal(journal);
+    vector<uint8_t> actions(envCount);
+    vector<uint8_t> observations(envCount * VectorEnv::OBSERVATION_SIZE);
+    vector<float> rewards(envCount);
+    vector<uint8_t> dones(envCount);
+    mt19937 random(1);
+
+    envs.reset(observations.data());
+
+    size_t steps = 0;
+    size_t episodes = 0;
+    auto started = chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < 3.0) {
+        for (uint8_t& action : actions) {
+            action = static_cast<uint8_t>(random() % VectorEnv::ACTION_COUNT);
+        }
+        envs.step(actions.data(), observations.data(), rewards.data(), dones.data());
+        steps += envCount;
+        episodes += count(dones.begin(), dones.end(), 1);
+        elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    }
+
+    cout << envCount << " environments, " << steps << " steps, " << episodes << " episodes in "
+        << elapsed << " s: " << static_cast<size_t>(steps / elapsed) << " env-steps/s\n";
+    if (journal != nullptr && journal->droppedCount() > 0) {
+        cout << "Journal dropped " << journal->droppedCount() << " events\n";
+    }
+    return true;
+}
+
+// Heap held after loading a level the way the game does, by subsystem.
+inline bool runMemoryReport(const string& mapPath, const GameConfig& config) {
+    Campaign campaign;
+    LevelData level;
+    if (!campaign.discover(mapPath) || !campaign.takeLevel(0, level)) {
+        cout << "Failed to load " << mapPath << "\n";
+        return false;
+    }
+
+    ostream discard(nullptr);
+    World world;
+    world.setOutput(discard);
+    world.setConfig(config);
+    int width = level.width;
+    int height = level.height;
+    if (!world.loadLevel(std::move(level))) {
+        cout << "Failed to load " << mapPath << "\n";
+        return false;
+    }
+    campaign.prefetchAfter(0);
+
+    MemoryUsage usage = world.getMemoryUsage();
+    usage.bytes[MemoryUsage::Prefetch] = campaign.memoryUsage();
+
+    cout << "Memory after loading " << mapPath << " (" << width << "x" << height << "):\n";
+    usage.print(cout);
+    cout << "Accounted: " << MemoryBudget::accountedBytes() / 1024 << " KB";
+    if (MemoryBudget::getLimit() > 0) {
+        cout << " of a " << MemoryBudget::getLimit() / 1024 << " KB budget";
+    }
+    cout << "\nPeak resident: " << ProcessStats::peakResidentBytes() / 1024 << " KB\n";
+    return true;
+}
+
+// Save size and timings for a generated size x size level with every cell
+// explored: serializing on the game thread, the background write, and
+// resuming through the mapped file.
+inline bool runSaveBenchmark(int size) {
+    const string mapPath = "bench_save.map";
+    const string savePath = "bench_save.sav";
+    string error;
+    if (!writeGeneratedLevel(mapPath, size, size, 7, error)) {
+        cout << error << "\n";
+        return false;
+    }
+
+    ostream discard(nullptr);
+    World world;
+    world.setOutput(discard);
+    if (!world.loadFromFile(mapPath)) {
+        cout << "Failed to load " << mapPath << "\n";
+        return false;
+    }
+    world.revealAll();
+
+    auto millisecondsSince = [](chrono::steady_clock::time_point started) {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+    };
+
+    auto started = chrono::steady_clock::now();
+    ByteWriter out;
+    world.writeSave(out);
+    size_t bytes = out.data().size();
+    double serializeMs = millisecondsSince(started);
+
+    SaveWriter writer;
+    started = chrono::steady_clock::now();
+    writer.start(savePath, std::move(out.data()));
+    double startMs = millisecondsSince(started);
+    writer.wait();
+    double writeMs = millisecondsSince(started);
+    if (writer.takeResult() != SaveWriter::Status::Done) {
+        cout << "Failed to write " << savePath << "\n";
+        return false;
+    }
+
+    started = chrono::steady_clock::now();
+    MappedFile file;
+    World resumed;
+    resumed.setOutput(discard);
+    if (!file.open(savePath)) {
+        cout << "Failed to open " << savePath << "\n";
+        return false;
+    }
+    ByteReader in(file.data(), file.size());
+    if (!resumed.loadFromSave(in)) {
+        cout << "Failed to resume from " << savePath << "\n";
+        return false;
+    }
+    double resumeMs = millisecondsSince(started);
+
+    cout << size << "x" << size << " map, " << world.getEnemies().size() << " enemies, "
+        << world.getItems().size() << " items, fully explored\n";
+    cout << "Save size:   " << bytes << " bytes\n";
+    cout << "Serialize:   " << serializeMs << " ms on the game thread\n";
+    cout << "Hand-off:    " << startMs << " ms on the game thread\n";
+    cout << "Disk write:  " << writeMs << " ms in the background\n";
+    cout << "Resume:      " << resumeMs << " ms (map template parse included)\n";
+    cout << "State hash " << (resumed.getStateHash() == world.getStateHash() ? "matches" : "DIFFERS") << "\n";
+    return resumed.getStateHash() == world.getStateHash();
+}
+
+// Load and reload times for a generated size x size level crowded with
+// entities (30% enemies, 10% items): loadLevel from an already parsed
+// level, and reload(), which parses the map file again. Builds with
+// HOLY_DIVER_COUNT_ALLOCATIONS also report heap allocations per cycle.
+inline bool runLoadBenchmark(int size) {
+    const string mapPath = "bench_load.map";
+    const int cycles = 20;
+    string error;
+    LevelData level;
+    if (!writeGeneratedLevel(mapPath, size, size, 7, error, 30, 10) || !LevelData::read(mapPath, level, error)) {
+        cout << error << "\n";
+        return false;
+    }
+
+    ostream discard(nullptr);
+    World world;
+    world.setOutput(discard);
+    // The first load sizes the pools and the per-cell arrays; the cycles
+    // measure what every later load costs.
+    if (!world.loadLevel(level)) {
+        cout << "Failed to load " << mapPath << "\n";
+        return false;
+    }
+
+    vector<LevelData> copies(cycles, level);
+    auto started = chrono::steady_clock::now();
+    uint64_t allocationsBefore = ProcessStats::allocationCount();
+    for (LevelData& copy : copies) {
+        world.loadLevel(std::move(copy));
+    }
+    uint64_t loadAllocations = ProcessStats::allocationCount() - allocationsBefore;
+    double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count() / cycles;
+
+    started = chrono::steady_clock::now();
+    allocationsBefore = ProcessStats::allocationCount();
+    bool reloaded = true;
+    for (int i = 0; i < cycles; ++i) {
+        reloaded = world.reload() && reloaded;
+    }
+    uint64_t reloadAllocations = ProcessStats::allocationCount() - allocationsBefore;
+    double reloadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count() / cycles;
+    remove(mapPath.c_str());
+    if (!reloaded) {
+        cout << "Failed to reload " << mapPath << "\n";
+        return false;
+    }
+
+    cout << size << "x" << size << " map, " << world.getEnemies().size() << " enemies, "
+        << world.getItems().size() << " items, " << cycles << " cycles each\n";
+    cout << "loadLevel: " << loadMs << " ms";
+    if (ProcessStats::countsAllocations()) {
+        cout << ", " << loadAllocations / cycles << " allocations";
+    }
+    cout << " per load\nreload:    " << reloadMs << " ms";
+    if (ProcessStats::countsAllocations()) {
+        cout << ", " << reloadAllocations / cycles << " allocations";
+    }
+    cout << " per reload\n";
+    if (!ProcessStats::countsAllocations()) {
+        cout << "Build with -DHOLY_DIVER_COUNT_ALLOCATIONS to count allocations\n";
+    }
+    return true;
+}
+
+// Turn latency (simulate, render, publish) with more and more spectators.
+// Half of the viewers read everything; the other half never read, fill
+// their socket buffers and fall back to keyframes.
+inline bool runSpectatorBenchmark(const string& mapPath, const GameConfig& config) {
+    LevelData level;
+    string error;
+    if (!LevelData::read(mapPath, level, error) || !level.validate(error)) {
+        cout << error << "\n";
+        return false;
+    }
+
+    SpectatorServer server;
+    if (!server.start(0, error)) {
+        cout << error << "\n";
+        return false;
+    }
+
+    const int turns = 2000;
+    const size_t viewerCounts[] = { 0, 16, 64, 256 };
+    vector<SocketHandle> clients;
+    ostream discard(nullptr);
+
+    cout << "viewers  mean us  p99 us  MB read by fast viewers\n";
+    for (size_t viewerCount : viewerCounts) {
+        while (clients.size() < viewerCount) {
+            SocketHandle client = Sockets::connectLoopback(server.getPort());
+            if (client == Sockets::INVALID) {
+                cout << "Failed to connect spectator " << clients.size() << "\n";
+                return false;
+            }
+            clients.push_back(client);
+        }
+        for (int wait = 0; server.getViewerCount() < viewerCount && wait < 200; ++wait) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+
+        atomic<bool> reading{ true };
+        atomic<uint64_t> bytesRead{ 0 };
+        thread reader([&]() {
+            vector<SocketPoll> polled;
+            for (size_t i = 0; i < clients.size(); i += 2) {
+                SocketPoll entry{};
+                entry.fd = clients[i];
+                entry.events = POLLIN;
+                polled.push_back(entry);
+            }
+            char buffer[65536];
+            while (reading) {
+                if (polled.empty() || Sockets::poll(polled.data(), polled.size(), 10) <= 0) {
+                    this_thread::sleep_for(chrono::milliseconds(1));
+                    continue;
+                }
+                for (SocketPoll& entry : polled) {
+                    if (entry.revents != 0) {
+                        long long received = ::recv(entry.fd, buffer, sizeof(buffer), 0);
+                        if (received > 0) {
+                            bytesRead += static_cast<uint64_t>(received);
+                        }
+                    }
+                }
+            }
+        });
+
+        World world;
+        world.setOutput(discard);
+        world.setConfig(config);
+        world.setSeed(1);
+        world.setHistoryCapacity(0);
+        world.loadLevel(level, false);
+        mt19937 random(1);
+
+        shared_ptr<World::ScreenPatch> first = make_shared<World::ScreenPatch>();
+        world.collectScreenChanges(*first);
+        server.publish(std::move(first));
+
+        vector<double> latencies;
+        latencies.reserve(turns);
+        for (int turn = 0; turn < turns; ++turn) {
+            auto started = chrono::steady_clock::now();
+            int dx = 0;
+            int dy = 0;
+            (random() % 2 == 0 ? dx : dy) = random() % 2 == 0 ? -1 : 1;
+            if (random() % 4 == 0) {
+                world.illuminateTile(dx, dy);
+            }
+            else {
+                world.requestPlayerMove(dx, dy);
+            }
+            if (world.isPlayerDead() || world.isLevelCompleted()) {
+                world.loadLevel(level, false);
+            }
+
+            shared_ptr<World::ScreenPatch> patch = make_shared<World::ScreenPatch>();
+            world.collectScreenChanges(*patch);
+            server.publish(std::move(patch));
+            latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - started).count());
+
+            // Far faster than anyone types, but slow enough that a reading
+            // viewer stays within the backlog.
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+
+        reading = false;
+        reader.join();
+
+        double mean = 0;
+        for (double latency : latencies) {
+            mean += latency;
+        }
+        mean /= latencies.size();
+        sort(latencies.begin(), latencies.end());
+        double p99 = latencies[latencies.size() * 99 / 100];
+
+        cout << viewerCount << "\t " << static_cast<int>(mean) << "\t  " << static_cast<int>(p99) << "\t  "
+            << bytesRead / 1e6 << "\n";
+    }
+
+    for (SocketHandle client : clients) {
+        Sockets::close(client);
+    }
+    return true;
+}
+
+// Cave-like terrain: random fill smoothed by a few cellular-automaton
+// passes, with a solid border. One bit per cell, set for walls.
+// Map scanning throughput over `gigabytes` of generated rows (a 64 MB map
+// scanned again and again): MapScanner against the per-symbol loops level
+// loading used before it, a search for 'P' and one full pass for each of
+// 'M', 'O' and 'B'.
+inline bool runScanBenchmark(int gigabytes) {
+    const int width = 4096;
+    const int height = 16384;
+    vector<string> tiles(height);
+    RandomStream rng(5);
+    for (string& row : tiles) {
+        row.assign(width, 'o');
+        for (char& c : row) {
+            int roll = rng.nextInt(0, 99);
+            c = roll < 25 ? 'x' : roll == 25 ? 'M' : roll == 26 ? (rng.nextInt(0, 1) == 0 ? 'O' : 'B') : 'o';
+        }
+    }
+    tiles[height / 2][width / 2] = 'P';
+
+    size_t mapBytes = static_cast<size_t>(width) * height;
+    size_t passes = max<size_t>(1, (static_cast<size_t>(gigabytes) << 30) / mapBytes);
+    double scannedGb = static_cast<double>(passes * mapBytes) / (1u << 30);
+
+    auto findFirst = [&](char symbol) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (tiles[y][x] == symbol) {
+                    return Position{ x, y };
+                }
+            }
+        }
+        return Position{ -1, -1 };
+    };
+    auto findAll = [&](char symbol) {
+        vector<Position> result;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (tiles[y][x] == symbol) {
+                    result.push_back({ x, y });
+                }
+            }
+        }
+        return result;
+    };
+
+    auto started = chrono::steady_clock::now();
+    size_t loopFound = 0;
+    for (size_t pass = 0; pass < passes; ++pass) {
+        loopFound += findFirst('P').x >= 0 ? 1 : 0;
+        loopFound += findAll('M').size();
+        loopFound += findAll('O').size();
+        loopFound += findAll('B').size();
+    }
+    double loopSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    vector<uint64_t> wallBits((width + 63) / 64);
+    vector<int> special;
+    started = chrono::steady_clock::now();
+    size_t scannerFound = 0;
+    for (size_t pass = 0; pass < passes; ++pass) {
+        for (int y = 0; y < height; ++y) {
+            fill(wallBits.begin(), wallBits.end(), 0);
+            special.clear();
+            MapScanner::scanRow(tiles[y].data(), width, wallBits.data(), special);
+            for (int x : special) {
+                scannerFound += MapScanner::classify(tiles[y][x]) != SymbolUnknown ? 1 : 0;
+            }
+        }
+    }
+    double scannerSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    cout << "Scanned " << scannedGb << " GB (" << passes << " passes over a " << width << "x" << height << " map)\n";
+    cout << "Per-symbol loops: " << scannedGb / loopSeconds << " GB/s\n";
+    cout << "MapScanner (" << (CpuFeatures::hasAvx2() ? "AVX2" : "SSE2") << "): " << scannedGb / scannerSeconds
+        << " GB/s, also building wall bits\n";
+    cout << "Speedup: " << loopSeconds / scannerSeconds << "x\n";
+    if (loopFound != scannerFound) {
+        cout << "Symbol counts differ: " << loopFound << " vs " << scannerFound << "\n";
+        return false;
+    }
+    return true;
+}
+
+inline void generateCaves(int size, uint32_t seed, vector<uint64_t>& wallBits, size_t& wordsPerRow) {
+    vector<uint8_t> cells(static_cast<size_t>(size) * size);
+    vector<uint8_t> smoothed(cells.size());
+    RandomStream rng(seed);
+    for (uint8_t& cell : cells) {
+        cell = rng.nextInt(0, 99) < 45 ? 1 : 0;
+    }
+
+    for (int pass = 0; pass < 4; ++pass) {
+        Parallel::forRange(static_cast<size_t>(size), 256, [&](size_t begin, size_t end) {
+            for (size_t row = begin; row < end; ++row) {
+                int y = static_cast<int>(row);
+                for (int x = 0; x < size; ++x) {
+                    int wallsAround = 0;
+                    for (int dy = -1; dy <= 1; ++dy) {
+                        for (int dx = -1; dx <= 1; ++dx) {
+                            int nx = x + dx;
+                            int ny = y + dy;
+                            bool outside = nx < 0 || ny < 0 || nx >= size || ny >= size;
+                            wallsAround += outside ? 1 : cells[static_cast<size_t>(ny) * size + nx];
+                        }
+                    }
+                    smoothed[row * size + x] = wallsAround >= 5 ? 1 : 0;
+                }
+            }
+        });
+        cells.swap(smoothed);
+    }
+
+    wordsPerRow = (static_cast<size_t>(size) + 63) / 64;
+    wallBits.assign(wordsPerRow * size, 0);
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            bool border = x == 0 || y == 0 || x == size - 1 || y == size - 1;
+            if (border || cells[static_cast<size_t>(y) * size + x] != 0) {
+                wallBits[y * wordsPerRow + (x >> 6)] |= uint64_t(1) << (x & 63);
+            }
+        }
+    }
+}
+
+// Compares the path hierarchy with plain A* on generated caves: build time
+// and per-query latency over random connected pairs. Then toggles random
+// walls, rebuilds only the dirty clusters, and checks the result against a
+// full rebuild and against plain A* on the changed map.
+inline bool runPathBenchmark(int size) {
+    if (size < 64) {
+        cout << "--pathbench needs a size of at least 64\n";
+        return false;
+    }
+
+    typedef chrono::steady_clock Clock;
+    auto seconds = [](Clock::time_point since) {
+        return chrono::duration<double>(Clock::now() - since).count();
+    };
+
+    vector<uint64_t> wallBits;
+    size_t wordsPerRow = 0;
+    auto started = Clock::now();
+    generateCaves(size, 1, wallBits, wordsPerRow);
+    cout << size << "x" << size << " caves generated in " << seconds(started) << " s\n";
+
+    auto open = [&](Position p) {
+        return ((wallBits[p.y * wordsPerRow + (p.x >> 6)] >> (p.x & 63)) & 1) == 0;
+    };
+    RandomStream rng(2);
+    auto randomOpenCell = [&]() {
+        Position p;
+        do {
+            p = { rng.nextInt(0, size - 1), rng.nextInt(0, size - 1) };
+        } while (!open(p));
+        return p;
+    };
+
+    started = Clock::now();
+    PathHierarchy hierarchy(size, size, wallBits, wordsPerRow);
+    hierarchy.build();
+    cout << "Hierarchy: " << hierarchy.nodeCount() << " entrance nodes, built in " << seconds(started) << " s\n";
+
+    started = Clock::now();
+    shared_ptr<const DistanceCache> cache = DistanceCache::acquire("", size, size, wallBits.data(), wordsPerRow,
+        randomOpenCell());
+    cout << "Distance cache for plain A* built in " << seconds(started) << " s\n";
+
+    const int queries = 16;
+    double flatSeconds = 0;
+    double hierarchySeconds = 0;
+    double lengthRatio = 0;
+    int measured = 0;
+    while (measured < queries) {
+        Position from = randomOpenCell();
+        Position to = randomOpenCell();
+        if (!cache->connected(from, to) || from == to) {
+            continue;
+        }
+
+        started = Clock::now();
+        int exact = cache->distance(from, to);
+        flatSeconds += seconds(started);
+
+        started = Clock::now();
+        vector<Position> path;
+        hierarchy.findPath(from, to, path);
+        hierarchySeconds += seconds(started);
+
+        lengthRatio += static_cast<double>(path.size() - 1) / exact;
+        measured++;
+    }
+
+    cout << "Plain A*:     " << flatSeconds / queries * 1000 << " ms per query\n";
+    cout << "Hierarchical: " << hierarchySeconds / queries * 1000 << " ms per query (path found and refined), "
+        << "paths " << (lengthRatio / queries - 1) * 100 << "% longer on average\n";
+
+    // Incremental updates: a few walls at a time, as a level editor or
+    // destructible terrain would change them.
+    const int batches = 32;
+    const int togglesPerBatch = 8;
+    double rebuildSeconds = 0;
+    size_t rebuiltClusters = 0;
+    for (int batch = 0; batch < batches; ++batch) {
+        for (int i = 0; i < togglesPerBatch; ++i) {
+            Position p{ rng.nextInt(1, size - 2), rng.nextInt(1, size - 2) };
+            bool wall = open(p);
+            wallBits[p.y * wordsPerRow + (p.x >> 6)] ^= uint64_t(1) << (p.x & 63);
+            hierarchy.setWall(p.x, p.y, wall);
+        }
+        started = Clock::now();
+        rebuiltClusters += hierarchy.rebuildDirty();
+        rebuildSeconds += seconds(started);
+    }
+
+    started = Clock::now();
+    PathHierarchy rebuilt(size, size, wallBits, wordsPerRow);
+    rebuilt.build();
+    double fullSeconds = seconds(started);
+
+    cout << "Incremental:  " << batches << " batches of " << togglesPerBatch << " wall toggles, "
+        << rebuildSeconds / batches * 1000 << " ms per batch (" << static_cast<double>(rebuiltClusters) / batches
+        << " clusters rebuilt), full rebuild " << fullSeconds * 1000 << " ms\n";
+
+    cache = DistanceCache::acquire("", size, size, wallBits.data(), wordsPerRow, randomOpenCell());
+    int mismatches = 0;
+    if (hierarchy.nodeCount() != rebuilt.nodeCount()) {
+        mismatches++;
+    }
+    for (int i = 0; i < queries; ++i) {
+        Position from = randomOpenCell();
+        Position to = randomOpenCell();
+        vector<Position> path;
+        bool found = hierarchy.findPath(from, to, path);
+        int length = found ? static_cast<int>(path.size()) - 1 : -1;
+        if (length != rebuilt.distance(from, to) || found != cache->connected(from, to)) {
+            mismatches++;
+            continue;
+        }
+        if (!found) {
+            continue;
+        }
+
+        bool valid = path.front() == from && path.back() == to;
+        for (size_t step = 0; valid && step < path.size(); ++step) {
+            valid = open(path[step])
+                && (step == 0 || abs(path[step].x - path[step - 1].x) + abs(path[step].y - path[step - 1].y) == 1);
+        }
+        if (!valid || length < cache->distance(from, to)) {
+            mismatches++;
+        }
+    }
+
+    if (mismatches > 0) {
+        cout << "Incremental rebuild FAILED: " << mismatches << " of " << queries + 1 << " checks differ\n";
+        return false;
+    }
+    cout << "Incremental rebuild matches a full rebuild and plain A* on " << queries << " queries\n";
+    return true;
+}
+
+// Records a new baseline, or checks the current build against one.
+inline bool runRegressionBench(const string& baselinePath, bool record, int tolerancePercent) {
+    RegressionBench bench;
+    vector<RegressionBench::Result> results;
+    string error;
+    if (!bench.run(results, error)) {
+        cout << error << "\n";
+        return false;
+    }
+
+    for (const RegressionBench::Result& result : results) {
+        cout << result.name << ": " << result.turns << " turns, " << static_cast<uint64_t>(result.turnsPerSecond)
+            << " turns/s, peak RSS " << result.peakResidentKb << " KB, ";
+        if (ProcessStats::countsAllocations()) {
+            cout << result.allocations << " allocations\n";
+        }
+        else {
+            cout << "allocations not counted\n";
+        }
+    }
+
+    if (record) {
+        if (!RegressionBench::writeBaseline(baselinePath, results, error)) {
+            cout << error << "\n";
+            return false;
+        }
+        cout << "Baseline written to " << baselinePath << "\n";
+        return true;
+    }
+
+    if (!RegressionBench::compare(baselinePath, results, tolerancePercent, cout, error)) {
+        if (!error.empty()) {
+            cout << error << "\n";
+        }
+        cout << "Regression bench FAILED\n";
+        return false;
+    }
+    cout << "Regression bench passed\n";
+    return true;
+}
+
+#endif
@@ -0,0 +1,291 @@
+#ifndef HOLY_DIVER_CAMPAIGN_H
+#define HOLY_DIVER_CAMPAIGN_H
+
+#include "level.h"
+
+// =====================
+// Campaign
+// =====================
+
+// The whole level_N sequence starting from the first map. Levels are
+// discovered and validated up front (in parallel), so a broken level is
+// reported at startup, and the next few levels are parsed in the
+// background so a level transition never waits on the disk.
+class Campaign {
+public:
+    static constexpr size_t PREFETCH_DEPTH = 2;
+    static constexpr size_t MAX_LEVELS = 1000;
+
+    Campaign() = default;
+    Campaign(const Campaign&) = delete;
+    Campaign& operator=(const Campaign&) = delete;
+
+    // Waits for at most the one level the loader is parsing right now.
+    ~Campaign() {
+        dropPending(0);
+        {
+            lock_guard<mutex> lock(loaderGuard);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (loader.joinable()) {
+            loader.join();
+        }
+    }
+
+    // Returns false if even the first level is broken.
+    bool discover(const string& firstPath) {
+        paths.clear();
+        dropPending(0);
+
+        string path = firstPath;
+        while (paths.size() < MAX_LEVELS && ifstream(path).good()) {
+            paths.push_back(path);
+            path = buildNextLevelPath(path);
+        }
+
+        vector<string> errors(paths.size());
+        vector<string> warnings(paths.size());
+        Parallel::forRange(paths.size(), 1, [this, &errors, &warnings](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                LevelData level;
+                if (LevelData::read(paths[i], level, errors[i])) {
+                    level.validate(errors[i], &warnings[i]);
+                }
+            }
+        });
+
+        for (size_t i = 0; i < paths.size(); ++i) {
+            if (!warnings[i].empty()) {
+                cout << warnings[i] << "\n";
+            }
+            if (!errors[i].empty()) {
+                cout << "Level " << paths[i] << " is broken: " << errors[i] << "\n";
+                if (i > 0) {
+                    cout << "The campaign will end before it.\n";
+                }
+                paths.resize(i);
+                break;
+            }
+        }
+
+        return !paths.empty();
+    }
+
+    size_t levelCount() const {
+        return paths.size();
+    }
+
+    const string& levelPath(size_t index) const {
+        return paths[index];
+    }
+
+    // Finds an already discovered level; -1 if the path is not part of
+    // the campaign.
+    int indexOf(const string& path) const {
+        auto it = find(paths.begin(), paths.end(), path);
+        return it == paths.end() ? -1 : static_cast<int>(it - paths.begin());
+    }
+
+    // Keeps the levels after `current` parsing on the loader thread. They
+    // count against the memory budget by their size on disk until parsed,
+    // then by their parsed size; over budget the farthest ones are dropped
+    // and no new ones started. Never waits: a dropped level that is still
+    // parsing is only marked cancelled.
+    void prefetchAfter(size_t current) {
+        while (!pending.empty() && pending.front().index <= current) {
+            cancel(*pending.front().slot);
+            pending.pop_front();
+        }
+        while (!pending.empty() && !MemoryBudget::fits(0)) {
+            cancel(*pending.back().slot);
+            pending.pop_back();
+        }
+
+        size_t next = pending.empty() ? current + 1 : pending.back().index + 1;
+        for (; next <= current + PREFETCH_DEPTH && next < paths.size(); ++next) {
+            size_t bytes = fileSize(paths[next]);
+            if (!MemoryBudget::fits(bytes)) {
+                break;
+            }
+            shared_ptr<PrefetchSlot> slot = make_shared<PrefetchSlot>();
+            slot->account.set(bytes);
+            pending.push_back({ next, slot });
+
+            lock_guard<mutex> lock(loaderGuard);
+            if (!loader.joinable()) {
+                loader = thread([this] { loadLoop(); });
+            }
+            requests.push_back({ paths[next], std::move(slot) });
+            wake.notify_all();
+        }
+    }
+
+    size_t memoryUsage() const {
+        size_t bytes = 0;
+        for (const PendingLevel& level : pending) {
+            bytes += level.slot->account.get();
+        }
+        return bytes;
+    }
+
+    // True when takeLevel(index) will not have to wait for the disk.
+    bool isLevelReady(size_t index) const {
+        for (const PendingLevel& level : pending) {
+            if (level.index == index) {
+                lock_guard<mutex> lock(level.slot->guard);
+                return level.slot->done;
+            }
+        }
+        return false;
+    }
+
+    // Hands over a parsed level. Waits only if its prefetch has not
+    // finished yet; check isLevelReady first to tell the player.
+    bool takeLevel(size_t index, LevelData& level) {
+        for (auto it = pending.begin(); it != pending.end(); ++it) {
+            if (it->index == index) {
+                shared_ptr<PrefetchSlot> slot = it->slot;
+                pending.erase(it);
+
+                unique_lock<mutex> lock(slot->guard);
+                slot->finished.wait(lock, [&slot] { return slot->done; });
+                if (!slot->dropped) {
+                    level = std::move(slot->level);
+                    return level.width > 0;
+                }
+                break;
+            }
+        }
+
+        string error;
+        if (!LevelData::read(paths[index], level, error)) {
+            cout << error << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    static string buildNextLevelPath(const string& currentPath) {
+        string result = currentPath;
+
+        int lastDigitPos = -1;
+        for (int i = static_cast<int>(result.size()) - 1; i >= 0; --i) {
+            if (isdigit(static_cast<unsigned char>(result[i]))) {
+                lastDigitPos = i;
+                break;
+            }
+        }
+
+        if (lastDigitPos == -1) {
+            return result + "2";
+        }
+
+        int firstDigitPos = lastDigitPos;
+        while (firstDigitPos - 1 >= 0 &&
+            isdigit(static_cast<unsigned char>(result[firstDigitPos - 1]))) {
+            firstDigitPos--;
+        }
+
+        int currentNumber = stoi(result.substr(firstDigitPos, lastDigitPos - firstDigitPos + 1));
+        int nextNumber = currentNumber + 1;
+
+        result.replace(firstDigitPos, lastDigitPos - firstDigitPos + 1, to_string(nextNumber));
+        return result;
+    }
+
+private:
+    // Shared between the game and the loader thread, so dropping a level
+    // never has to wait for its parse to end.
+    struct PrefetchSlot {
+        mutex guard;
+        condition_variable finished;
+        bool done = false;
+        // Parsed, but did not fit in the budget; read again when needed.
+        bool dropped = false;
+        atomic<bool> cancelled{ false };
+        LevelData level;
+        // The file size until the level is parsed, then the parsed size.
+        MemoryAccount account;
+    };
+
+    struct PendingLevel {
+        size_t index;
+        shared_ptr<PrefetchSlot> slot;
+    };
+
+    struct LoadRequest {
+        string path;
+        shared_ptr<PrefetchSlot> slot;
+    };
+
+    void loadLoop() {
+        unique_lock<mutex> lock(loaderGuard);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || !requests.empty(); });
+            if (stopping) {
+                return;
+            }
+
+            LoadRequest request = std::move(requests.front());
+            requests.pop_front();
+            lock.unlock();
+
+            LevelData level;
+            if (!request.slot->cancelled) {
+                string error;
+                LevelData::read(request.path, level, error);
+            }
+            size_t bytes = level.memoryUsage();
+            {
+                lock_guard<mutex> slotLock(request.slot->guard);
+                PrefetchSlot& slot = *request.slot;
+                size_t estimate = slot.account.get();
+                if (!slot.cancelled && MemoryBudget::fits(bytes > estimate ? bytes - estimate : 0)) {
+                    slot.level = std::move(level);
+                    slot.account.set(bytes);
+                }
+                else {
+                    slot.dropped = true;
+                    slot.account.set(0);
+                }
+                slot.done = true;
+            }
+            request.slot->finished.notify_all();
+
+            lock.lock();
+        }
+    }
+
+    // Drops every prefetched level after `keep` levels without waiting.
+    void dropPending(size_t keep) {
+        while (pending.size() > keep) {
+            cancel(*pending.back().slot);
+            pending.pop_back();
+        }
+    }
+
+    // Its bytes leave the budget at once, even while the loader still
+    // holds the slot.
+    static void cancel(PrefetchSlot& slot) {
+        lock_guard<mutex> lock(slot.guard);
+        slot.cancelled = true;
+        slot.account.set(0);
+    }
+
+    static size_t fileSize(const string& path) {
+        ifstream file(path, ios::binary | ios::ate);
+        return file ? static_cast<size_t>(file.tellg()) : 0;
+    }
+
+    vector<string> paths;
+    deque<PendingLevel> pending;
+
+    mutex loaderGuard;
+    condition_variable wake;
+    deque<LoadRequest> requests;
+    bool stopping = false;
+    thread loader;
+};
+
+#endif
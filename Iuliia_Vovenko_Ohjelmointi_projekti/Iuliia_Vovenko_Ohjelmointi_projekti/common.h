@@ -0,0 +1,318 @@
+#ifndef HOLY_DIVER_COMMON_H
+#define HOLY_DIVER_COMMON_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <random>
+#include <limits>
+#include <cctype>
+#include <cmath>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <sstream>
+#include <future>
+#include <map>
+#include <queue>
+#include <unordered_map>
+
+// x86 builds look for AVX and AVX2 at run time (CpuFeatures), so a default
+// build still uses them for map scanning and the ocean stencil on CPUs that
+// have them.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HOLY_DIVER_AVX_DISPATCH
+#define HOLY_DIVER_TARGET_AVX __attribute__((target("avx")))
+#define HOLY_DIVER_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define HOLY_DIVER_AVX_DISPATCH
+#define HOLY_DIVER_TARGET_AVX
+#define HOLY_DIVER_TARGET_AVX2
+#endif
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64) || defined(HOLY_DIVER_AVX_DISPATCH)
+#include <immintrin.h>
+#endif
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <intrin.h>
+#include <io.h>
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// =====================
+// Utility
+// =====================
+
+struct Position {
+    int x = -1;
+    int y = -1;
+
+    bool operator==(const Position& other) const {
+        return x == other.x && y == other.y;
+    }
+};
+
+// Whether the CPU and the OS support AVX and AVX2. Checked once.
+class CpuFeatures {
+public:
+    static bool hasAvx() {
+        static const bool supported = detect(false);
+        return supported;
+    }
+
+    static bool hasAvx2() {
+        static const bool supported = detect(true);
+        return supported;
+    }
+
+private:
+    static bool detect(bool avx2) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_cpu_init();
+        return avx2 ? __builtin_cpu_supports("avx2") != 0 : __builtin_cpu_supports("avx") != 0;
+#elif defined(_MSC_VER) && defined(_M_X64)
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+        __cpuid(info, 1);
+        bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+        if (!osSavesYmm || (info[2] & (1 << 28)) == 0) {
+            return false;
+        }
+        if (!avx2) {
+            return true;
+        }
+        if (maxLeaf < 7) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        (void)avx2;
+        return false;
+#endif
+    }
+};
+
+// Small per-entity random stream (splitmix64). Each enemy owns one, so
+// enemies can be updated on any thread and still produce the same rolls.
+class RandomStream {
+public:
+    RandomStream() = default;
+
+    explicit RandomStream(uint64_t seed)
+        : state(seed) {
+    }
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    int nextInt(int left, int right) {
+        uint64_t span = static_cast<uint64_t>(right - left) + 1;
+        return left + static_cast<int>(next() % span);
+    }
+
+    uint64_t getState() const {
+        return state;
+    }
+
+private:
+    uint64_t state = 0;
+};
+
+// Zobrist-style keys for state hashing. Keys are derived from a mixing
+// function instead of a random table, so they cost no memory on huge maps.
+class Zobrist {
+public:
+    enum Feature : uint64_t {
+        PlayerPosition = 1,
+        PlayerHealth,
+        PlayerOxygen,
+        PlayerBattery,
+        PlayerScore,
+        EnemyCell,
+        EnemyActive,
+        VisibleCell,
+        ItemCell
+    };
+
+    static uint64_t key(Feature feature, uint64_t value) {
+        uint64_t z = value + static_cast<uint64_t>(feature) * 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    static uint64_t pack(int high, int low) {
+        return static_cast<uint64_t>(static_cast<uint32_t>(high)) << 32 | static_cast<uint32_t>(low);
+    }
+};
+
+// Worker threads shared by the whole process. They start on first use and
+// then wait for jobs, so a parallel phase that runs every turn does not
+// create threads every turn.
+class WorkerPool {
+public:
+    // Never destroyed: joining threads from a static destructor can hang
+    // when the engine is unloaded as a library.
+    static WorkerPool& instance() {
+        static WorkerPool* pool = new WorkerPool();
+        return *pool;
+    }
+
+    // Calls task(context, i) for every i in [0, count) on up to `threads`
+    // threads, the calling one included, and returns when all calls are done.
+    // Tasks may start jobs of their own.
+    void run(size_t count, size_t threads, void (*task)(void*, size_t), void* context) {
+        Job job;
+        job.task = task;
+        job.context = context;
+        job.count = count;
+
+        {
+            lock_guard<mutex> lock(guard);
+            while (workers.size() + 1 < threads) {
+                workers.emplace_back([this] { workLoop(); });
+            }
+            jobs.push_back(&job);
+        }
+        wake.notify_all();
+
+        runTasks(job);
+
+        unique_lock<mutex> lock(guard);
+        removeJob(&job);
+        finished.wait(lock, [&job] { return job.helpers == 0; });
+    }
+
+private:
+    struct Job {
+        void (*task)(void*, size_t) = nullptr;
+        void* context = nullptr;
+        size_t count = 0;
+        atomic<size_t> next{ 0 };
+        size_t helpers = 0;      // workers inside runTasks, under guard
+    };
+
+    WorkerPool() = default;
+
+    void workLoop() {
+        unique_lock<mutex> lock(guard);
+        while (true) {
+            wake.wait(lock, [this] { return !jobs.empty(); });
+
+            Job* job = jobs.front();
+            job->helpers++;
+            lock.unlock();
+
+            runTasks(*job);
+
+            lock.lock();
+            removeJob(job);
+            job->helpers--;
+            if (job->helpers == 0) {
+                finished.notify_all();
+            }
+        }
+    }
+
+    static void runTasks(Job& job) {
+        for (size_t i = job.next++; i < job.count; i = job.next++) {
+            job.task(job.context, i);
+        }
+    }
+
+    // A job leaves the queue once every task has been claimed.
+    void removeJob(Job* job) {
+        auto found = find(jobs.begin(), jobs.end(), job);
+        if (found != jobs.end()) {
+            jobs.erase(found);
+        }
+    }
+
+    mutex guard;
+    condition_variable wake;
+    condition_variable finished;
+    deque<Job*> jobs;
+    vector<thread> workers;
+};
+
+class Parallel {
+public:
+    // 0 means "use all hardware threads".
+    static unsigned& threadLimit() {
+        static unsigned limit = 0;
+        return limit;
+    }
+
+    // Splits [0, count) into contiguous ranges and calls fn(begin, end) for
+    // each of them on the worker pool. Small ranges run on the calling thread.
+    template <typename Fn>
+    static void forRange(size_t count, size_t minChunk, Fn fn) {
+        size_t threads = threadLimit() != 0 ? threadLimit() : thread::hardware_concurrency();
+        if (minChunk == 0) {
+            minChunk = 1;
+        }
+        threads = min(threads, count / minChunk);
+
+        if (threads <= 1) {
+            fn(size_t(0), count);
+            return;
+        }
+
+        struct Ranges {
+            Fn* fn;
+            size_t count;
+            size_t chunk;
+        } ranges = { &fn, count, (count + threads - 1) / threads };
+
+        size_t pieces = (count + ranges.chunk - 1) / ranges.chunk;
+        WorkerPool::instance().run(pieces, threads, [](void* context, size_t piece) {
+            Ranges& r = *static_cast<Ranges*>(context);
+            size_t begin = piece * r.chunk;
+            (*r.fn)(begin, min(r.count, begin + r.chunk));
+        }, &ranges);
+    }
+};
+
+#endif
@@ -0,0 +1,464 @@
+#ifndef HOLY_DIVER_DISTANCE_CACHE_H
+#define HOLY_DIVER_DISTANCE_CACHE_H
+
+#include "path_hierarchy.h"
+
+// =====================
+// Distance cache
+// =====================
+
+// Walking distances over a level's terrain (walls only; entities move and
+// are ignored). Built once per level and shared: World looks caches up by
+// level path and terrain hash, so reload() and other Worlds playing the
+// same level reuse the same instance.
+//
+// Built up front: connected-component labels and a distance field from the
+// start (16-bit, saturating). Added on first use, while they fit both
+// MAX_FIELD_ENTRIES and the memory budget: a field per queried source
+// (see distanceFromSource) and fields from a few far-apart landmarks that give an
+// ALT lower bound for point-to-point A* queries. Maps too large for the
+// landmark fields get a PathHierarchy instead.
+class DistanceCache {
+public:
+    static constexpr uint16_t UNREACHABLE = 0xFFFF;
+    static constexpr uint16_t SATURATED = 0xFFFE;
+    static constexpr size_t LANDMARK_COUNT = 8;
+    static constexpr size_t MAX_FIELD_ENTRIES = size_t(1) << 26;
+
+    // The registry lock is only held for lookups. A cache being built is
+    // found through its future, so a second World asking for the same level
+    // waits for that build instead of starting its own, and Worlds loading
+    // other levels do not wait at all. A build that throws is not kept.
+    static shared_ptr<const DistanceCache> acquire(const string& levelPath, int width, int height,
+        const uint64_t* wallBits, size_t wordsPerRow, Position start) {
+        uint64_t terrainHash = Zobrist::key(Zobrist::VisibleCell, Zobrist::pack(width, height));
+        for (size_t i = 0; i < wordsPerRow * height; ++i) {
+            terrainHash = Zobrist::key(Zobrist::VisibleCell, terrainHash ^ wallBits[i]);
+        }
+        terrainHash ^= Zobrist::key(Zobrist::PlayerPosition, Zobrist::pack(start.x, start.y));
+
+        Registry& registry = sharedRegistry();
+        auto key = make_pair(levelPath, terrainHash);
+        promise<shared_ptr<const DistanceCache>> result;
+        shared_future<shared_ptr<const DistanceCache>> inFlight;
+        {
+            lock_guard<mutex> lock(registry.guard);
+            shared_ptr<const DistanceCache> cache = registry.caches[key].lock();
+            if (cache) {
+                return cache;
+            }
+
+            auto found = registry.building.find(key);
+            if (found != registry.building.end()) {
+                inFlight = found->second;
+            }
+            else {
+                registry.building[key] = result.get_future().share();
+            }
+        }
+        if (inFlight.valid()) {
+            return inFlight.get();
+        }
+
+        shared_ptr<DistanceCache> built;
+        try {
+            built.reset(new DistanceCache(width, height, wallBits, wordsPerRow));
+            built->build(start);
+            built->updateMemoryAccount();
+        }
+        catch (...) {
+            // Waiting Worlds get the same exception, and the next load of
+            // the level starts a fresh build.
+            {
+                lock_guard<mutex> lock(registry.guard);
+                registry.building.erase(key);
+            }
+            result.set_exception(current_exception());
+            throw;
+        }
+        {
+            lock_guard<mutex> lock(registry.guard);
+            registry.caches[key] = built;
+            registry.building.erase(key);
+        }
+        result.set_value(built);
+        return built;
+    }
+
+    size_t memoryUsage() const {
+        size_t bytes = heapBytes(walls) + heapBytes(components) + heapBytes(startField);
+        if (landmarksReady) {
+            bytes += heapBytes(landmarkFields);
+            for (const vector<uint16_t>& field : landmarkFields) {
+                bytes += heapBytes(field);
+            }
+        }
+        if (hierarchy) {
+            bytes += sizeof(PathHierarchy) + hierarchy->memoryUsage();
+        }
+
+        lock_guard<mutex> lock(fieldGuard);
+        // Buckets plus one node (key, pointer, next pointer) and the
+        // vector per field.
+        bytes += sourceFields.bucket_count() * sizeof(void*);
+        for (const auto& entry : sourceFields) {
+            bytes += sizeof(entry) + sizeof(void*) + sizeof(vector<uint16_t>) + heapBytes(*entry.second);
+        }
+        return bytes;
+    }
+
+    bool isWalkable(int x, int y) const {
+        if (x < 0 || x >= width || y < 0 || y >= height) {
+            return false;
+        }
+        return ((walls[y * wordsPerRow + (x >> 6)] >> (x & 63)) & 1) == 0;
+    }
+
+    // -1 for walls and cells outside the map.
+    int component(int x, int y) const {
+        return isWalkable(x, y) ? components[cellIndex(x, y)] : -1;
+    }
+
+    bool connected(Position a, Position b) const {
+        int ca = component(a.x, a.y);
+        return ca != -1 && ca == component(b.x, b.y);
+    }
+
+    // -1 when unreachable; SATURATED means "at least that far".
+    int distanceFromStart(Position target) const {
+        return fieldValue(startField, target);
+    }
+
+    // Distance from a fixed source such as an item's original cell. The
+    // source's field is built on the first query; when it does not fit,
+    // falls back to a point query.
+    int distanceFromSource(Position source, Position target) const {
+        shared_ptr<const vector<uint16_t>> field = sourceField(source);
+        if (!field) {
+            return estimateDistance(source, target);
+        }
+        return fieldValue(*field, target);
+    }
+
+    // Walking distance from `from` to the closest of `targets`, -1 if none
+    // is reachable. One breadth-first search that stops at the first target
+    // it reaches, so its cost follows that distance rather than the number
+    // of targets.
+    int nearestDistance(Position from, const vector<Position>& targets) const {
+        vector<int> goals;
+        for (Position target : targets) {
+            if (connected(from, target)) {
+                goals.push_back(static_cast<int>(cellIndex(target.x, target.y)));
+            }
+        }
+        if (goals.empty()) {
+            return -1;
+        }
+        sort(goals.begin(), goals.end());
+
+        vector<uint64_t> seen((cellCount() + 63) / 64, 0);
+        vector<int> frontier(1, static_cast<int>(cellIndex(from.x, from.y)));
+        seen[frontier[0] >> 6] |= uint64_t(1) << (frontier[0] & 63);
+        int depth = 0;
+        size_t depthEnd = 1;
+        for (size_t head = 0; head < frontier.size(); ++head) {
+            if (head == depthEnd) {
+                depth++;
+                depthEnd = frontier.size();
+            }
+            int cell = frontier[head];
+            if (binary_search(goals.begin(), goals.end(), cell)) {
+                return depth;
+            }
+            forEachNeighbour(cell, [&](int neighbour) {
+                uint64_t bit = uint64_t(1) << (neighbour & 63);
+                if ((seen[neighbour >> 6] & bit) == 0) {
+                    seen[neighbour >> 6] |= bit;
+                    frontier.push_back(neighbour);
+                }
+            });
+        }
+        return -1;
+    }
+
+    // Near-optimal distance from the path hierarchy on large maps, the
+    // exact distance() otherwise. -1 if there is no path.
+    int estimateDistance(Position from, Position to) const {
+        if (!connected(from, to)) {
+            return -1;
+        }
+        return hierarchy ? hierarchy->distance(from, to) : distance(from, to);
+    }
+
+    // Null unless the map was too large for landmark fields.
+    const PathHierarchy* getHierarchy() const {
+        return hierarchy.get();
+    }
+
+    // Exact walking distance via A* with the landmark bound, -1 if there is
+    // no path.
+    int distance(Position from, Position to) const {
+        if (!connected(from, to)) {
+            return -1;
+        }
+        call_once(landmarksOnce, [this] { pickLandmarks(); });
+
+        typedef pair<int, int> Entry; // (f, cell)
+        priority_queue<Entry, vector<Entry>, greater<Entry>> open;
+        unordered_map<int, int> best;
+
+        int start = static_cast<int>(cellIndex(from.x, from.y));
+        int goal = static_cast<int>(cellIndex(to.x, to.y));
+        best[start] = 0;
+        open.push({ lowerBound(from, to), start });
+
+        static const int dirs[4][2] = { {0, -1}, {0, 1}, {-1, 0}, {1, 0} };
+
+        while (!open.empty()) {
+            int cell = open.top().second;
+            int f = open.top().first;
+            open.pop();
+
+            int g = best[cell];
+            Position here{ cell % width, cell / width };
+            if (f > g + lowerBound(here, to)) {
+                continue; // stale entry
+            }
+            if (cell == goal) {
+                return g;
+            }
+
+            for (const auto& dir : dirs) {
+                Position next{ here.x + dir[0], here.y + dir[1] };
+                if (!isWalkable(next.x, next.y)) {
+                    continue;
+                }
+                int nextCell = static_cast<int>(cellIndex(next.x, next.y));
+                auto found = best.find(nextCell);
+                if (found == best.end() || g + 1 < found->second) {
+                    best[nextCell] = g + 1;
+                    open.push({ g + 1 + lowerBound(next, to), nextCell });
+                }
+            }
+        }
+
+        return -1;
+    }
+
+    // Admissible estimate: Manhattan distance or the landmark triangle
+    // inequality, whichever is larger.
+    int lowerBound(Position a, Position b) const {
+        int bound = abs(a.x - b.x) + abs(a.y - b.y);
+        if (!landmarksReady) {
+            return bound;
+        }
+        for (const vector<uint16_t>& field : landmarkFields) {
+            int da = field[cellIndex(a.x, a.y)];
+            int db = field[cellIndex(b.x, b.y)];
+            if (da != UNREACHABLE && db != UNREACHABLE) {
+                bound = max(bound, abs(da - db));
+            }
+        }
+        return bound;
+    }
+
+private:
+    typedef pair<string, uint64_t> Key;
+
+    struct Registry {
+        mutex guard;
+        map<Key, weak_ptr<const DistanceCache>> caches;
+        map<Key, shared_future<shared_ptr<const DistanceCache>>> building;
+    };
+
+    static Registry& sharedRegistry() {
+        static Registry registry;
+        return registry;
+    }
+
+    DistanceCache(int mapWidth, int mapHeight, const uint64_t* wallBits, size_t rowWords)
+        : width(mapWidth), height(mapHeight), wordsPerRow(rowWords), walls(wallBits, wallBits + rowWords * mapHeight) {
+    }
+
+    size_t cellCount() const {
+        return static_cast<size_t>(width) * height;
+    }
+
+    void updateMemoryAccount() const {
+        size_t bytes = memoryUsage();
+        lock_guard<mutex> lock(fieldGuard);
+        account.set(bytes);
+    }
+
+    size_t cellIndex(int x, int y) const {
+        return static_cast<size_t>(y) * width + x;
+    }
+
+    int fieldValue(const vector<uint16_t>& field, Position target) const {
+        if (!isWalkable(target.x, target.y)) {
+            return -1;
+        }
+        uint16_t value = field[cellIndex(target.x, target.y)];
+        return value == UNREACHABLE ? -1 : value;
+    }
+
+    void build(Position start) {
+        labelComponents();
+        startField = distanceField(start);
+
+        if ((1 + LANDMARK_COUNT) * cellCount() > MAX_FIELD_ENTRIES) {
+            hierarchy.reset(new PathHierarchy(width, height, walls, wordsPerRow));
+            hierarchy->build();
+        }
+    }
+
+    // Field entries already stored: the start field, the source fields and
+    // the landmark fields if they may still be built.
+    size_t storedFieldEntries() const {
+        return (1 + sourceFields.size() + (hierarchy ? 0 : LANDMARK_COUNT)) * cellCount();
+    }
+
+    shared_ptr<const vector<uint16_t>> sourceField(Position source) const {
+        size_t key = cellIndex(source.x, source.y);
+        size_t fieldBytes = cellCount() * sizeof(uint16_t);
+        {
+            lock_guard<mutex> lock(fieldGuard);
+            auto it = sourceFields.find(key);
+            if (it != sourceFields.end()) {
+                return it->second;
+            }
+            if (storedFieldEntries() + cellCount() > MAX_FIELD_ENTRIES || !MemoryBudget::fits(fieldBytes)) {
+                return nullptr;
+            }
+        }
+
+        // Built outside the lock; if another thread got there first its
+        // field is kept.
+        shared_ptr<const vector<uint16_t>> field = make_shared<const vector<uint16_t>>(distanceField(source));
+        {
+            lock_guard<mutex> lock(fieldGuard);
+            field = sourceFields.emplace(key, field).first->second;
+        }
+        updateMemoryAccount();
+        return field;
+    }
+
+    // Farthest-point selection inside the start's component: each new
+    // landmark is the cell farthest from all landmarks chosen so far. Runs
+    // on the first A* query, and only if the fields fit the budget.
+    void pickLandmarks() const {
+        if (hierarchy || !MemoryBudget::fits(LANDMARK_COUNT * cellCount() * sizeof(uint16_t))) {
+            return;
+        }
+
+        vector<uint16_t> nearest = startField;
+        for (size_t i = 0; i < LANDMARK_COUNT; ++i) {
+            size_t farthest = 0;
+            uint16_t farthestDistance = 0;
+            for (size_t cell = 0; cell < nearest.size(); ++cell) {
+                if (nearest[cell] != UNREACHABLE && nearest[cell] > farthestDistance) {
+                    farthest = cell;
+                    farthestDistance = nearest[cell];
+                }
+            }
+            if (farthestDistance == 0) {
+                break;
+            }
+
+            Position landmark{ static_cast<int>(farthest % width), static_cast<int>(farthest / width) };
+            landmarkFields.push_back(distanceField(landmark));
+
+            const vector<uint16_t>& field = landmarkFields.back();
+            for (size_t cell = 0; cell < nearest.size(); ++cell) {
+                nearest[cell] = min(nearest[cell], field[cell]);
+            }
+        }
+        landmarksReady = true;
+        updateMemoryAccount();
+    }
+
+    void labelComponents() {
+        components.assign(static_cast<size_t>(width) * height, -1);
+        vector<int> frontier;
+        int next = 0;
+
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (!isWalkable(x, y) || components[cellIndex(x, y)] != -1) {
+                    continue;
+                }
+
+                frontier.assign(1, static_cast<int>(cellIndex(x, y)));
+                components[frontier[0]] = next;
+                while (!frontier.empty()) {
+                    int cell = frontier.back();
+                    frontier.pop_back();
+                    forEachNeighbour(cell, [&](int neighbour) {
+                        if (components[neighbour] == -1) {
+                            components[neighbour] = next;
+                            frontier.push_back(neighbour);
+                        }
+                    });
+                }
+                next++;
+            }
+        }
+    }
+
+    vector<uint16_t> distanceField(Position source) const {
+        vector<uint16_t> field(static_cast<size_t>(width) * height, static_cast<uint16_t>(UNREACHABLE));
+        if (!isWalkable(source.x, source.y)) {
+            return field;
+        }
+
+        vector<int> frontier(1, static_cast<int>(cellIndex(source.x, source.y)));
+        field[frontier[0]] = 0;
+        for (size_t head = 0; head < frontier.size(); ++head) {
+            int cell = frontier[head];
+            uint16_t nextDistance = field[cell] >= SATURATED - 1 ? SATURATED : static_cast<uint16_t>(field[cell] + 1);
+            forEachNeighbour(cell, [&](int neighbour) {
+                if (field[neighbour] == UNREACHABLE) {
+                    field[neighbour] = nextDistance;
+                    frontier.push_back(neighbour);
+                }
+            });
+        }
+        return field;
+    }
+
+    template <typename Fn>
+    void forEachNeighbour(int cell, Fn fn) const {
+        int x = cell % width;
+        int y = cell / width;
+        if (isWalkable(x, y - 1)) {
+            fn(cell - width);
+        }
+        if (isWalkable(x, y + 1)) {
+            fn(cell + width);
+        }
+        if (isWalkable(x - 1, y)) {
+            fn(cell - 1);
+        }
+        if (isWalkable(x + 1, y)) {
+            fn(cell + 1);
+        }
+    }
+
+    int width;
+    int height;
+    size_t wordsPerRow;
+    vector<uint64_t> walls;
+    vector<int> components;
+    vector<uint16_t> startField;
+    unique_ptr<PathHierarchy> hierarchy;
+
+    // Grown lazily by const queries from any thread.
+    mutable mutex fieldGuard;
+    mutable unordered_map<size_t, shared_ptr<const vector<uint16_t>>> sourceFields;
+    mutable once_flag landmarksOnce;
+    mutable vector<vector<uint16_t>> landmarkFields;
+    mutable atomic<bool> landmarksReady{ false };
+    mutable MemoryAccount account;
+};
+
+#endif
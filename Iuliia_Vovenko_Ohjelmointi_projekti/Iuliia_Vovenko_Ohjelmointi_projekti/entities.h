@@ -0,0 +1,629 @@
+#ifndef HOLY_DIVER_ENTITIES_H
+#define HOLY_DIVER_ENTITIES_H
+
+#include "common.h"
+
+// =====================
+// Forward declarations
+// =====================
+
+class World;
+
+// =====================
+// Player
+// =====================
+
+class Player {
+public:
+    static constexpr int MAX_HEALTH = 100;
+    static constexpr int MAX_OXYGEN = 100;
+    static constexpr int MAX_BATTERY = 100;
+
+    Player() {
+        hash = computeHash();
+    }
+
+    // Caps used by reset, refills and pickups; the defaults are the MAX_*
+    // constants unless a GameConfig says otherwise.
+    void setLimits(int healthLimit, int oxygenLimit, int batteryLimit) {
+        maxHealth = healthLimit;
+        maxOxygen = oxygenLimit;
+        maxBattery = batteryLimit;
+    }
+
+    void reset() {
+        setStat(health, maxHealth, Zobrist::PlayerHealth);
+        setStat(oxygen, maxOxygen, Zobrist::PlayerOxygen);
+        setStat(battery, maxBattery, Zobrist::PlayerBattery);
+        setStat(score, 0, Zobrist::PlayerScore);
+        setPosition({ -1, -1 });
+    }
+
+    void resetPositionOnly() {
+        setPosition({ -1, -1 });
+    }
+
+    void refillForNewLevel() {
+        setStat(oxygen, maxOxygen, Zobrist::PlayerOxygen);
+        setStat(battery, maxBattery, Zobrist::PlayerBattery);
+    }
+
+    void setPosition(Position p) {
+        hash ^= Zobrist::key(Zobrist::PlayerPosition, Zobrist::pack(pos.x, pos.y));
+        pos = p;
+        hash ^= Zobrist::key(Zobrist::PlayerPosition, Zobrist::pack(pos.x, pos.y));
+    }
+
+    void restore(Position p, int savedHealth, int savedOxygen, int savedBattery, int savedScore) {
+        setStat(health, savedHealth, Zobrist::PlayerHealth);
+        setStat(oxygen, savedOxygen, Zobrist::PlayerOxygen);
+        setStat(battery, savedBattery, Zobrist::PlayerBattery);
+        setStat(score, savedScore, Zobrist::PlayerScore);
+        setPosition(p);
+    }
+
+    // Kept up to date by every mutator below.
+    uint64_t getHash() const {
+        return hash;
+    }
+
+    uint64_t computeHash() const {
+        return Zobrist::key(Zobrist::PlayerPosition, Zobrist::pack(pos.x, pos.y))
+            ^ Zobrist::key(Zobrist::PlayerHealth, static_cast<uint32_t>(health))
+            ^ Zobrist::key(Zobrist::PlayerOxygen, static_cast<uint32_t>(oxygen))
+            ^ Zobrist::key(Zobrist::PlayerBattery, static_cast<uint32_t>(battery))
+            ^ Zobrist::key(Zobrist::PlayerScore, static_cast<uint32_t>(score));
+    }
+
+    const Position& getPosition() const {
+        return pos;
+    }
+
+    int getHealth() const {
+        return health;
+    }
+
+    int getOxygen() const {
+        return oxygen;
+    }
+
+    int getBattery() const {
+        return battery;
+    }
+
+    int getScore() const {
+        return score;
+    }
+
+    void addScore(int amount) {
+        setStat(score, max(0, score + amount), Zobrist::PlayerScore);
+    }
+
+    void takeDamage(int amount) {
+        setStat(health, max(0, health - amount), Zobrist::PlayerHealth);
+    }
+
+    void consumeOxygen(int amount) {
+        setStat(oxygen, max(0, oxygen - amount), Zobrist::PlayerOxygen);
+    }
+
+    void addOxygen(int amount) {
+        int value = oxygen + amount;
+        if (value > maxOxygen) {
+            value = maxOxygen;
+        }
+        setStat(oxygen, value, Zobrist::PlayerOxygen);
+    }
+
+    void addBattery(int amount) {
+        int value = battery + amount;
+        if (value > maxBattery) {
+            value = maxBattery;
+        }
+        setStat(battery, value, Zobrist::PlayerBattery);
+    }
+
+    bool canSpendBattery(int amount) const {
+        return battery >= amount;
+    }
+
+    void spendBattery(int amount) {
+        setStat(battery, max(0, battery - amount), Zobrist::PlayerBattery);
+    }
+
+    bool isDead() const {
+        return health <= 0 || oxygen <= 0;
+    }
+
+private:
+    void setStat(int& field, int value, Zobrist::Feature feature) {
+        hash ^= Zobrist::key(feature, static_cast<uint32_t>(field));
+        field = value;
+        hash ^= Zobrist::key(feature, static_cast<uint32_t>(field));
+    }
+
+    int maxHealth = MAX_HEALTH;
+    int maxOxygen = MAX_OXYGEN;
+    int maxBattery = MAX_BATTERY;
+    int health = MAX_HEALTH;
+    int oxygen = MAX_OXYGEN;
+    int battery = MAX_BATTERY;
+    int score = 0;
+    Position pos;
+    uint64_t hash = 0;
+};
+
+// =====================
+// Type registry
+// =====================
+
+// Item and enemy kinds are described by plain structs with compile-time
+// stats and static behaviour. A registry turns a list of them into a
+// constexpr table indexed by kind for the stats, and dispatches behaviour
+// on the kind with direct calls, so there are no virtual or function
+// pointer calls and symbol classification folds to constants.
+template <typename Info, size_t Count>
+struct KindTable {
+    Info entries[Count];
+
+    constexpr size_t size() const {
+        return Count;
+    }
+
+    constexpr const Info& operator[](size_t kind) const {
+        return entries[kind];
+    }
+
+    // Kind of the first entry using this map symbol, or -1.
+    constexpr int kindForSymbol(char symbol) const {
+        for (size_t kind = 0; kind < Count; ++kind) {
+            if (entries[kind].symbol == symbol) {
+                return static_cast<int>(kind);
+            }
+        }
+        return -1;
+    }
+
+};
+
+// Calls fn(Kind()) with the type at index `kind` of the list. This is a
+// chain of compares that the compiler turns into a switch of direct,
+// inlinable calls.
+template <typename... Kinds>
+struct KindDispatch;
+
+template <typename Kind>
+struct KindDispatch<Kind> {
+    template <typename Fn>
+    static auto visit(size_t, Fn&& fn) {
+        return fn(Kind());
+    }
+};
+
+template <typename Kind, typename Next, typename... Rest>
+struct KindDispatch<Kind, Next, Rest...> {
+    template <typename Fn>
+    static auto visit(size_t kind, Fn&& fn) {
+        if (kind == 0) {
+            return fn(Kind());
+        }
+        return KindDispatch<Next, Rest...>::visit(kind - 1, std::forward<Fn>(fn));
+    }
+};
+
+// =====================
+// Items
+// =====================
+
+// value and scoreValue are defaults; GameConfig can override them.
+struct ItemInfo {
+    const char* name;
+    char symbol;
+    int value;
+    int scoreValue;
+    const char* pickupText;
+    // Keeps the water around it rich in oxygen while it lies on the map.
+    bool oxygenSource;
+};
+
+struct OxygenItem {
+    static constexpr const char* name = "oxygen_item";
+    static constexpr char symbol = 'O';
+    static constexpr int value = 25;
+    static constexpr int scoreValue = 10;
+    static constexpr const char* pickupText = "Picked up extra oxygen!";
+    static constexpr bool oxygenSource = true;
+
+    static void apply(Player& player, int amount) {
+        player.addOxygen(amount);
+    }
+};
+
+struct BatteryItem {
+    static constexpr const char* name = "battery_item";
+    static constexpr char symbol = 'B';
+    static constexpr int value = 20;
+    static constexpr int scoreValue = 10;
+    static constexpr const char* pickupText = "Picked up battery!";
+    static constexpr bool oxygenSource = false;
+
+    static void apply(Player& player, int amount) {
+        player.addBattery(amount);
+    }
+};
+
+// Every kind also has static void apply(Player&, int amount).
+template <typename... Kinds>
+struct ItemRegistry {
+    static constexpr KindTable<ItemInfo, sizeof...(Kinds)> table{ {
+        { Kinds::name, Kinds::symbol, Kinds::value, Kinds::scoreValue, Kinds::pickupText, Kinds::oxygenSource }...
+    } };
+
+    template <typename Fn>
+    static auto visit(size_t kind, Fn&& fn) {
+        return KindDispatch<Kinds...>::visit(kind, std::forward<Fn>(fn));
+    }
+};
+
+template <typename... Kinds>
+constexpr KindTable<ItemInfo, sizeof...(Kinds)> ItemRegistry<Kinds...>::table;
+
+// Order defines the kind ids stored in save files: append new kinds only.
+using ItemTypes = ItemRegistry<OxygenItem, BatteryItem>;
+
+// =====================
+// Enemies
+// =====================
+
+// damage is a default; GameConfig can override it. symbol places this kind
+// on a map; see Enemy::SYMBOL for enemies of a random kind.
+struct EnemyInfo {
+    const char* name;
+    char symbol;
+    int damage;
+};
+
+// What an enemy does on its turn: attack the diver `attacks` times, then
+// try to enter `target` (its own cell to stay).
+struct EnemyPlan {
+    Position target;
+    int attacks;
+};
+
+struct StationaryEnemy {
+    static constexpr const char* name = "stationary_enemy";
+    static constexpr char symbol = 'S';
+    static constexpr int damage = 10;
+
+    static EnemyPlan planMove(Position current, RandomStream&, const World&) {
+        // Stationary enemy does not move
+        return { current, 0 };
+    }
+};
+
+struct MovingEnemy {
+    static constexpr const char* name = "moving_enemy";
+    static constexpr char symbol = 'R';
+    static constexpr int damage = 10;
+
+    static EnemyPlan planMove(Position current, RandomStream& rng, const World& world);
+};
+
+// Every kind also has static EnemyPlan planMove(Position current,
+// RandomStream& rng, const World& world), returning what the enemy wants
+// to do this turn. It is called concurrently for different enemies, so it
+// may only read the world and use the enemy's own random stream.
+template <typename... Kinds>
+struct EnemyRegistry {
+    static constexpr KindTable<EnemyInfo, sizeof...(Kinds)> table{ {
+        { Kinds::name, Kinds::symbol, Kinds::damage }...
+    } };
+
+    template <typename Fn>
+    static auto visit(size_t kind, Fn&& fn) {
+        return KindDispatch<Kinds...>::visit(kind, std::forward<Fn>(fn));
+    }
+};
+
+template <typename... Kinds>
+constexpr KindTable<EnemyInfo, sizeof...(Kinds)> EnemyRegistry<Kinds...>::table;
+
+// Order defines the kind ids stored in save files: append new kinds only.
+using EnemyTypes = EnemyRegistry<StationaryEnemy, MovingEnemy>;
+
+// =====================
+// Configuration
+// =====================
+
+// Reads "key = value" lines. Blank lines and lines starting with '#' are
+// skipped.
+inline bool readSettings(const string& path, vector<pair<string, string>>& settings, string& error) {
+    ifstream in(path);
+    if (!in) {
+        error = "Failed to open settings file: " + path;
+        return false;
+    }
+
+    auto trim = [](const string& text) {
+        size_t first = text.find_first_not_of(" \t\r");
+        size_t last = text.find_last_not_of(" \t\r");
+        return first == string::npos ? string() : text.substr(first, last - first + 1);
+    };
+
+    string line;
+    int lineNumber = 0;
+    while (getline(in, line)) {
+        lineNumber++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == string::npos) {
+            error = path + ":" + to_string(lineNumber) + ": expected key = value";
+            return false;
+        }
+        settings.push_back({ trim(line.substr(0, equals)), trim(line.substr(equals + 1)) });
+    }
+
+    return true;
+}
+
+inline bool parseInt(const string& text, int& value) {
+    if (text.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    long parsed = strtol(text.c_str(), &end, 10);
+    if (*end != '\0' || parsed < numeric_limits<int>::min() || parsed > numeric_limits<int>::max()) {
+        return false;
+    }
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+// Gameplay constants. Defaults match the Player limits and the item and
+// enemy registries; a settings file can override any of them by key.
+struct GameConfig {
+    int maxHealth = Player::MAX_HEALTH;
+    int maxOxygen = Player::MAX_OXYGEN;
+    int maxBattery = Player::MAX_BATTERY;
+    int moveOxygenCost = 2;
+    int illuminateOxygenCost = 2;
+    int illuminateBatteryCost = 5;
+    int movingEnemyIdlePercent = 30;
+
+    // Dormancy, off by default. With a radius, active enemies further than
+    // that from the diver (Chebyshev distance) are not simulated, and catch
+    // up on at most fastForwardTurns of the turns they missed when they come
+    // back in range. 0 means every enemy and every missed turn.
+    int simulationRadius = 0;
+    int fastForwardTurns = 0;
+    // Enemies hunt from the first turn instead of waiting to be seen.
+    int enemiesStartAwake = 0;
+
+    // Ocean layer, off unless ocean = 1. Percentages per turn; see
+    // OceanField.
+    int oceanEnabled = 0;
+    int oceanDiffusionPercent = 20;
+    int oceanRecoveryPercent = 5;
+    int oceanBreathPercent = 30;
+    int oceanDriftPercent = 25;
+
+    int itemValue[ItemTypes::table.size()];
+    int itemScore[ItemTypes::table.size()];
+    int enemyDamage[EnemyTypes::table.size()];
+
+    GameConfig() {
+        for (size_t kind = 0; kind < ItemTypes::table.size(); ++kind) {
+            itemValue[kind] = ItemTypes::table[kind].value;
+            itemScore[kind] = ItemTypes::table[kind].scoreValue;
+        }
+        for (size_t kind = 0; kind < EnemyTypes::table.size(); ++kind) {
+            enemyDamage[kind] = EnemyTypes::table[kind].damage;
+        }
+    }
+
+    // Per-kind keys are "<name>_value", "<name>_score" for items and
+    // "<name>_damage" for enemies, e.g. oxygen_item_value.
+    int* field(const string& key) {
+        static const struct {
+            const char* key;
+            int GameConfig::* member;
+        } scalars[] = {
+            { "max_health", &GameConfig::maxHealth },
+            { "max_oxygen", &GameConfig::maxOxygen },
+            { "max_battery", &GameConfig::maxBattery },
+            { "move_oxygen_cost", &GameConfig::moveOxygenCost },
+            { "illuminate_oxygen_cost", &GameConfig::illuminateOxygenCost },
+            { "illuminate_battery_cost", &GameConfig::illuminateBatteryCost },
+            { "moving_enemy_idle_percent", &GameConfig::movingEnemyIdlePercent },
+            { "simulation_radius", &GameConfig::simulationRadius },
+            { "fast_forward_turns", &GameConfig::fastForwardTurns },
+            { "enemies_start_awake", &GameConfig::enemiesStartAwake },
+            { "ocean", &GameConfig::oceanEnabled },
+            { "ocean_diffusion_percent", &GameConfig::oceanDiffusionPercent },
+            { "ocean_recovery_percent", &GameConfig::oceanRecoveryPercent },
+            { "ocean_breath_percent", &GameConfig::oceanBreathPercent },
+            { "ocean_drift_percent", &GameConfig::oceanDriftPercent }
+        };
+
+        for (const auto& scalar : scalars) {
+            if (key == scalar.key) {
+                return &(this->*scalar.member);
+            }
+        }
+
+        for (size_t kind = 0; kind < ItemTypes::table.size(); ++kind) {
+            string name = ItemTypes::table[kind].name;
+            if (key == name + "_value") {
+                return &itemValue[kind];
+            }
+            if (key == name + "_score") {
+                return &itemScore[kind];
+            }
+        }
+
+        for (size_t kind = 0; kind < EnemyTypes::table.size(); ++kind) {
+            if (key == string(EnemyTypes::table[kind].name) + "_damage") {
+                return &enemyDamage[kind];
+            }
+        }
+
+        return nullptr;
+    }
+
+    bool set(const string& key, const string& text, string& error) {
+        int* target = field(key);
+        if (target == nullptr) {
+            error = "Unknown setting: " + key;
+            return false;
+        }
+        if (!parseInt(text, *target)) {
+            error = "Setting " + key + " needs an integer, got '" + text + "'";
+            return false;
+        }
+        return true;
+    }
+
+    bool loadFromFile(const string& path, string& error) {
+        vector<pair<string, string>> settings;
+        if (!readSettings(path, settings, error)) {
+            return false;
+        }
+        for (const auto& setting : settings) {
+            if (!set(setting.first, setting.second, error)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// =====================
+// Entities
+// =====================
+
+class Item {
+public:
+    Item(Position position, uint8_t itemKind)
+        : pos(position), kind(itemKind) {
+    }
+
+    const Position& getPosition() const {
+        return pos;
+    }
+
+    uint8_t getKind() const {
+        return kind;
+    }
+
+    const ItemInfo& info() const {
+        return ItemTypes::table[kind];
+    }
+
+    char getSymbol() const {
+        return info().symbol;
+    }
+
+    int getScoreValue(const GameConfig& config) const {
+        return config.itemScore[kind];
+    }
+
+    void apply(Player& player, const GameConfig& config) const {
+        int amount = config.itemValue[kind];
+        ItemTypes::visit(kind, [&](auto type) {
+            decltype(type)::apply(player, amount);
+        });
+        player.addScore(getScoreValue(config));
+    }
+
+private:
+    Position pos;
+    uint8_t kind = 0;
+};
+
+class Enemy {
+public:
+    // 'M' on a map is an enemy of a random kind, rolled per cell from the
+    // level seed as in the original game. Every enemy is drawn as 'M', so
+    // the player cannot tell the kinds apart.
+    static constexpr char SYMBOL = 'M';
+    static constexpr uint8_t RANDOM_KIND = 0xFF;
+
+    Enemy(Position position, uint8_t enemyKind, uint64_t seed)
+        : pos(position), kind(enemyKind), rng(seed) {
+    }
+
+    const Position& getPosition() const {
+        return pos;
+    }
+
+    void setPosition(Position p) {
+        pos = p;
+    }
+
+    uint8_t getKind() const {
+        return kind;
+    }
+
+    const EnemyInfo& info() const {
+        return EnemyTypes::table[kind];
+    }
+
+    int giveDamage(const GameConfig& config) const {
+        return config.enemyDamage[kind];
+    }
+
+    char getSymbol() const {
+        return SYMBOL;
+    }
+
+    bool isActive() const {
+        return active;
+    }
+
+    void activate() {
+        active = true;
+    }
+
+    int getLastSimulatedTurn() const {
+        return lastSimulatedTurn;
+    }
+
+    void markSimulated(int turn) {
+        lastSimulatedTurn = turn;
+    }
+
+    uint64_t getRandomState() const {
+        return rng.getState();
+    }
+
+    void setRandomState(uint64_t state) {
+        rng = RandomStream(state);
+    }
+
+    // Puts back state taken earlier, e.g. when a turn is undone.
+    void restore(Position p, bool wasActive, int simulatedTurn, uint64_t randomState) {
+        pos = p;
+        active = wasActive;
+        lastSimulatedTurn = simulatedTurn;
+        rng = RandomStream(randomState);
+    }
+
+    EnemyPlan planMove(const World& world) {
+        return EnemyTypes::visit(kind, [&](auto type) {
+            return decltype(type)::planMove(pos, rng, world);
+        });
+    }
+
+private:
+    Position pos;
+    uint8_t kind = 0;
+    bool active = false;
+    int lastSimulatedTurn = 0;
+    RandomStream rng;
+};
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef HOLY_DIVER_EVENT_JOURNAL_H
+#define HOLY_DIVER_EVENT_JOURNAL_H
+
+#include "save_file.h"
+
+// =====================
+// Event journal
+// =====================
+
+// Binary log of rule events (hits, pickups, illumination, level changes,
+// deaths) for working out afterwards why a dive ended. Every thread that
+// records gets its own single-producer ring per journal, so recording is a
+// few stores and never takes a lock; a background thread drains the rings
+// in batches into the file, writing without holding any lock the
+// recording threads need. When a ring is full the event is dropped and
+// counted.
+//
+// File layout: a header (magic, version, event size), then batches of
+// (ring id, event count, raw events) in host byte order.
+class EventJournal {
+public:
+    enum Type : uint8_t {
+        LevelStart,     // amount: items on the level
+        Bump,           // the diver walked into an enemy; amount: damage
+        EnemyHit,       // an enemy attacked; amount: damage
+        Pickup,         // amount: score gained
+        Illuminate,     // amount: battery spent
+        Drift,          // the current moved the diver
+        Rewind,         // amount: turns undone
+        LevelComplete,
+        Death,          // kind: 0 health, 1 oxygen
+        TYPE_COUNT
+    };
+
+    // Player stats are the values right after the event. No implicit
+    // padding, so the bytes written are exactly the fields.
+    struct Event {
+        uint32_t turn;
+        uint8_t type;
+        uint8_t kind;
+        uint16_t reserved;  // 0
+        int32_t amount;
+        int32_t x;
+        int32_t y;
+        int32_t health;
+        int32_t oxygen;
+    };
+
+    static constexpr uint32_t MAGIC = 0x4A454448; // "HDEJ"
+    static constexpr uint32_t VERSION = 2;
+    static constexpr size_t RING_CAPACITY = 16384;
+
+    EventJournal()
+        : id(nextJournalId().fetch_add(1)) {
+    }
+
+    EventJournal(const EventJournal&) = delete;
+    EventJournal& operator=(const EventJournal&) = delete;
+
+    // Threads still holding a lease drop it the next time they record to
+    // any journal, or when they end.
+    ~EventJournal() {
+        close();
+        lock_guard<mutex> lock(ringsGuard);
+        for (const shared_ptr<Ring>& ring : rings) {
+            ring->retired.store(true, memory_order_release);
+        }
+    }
+
+    bool open(const string& path, string& error) {
+        close();
+        file = fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            error = "Failed to open journal file: " + path;
+            return false;
+        }
+
+        uint32_t header[3] = { MAGIC, VERSION, static_cast<uint32_t>(sizeof(Event)) };
+        fwrite(header, sizeof(header), 1, file);
+        stopping = false;
+        flusher = thread([this]() { flushLoop(); });
+        return true;
+    }
+
+    bool isOpen() const {
+        return file != nullptr;
+    }
+
+    // Writes out everything recorded so far and closes the file.
+    void close() {
+        if (file == nullptr) {
+            return;
+        }
+        {
+            lock_guard<mutex> lock(guard);
+            stopping = true;
+        }
+        wake.notify_one();
+        flusher.join();
+        fclose(file);
+        file = nullptr;
+    }
+
+    void record(const Event& event) {
+        Ring& ring = ringForThisThread();
+        uint64_t head = ring.head.load(memory_order_relaxed);
+        uint64_t used = head - ring.tail.load(memory_order_acquire);
+        if (used == RING_CAPACITY) {
+            dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+        ring.events[head % RING_CAPACITY] = event;
+        ring.head.store(head + 1, memory_order_release);
+
+        // Half full: flush early rather than wait for the timer.
+        if (used == RING_CAPACITY / 2) {
+            flushRequested.store(true, memory_order_relaxed);
+            wake.notify_one();
+        }
+    }
+
+    uint64_t droppedCount() const {
+        return dropped.load(memory_order_relaxed);
+    }
+
+    static const char* typeName(uint8_t type) {
+        static const char* const names[TYPE_COUNT] = {
+            "level_start", "bump", "enemy_hit", "pickup", "illuminate", "drift", "rewind", "level_complete", "death"
+        };
+        return type < TYPE_COUNT ? names[type] : "unknown";
+    }
+
+    // Turns a journal file into CSV, one row per event.
+    static bool decode(const string& path, ostream& csv, string& error) {
+        MappedFile mapped;
+        if (!mapped.open(path)) {
+            error = "Failed to open journal file: " + path;
+            return false;
+        }
+
+        ByteReader in(mapped.data(), mapped.size());
+        if (in.get<uint32_t>() != MAGIC || in.get<uint32_t>() != VERSION || in.get<uint32_t>() != sizeof(Event)) {
+            error = "Not a Holy Diver journal: " + path;
+            return false;
+        }
+
+        csv << "thread,turn,event,kind,amount,x,y,health,oxygen\n";
+        while (in.isOk() && !in.atEnd()) {
+            uint32_t ring = in.get<uint32_t>();
+            uint32_t count = in.get<uint32_t>();
+            for (uint32_t i = 0; i < count && in.isOk(); ++i) {
+                Event event = in.get<Event>();
+                if (!in.isOk()) {
+                    break;
+                }
+                csv << ring << "," << event.turn << "," << typeName(event.type) << "," << int(event.kind) << ","
+                    << event.amount << "," << event.x << "," << event.y << "," << event.health << ","
+                    << event.oxygen << "\n";
+            }
+        }
+
+        if (!in.isOk()) {
+            error = "Journal is truncated: " + path;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr int FLUSH_INTERVAL_MS = 50;
+
+    struct Ring {
+        Event events[RING_CAPACITY];
+        atomic<uint64_t> head{ 0 };
+        atomic<uint64_t> tail{ 0 };
+        // Held by one live thread at a time; a thread that ends hands its
+        // ring to the next one that registers.
+        atomic<bool> leased{ false };
+        // Set when the journal is destroyed.
+        atomic<bool> retired{ false };
+    };
+
+    struct Lease {
+        uint64_t journal;
+        shared_ptr<Ring> ring;
+    };
+
+    // The calling thread's rings, one per journal it records to; a thread
+    // rarely records to more than one or two. The rings are handed back
+    // when the thread ends. Recording threads are the game thread and the
+    // persistent WorkerPool threads, so the ring list stays at one ring per
+    // thread. Shares ownership of the rings in case a thread outlives a
+    // journal.
+    struct Leases {
+        vector<Lease> held;
+
+        ~Leases() {
+            for (const Lease& lease : held) {
+                lease.ring->leased.store(false, memory_order_release);
+            }
+        }
+    };
+
+    static atomic<uint64_t>& nextJournalId() {
+        static atomic<uint64_t> next{ 1 };
+        return next;
+    }
+
+    Ring& ringForThisThread() {
+        thread_local Leases leases;
+        for (const Lease& lease : leases.held) {
+            if (lease.journal == id) {
+                return *lease.ring;
+            }
+        }
+
+        // First event from this thread: forget journals that are gone.
+        leases.held.erase(remove_if(leases.held.begin(), leases.held.end(), [](const Lease& lease) {
+            return lease.ring->retired.load(memory_order_acquire);
+        }), leases.held.end());
+
+        lock_guard<mutex> lock(ringsGuard);
+        shared_ptr<Ring> ring;
+        for (const shared_ptr<Ring>& candidate : rings) {
+            bool expected = false;
+            if (candidate->leased.compare_exchange_strong(expected, true, memory_order_acq_rel)) {
+                ring = candidate;
+                break;
+            }
+        }
+        if (ring == nullptr) {
+            ring = make_shared<Ring>();
+            ring->leased.store(true, memory_order_relaxed);
+            rings.push_back(ring);
+        }
+
+        leases.held.push_back({ id, ring });
+        return *ring;
+    }
+
+    void flushLoop() {
+        unique_lock<mutex> lock(guard);
+        while (true) {
+            wake.wait_for(lock, chrono::milliseconds(static_cast<int>(FLUSH_INTERVAL_MS)), [this]() {
+                return stopping || flushRequested.load(memory_order_relaxed);
+            });
+            bool last = stopping;
+            flushRequested.store(false, memory_order_relaxed);
+            lock.unlock();
+            drain();
+            lock.lock();
+            if (last) {
+                fflush(file);
+                return;
+            }
+        }
+    }
+
+    // One batch per ring with new events. The ring list is copied under the
+    // lock and the file written without it, so a thread registering its
+    // ring never waits for the disk.
+    void drain() {
+        {
+            lock_guard<mutex> lock(ringsGuard);
+            drainList = rings;
+        }
+        for (size_t index = 0; index < drainList.size(); ++index) {
+            Ring& ring = *drainList[index];
+            uint64_t tail = ring.tail.load(memory_order_relaxed);
+            uint64_t head = ring.head.load(memory_order_acquire);
+            if (head == tail) {
+                continue;
+            }
+
+            uint32_t batch[2] = { static_cast<uint32_t>(index), static_cast<uint32_t>(head - tail) };
+            fwrite(batch, sizeof(batch), 1, file);
+
+            // At most two contiguous pieces of the ring.
+            size_t first = static_cast<size_t>(tail % RING_CAPACITY);
+            size_t count = static_cast<size_t>(head - tail);
+            size_t untilEnd = min(count, RING_CAPACITY - first);
+            fwrite(&ring.events[first], sizeof(Event), untilEnd, file);
+            fwrite(&ring.events[0], sizeof(Event), count - untilEnd, file);
+
+            ring.tail.store(head, memory_order_release);
+        }
+    }
+
+    const uint64_t id;
+    FILE* file = nullptr;
+    thread flusher;
+    mutex guard;
+    condition_variable wake;
+    bool stopping = false;
+    atomic<bool> flushRequested{ false };
+
+    mutex ringsGuard;
+    vector<shared_ptr<Ring>> rings;
+    atomic<uint64_t> dropped{ 0 };
+
+    // Only touched by the flusher thread.
+    vector<shared_ptr<Ring>> drainList;
+};
+
+#endif
@@ -0,0 +1,413 @@
+#ifndef HOLY_DIVER_GAME_H
+#define HOLY_DIVER_GAME_H
+
+#include "campaign.h"
+#include "spectator.h"
+
+// =====================
+// Game
+// =====================
+
+class Game {
+public:
+    explicit Game(string firstMapPath, const GameConfig& config = GameConfig())
+        : currentMapPath(move(firstMapPath)) {
+        world.setConfig(config);
+    }
+
+    // Fixes enemy placement and movement, for reproducible replays.
+    void setSeed(uint32_t seed) {
+        world.setSeed(seed);
+    }
+
+    // Plays a whole command script (one command per line) instead of
+    // reading the keyboard.
+    void runScript(const string& script) {
+        input.feed(script);
+        run();
+    }
+
+    int getCommandCount() const {
+        return commandCount;
+    }
+
+    void setJournal(EventJournal* journal) {
+        world.setJournal(journal);
+    }
+
+    // Every frame is also published to these spectators; nullptr for none.
+    void setSpectators(SpectatorServer* server) {
+        spectators = server;
+    }
+
+    void run() {
+        showIntro();
+        input.start();
+
+        if (!startSession()) {
+            cout << "Could not start the game.\n";
+            waitForExit();
+            return;
+        }
+
+        running = true;
+        collectScreenChanges();
+        presenter.start();
+
+        while (running) {
+            reportSaveResult();
+
+            if (world.isPlayerDead()) {
+                const Player& player = world.getPlayer();
+                world.recordEvent(EventJournal::Death, player.getPosition(), 0, player.getHealth() <= 0 ? 0 : 1);
+                presentFrame(false);
+                showDeathMessage();
+                break;
+            }
+
+            if (world.isLevelCompleted()) {
+                presentFrame(false);
+                finishCurrentLevel();
+                continue;
+            }
+
+            presentFrame(true);
+            applyQueuedCommands();
+        }
+
+        // Moves queued ahead of a quit still get their frame.
+        if (framePending) {
+            presentFrame(false);
+        }
+        presenter.stop();
+        waitForExit();
+    }
+
+private:
+    void showIntro() const {
+        cout << "Epic Holy Diver Game\n";
+        cout << "Commands:\n";
+        cout << "  w/a/s/d - move\n";
+        cout << "  i/j/k/l - illuminate adjacent tile\n";
+        cout << "  u       - undo the last turn\n";
+        cout << "  r       - reload field and game state\n";
+        cout << "  h       - distance to the nearest oxygen item\n";
+        cout << "  v       - save game (enter the .sav file as map path to resume)\n";
+        cout << "  q       - quit\n\n";
+        cout << "Map symbols:\n";
+        cout << "  x - wall\n";
+        cout << "  o - floor\n";
+        cout << "  P - player start\n";
+        cout << "  M - enemy of a random kind\n";
+        cout << "  S - stationary enemy\n";
+        cout << "  R - roaming enemy\n";
+        cout << "  O - oxygen item\n";
+        cout << "  B - battery item\n";
+        cout << "Maps from before S and R play as before: each M is rolled\n";
+        cout << "stationary or roaming. On screen every enemy is drawn as M.\n\n";
+    }
+
+    // Collects what the last world change put on screen. Called after every
+    // change, so a frame costs the cells that changed, not the whole map.
+    void collectScreenChanges() {
+        world.collectScreenChanges(screenChanges);
+        framePending = true;
+    }
+
+    // Hands the changes since the last frame to the presenter, which builds
+    // the frame on its own thread.
+    void presentFrame(bool withPrompt) {
+        screenChanges.status = world.getScreenStatus();
+        shared_ptr<const World::ScreenPatch> patch = make_shared<const World::ScreenPatch>(std::move(screenChanges));
+        screenChanges = World::ScreenPatch();
+        framePending = false;
+        if (spectators != nullptr) {
+            spectators->publish(patch);
+        }
+        presenter.present(std::move(patch), withPrompt);
+    }
+
+    // Waits for one command, then applies every command already queued
+    // behind it before the next frame is built. Stops early when the turn
+    // outcome needs its own screen (death, level end, quit).
+    void applyQueuedCommands() {
+        char command;
+        if (!input.next(command)) {
+            running = false;
+            return;
+        }
+
+        do {
+            if (command != '\n' && handleCommand(command)) {
+                collectScreenChanges();
+            }
+
+            if (!running || world.isPlayerDead() || world.isLevelCompleted()) {
+                return;
+            }
+        } while (input.tryNext(command));
+    }
+
+    // Returns whether the command changed the world.
+    bool handleCommand(char command) {
+        commandCount++;
+        switch (command) {
+        case 'w':
+            world.requestPlayerMove(0, -1);
+            return true;
+        case 's':
+            world.requestPlayerMove(0, 1);
+            return true;
+        case 'a':
+            world.requestPlayerMove(-1, 0);
+            return true;
+        case 'd':
+            world.requestPlayerMove(1, 0);
+            return true;
+        case 'i':
+            world.illuminateTile(0, -1);
+            return true;
+        case 'k':
+            world.illuminateTile(0, 1);
+            return true;
+        case 'j':
+            world.illuminateTile(-1, 0);
+            return true;
+        case 'l':
+            world.illuminateTile(1, 0);
+            return true;
+        case 'r':
+            if (world.reload()) {
+                cout << "Game state reloaded.\n";
+                totalCollectedItems = 0;
+                return true;
+            }
+            cout << "Reload failed.\n";
+            return false;
+        case 'u':
+            if (world.rewind(1) == 0) {
+                cout << "Nothing to undo.\n";
+                return false;
+            }
+            return true;
+        case 'v':
+            saveGame();
+            return false;
+        case 'h':
+            showOxygenHint();
+            return false;
+        case 'q':
+            running = false;
+            cout << "Quitting game.\n";
+            return false;
+        default:
+            cout << "Unknown command.\n";
+            return false;
+        }
+    }
+
+    void finishCurrentLevel() {
+        world.recordEvent(EventJournal::LevelComplete, world.getPlayer().getPosition(), world.getCollectedItemsOnLevel());
+        totalCollectedItems += world.getCollectedItemsOnLevel();
+
+        cout << "\n=== LEVEL COMPLETED ===\n";
+        cout << "Level " << levelNumber << " finished.\n";
+        cout << "Session collected items: " << totalCollectedItems << "\n";
+        cout << "Total score: " << world.getPlayer().getScore() << "\n";
+
+        world.getPlayer().refillForNewLevel();
+
+        size_t nextIndex = levelIndex + 1;
+        if (nextIndex < campaign.levelCount() && !campaign.isLevelReady(nextIndex)) {
+            cout << "\nLoading next level...\n";
+        }
+        LevelData nextLevel;
+        if (nextIndex >= campaign.levelCount() || !campaign.takeLevel(nextIndex, nextLevel)
+            || !world.loadLevel(std::move(nextLevel), true)) {
+            cout << "\nNo next level found. You completed all available levels!\n";
+            cout << "Final score: " << world.getPlayer().getScore() << "\n";
+            cout << "Total collected items: " << totalCollectedItems << "\n";
+            running = false;
+            return;
+        }
+
+        collectScreenChanges();
+        levelIndex = nextIndex;
+        currentMapPath = campaign.levelPath(levelIndex);
+        levelNumber++;
+        campaign.prefetchAfter(levelIndex);
+
+        cout << "\nLoading next level: " << currentMapPath << "\n";
+        cout << "Oxygen and battery restored for the new level.\n\n";
+    }
+
+    void showOxygenHint() const {
+        int kind = ItemTypes::table.kindForSymbol(OxygenItem::symbol);
+        int d = world.distanceToNearestItem(static_cast<uint8_t>(kind));
+        if (d < 0) {
+            cout << "No reachable oxygen left on this level.\n";
+        }
+        else {
+            cout << "Nearest oxygen is " << d << " steps away.\n";
+        }
+    }
+
+    bool startSession() {
+        if (!isSavePath(currentMapPath)) {
+            if (!startCampaign(currentMapPath)) {
+                return false;
+            }
+
+            LevelData firstLevel;
+            if (!campaign.takeLevel(0, firstLevel) || !world.loadLevel(std::move(firstLevel), false)) {
+                return false;
+            }
+            levelNumber = extractLevelNumber(currentMapPath);
+            return true;
+        }
+
+        MappedFile file;
+        if (!file.open(currentMapPath)) {
+            cout << "Failed to open save file: " << currentMapPath << "\n";
+            return false;
+        }
+
+        ByteReader in(file.data(), file.size());
+        if (in.get<uint32_t>() != SAVE_MAGIC || in.get<uint32_t>() != SAVE_VERSION) {
+            cout << "Not a Holy Diver save file: " << currentMapPath << "\n";
+            return false;
+        }
+
+        levelNumber = in.get<int32_t>();
+        totalCollectedItems = in.get<int32_t>();
+
+        if (!world.loadFromSave(in)) {
+            return false;
+        }
+
+        cout << "Resumed game from " << currentMapPath << "\n";
+        currentMapPath = world.getMapPath();
+        return startCampaign(currentMapPath);
+    }
+
+    bool startCampaign(const string& firstPath) {
+        if (!campaign.discover(firstPath)) {
+            if (campaign.levelCount() == 0 && !ifstream(firstPath).good()) {
+                cout << "Failed to open map file: " << firstPath << "\n";
+            }
+            return false;
+        }
+
+        int index = campaign.indexOf(firstPath);
+        if (index < 0) {
+            cout << "Map file is not part of its campaign: " << firstPath << "\n";
+            return false;
+        }
+
+        cout << "Campaign: " << campaign.levelCount() << " level(s) found.\n";
+        levelIndex = static_cast<size_t>(index);
+        campaign.prefetchAfter(levelIndex);
+        return true;
+    }
+
+    // The snapshot is serialized here, the disk write happens in the
+    // background and is reported on a later turn.
+    void saveGame() {
+        ByteWriter out;
+        out.put(static_cast<uint32_t>(SAVE_MAGIC));
+        out.put(static_cast<uint32_t>(SAVE_VERSION));
+        out.put(static_cast<int32_t>(levelNumber));
+        out.put(static_cast<int32_t>(totalCollectedItems));
+        world.writeSave(out);
+
+        string savePath = buildSavePath(currentMapPath);
+        cout << "Saving game to " << savePath << " (" << out.data().size() << " bytes)...\n";
+        saveWriter.start(savePath, std::move(out.data()));
+    }
+
+    void reportSaveResult() {
+        for (SaveWriter::Status status = saveWriter.takeResult(); status != SaveWriter::Status::Idle;
+            status = saveWriter.takeResult()) {
+            if (status == SaveWriter::Status::Done) {
+                cout << "Game saved.\n";
+            }
+            else {
+                cout << "Saving the game failed.\n";
+            }
+        }
+    }
+
+    static bool isSavePath(const string& path) {
+        return path.size() >= 4 && path.compare(path.size() - 4, 4, ".sav") == 0;
+    }
+
+    static string buildSavePath(const string& mapPath) {
+        size_t dot = mapPath.find_last_of('.');
+        size_t slash = mapPath.find_last_of("/\\");
+        if (dot == string::npos || (slash != string::npos && dot < slash)) {
+            return mapPath + ".sav";
+        }
+        return mapPath.substr(0, dot) + ".sav";
+    }
+
+    void showDeathMessage() const {
+        const Player& player = world.getPlayer();
+
+        if (player.getHealth() <= 0) {
+            cout << "\nGame Over: health reached 0.\n";
+        }
+        else if (player.getOxygen() <= 0) {
+            cout << "\nGame Over: oxygen reached 0.\n";
+        }
+        else {
+            cout << "\nGame Over.\n";
+        }
+
+        cout << "Final score: " << player.getScore() << "\n";
+        cout << "Collected items in session: " << totalCollectedItems + world.getCollectedItemsOnLevel() << "\n";
+    }
+
+    void waitForExit() {
+        saveWriter.wait();
+        reportSaveResult();
+        cout << "Press Enter to exit..." << flush;
+        char ignored;
+        input.next(ignored);
+    }
+
+    int extractLevelNumber(const string& path) const {
+        int number = 0;
+        bool found = false;
+
+        for (char c : path) {
+            if (isdigit(static_cast<unsigned char>(c))) {
+                found = true;
+                number = number * 10 + (c - '0');
+            }
+        }
+
+        return found ? number : 1;
+    }
+
+private:
+    static constexpr uint32_t SAVE_MAGIC = 0x56534448; // "HDSV"
+    static constexpr uint32_t SAVE_VERSION = 1;
+
+    string currentMapPath;
+    World world;
+    SaveWriter saveWriter;
+    InputQueue input;
+    FramePresenter presenter;
+    World::ScreenPatch screenChanges;
+    bool framePending = false;  // screenChanges holds changes not yet presented
+    SpectatorServer* spectators = nullptr;
+    Campaign campaign;
+    size_t levelIndex = 0;
+    bool running = false;
+
+    int totalCollectedItems = 0;
+    int levelNumber = 1;
+    int commandCount = 0;
+};
+
+#endif
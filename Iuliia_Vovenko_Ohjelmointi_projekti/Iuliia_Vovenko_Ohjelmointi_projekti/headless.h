@@ -0,0 +1,377 @@
+#ifndef HOLY_DIVER_HEADLESS_H
+#define HOLY_DIVER_HEADLESS_H
+
+#include "world.h"
+
+// =====================
+// Headless evaluation
+// =====================
+
+// Scripted diver for headless runs: walks the shortest passable path to the
+// nearest remaining item, or picks a random direction when none is
+// reachable.
+class AutoPilot {
+public:
+    explicit AutoPilot(uint32_t seed)
+        : random(seed) {
+    }
+
+    // Returns the (dx, dy) of the next move.
+    Position nextStep(const World& world) {
+        int width = world.getWidth();
+        size_t cells = static_cast<size_t>(width) * world.getHeight();
+        cameFrom.assign(cells, -1);
+        isTarget.assign(cells, 0);
+
+        for (const Item* item : world.getItems()) {
+            isTarget[static_cast<size_t>(item->getPosition().y) * width + item->getPosition().x] = 1;
+        }
+
+        static const int dirs[4][2] = { {0, -1}, {0, 1}, {-1, 0}, {1, 0} };
+
+        Position start = world.getPlayer().getPosition();
+        int startCell = start.y * width + start.x;
+        cameFrom[startCell] = startCell;
+        frontier.assign(1, startCell);
+
+        for (size_t head = 0; head < frontier.size(); ++head) {
+            int cell = frontier[head];
+            if (isTarget[cell] && cell != startCell) {
+                while (cameFrom[cell] != startCell) {
+                    cell = cameFrom[cell];
+                }
+                return { cell % width - start.x, cell / width - start.y };
+            }
+
+            for (const auto& dir : dirs) {
+                int x = cell % width + dir[0];
+                int y = cell / width + dir[1];
+                if (!world.isPassable(x, y)) {
+                    continue;
+                }
+                int next = y * width + x;
+                if (cameFrom[next] == -1) {
+                    cameFrom[next] = cell;
+                    frontier.push_back(next);
+                }
+            }
+        }
+
+        const int* dir = dirs[uniform_int_distribution<int>(0, 3)(random)];
+        return { dir[0], dir[1] };
+    }
+
+private:
+    mt19937 random;
+    vector<int> cameFrom;
+    vector<char> isTarget;
+    vector<int> frontier;
+};
+
+struct GameOutcome {
+    bool won = false;
+    int score = 0;
+    int turns = 0;
+};
+
+// Runs a grid of GameConfig values against one level. The sweep file holds
+// "key = v1, v2, ..." lines for any GameConfig key plus the plain settings
+// map, runs, max_turns and seed. Every grid point plays `runs` seeded games
+// (the same seeds for every point) spread over all cores, and one CSV row
+// per point reports win rate and means.
+class ParameterSweep {
+public:
+    bool load(const string& path, const GameConfig& baseConfig, string& error) {
+        base = baseConfig;
+
+        vector<pair<string, string>> settings;
+        if (!readSettings(path, settings, error)) {
+            return false;
+        }
+
+        for (const auto& setting : settings) {
+            const string& key = setting.first;
+            if (key == "map") {
+                mapPath = setting.second;
+                continue;
+            }
+
+            int* plain = key == "runs" ? &runs : key == "max_turns" ? &maxTurns : key == "seed" ? &seed : nullptr;
+            if (plain != nullptr) {
+                if (!parseInt(setting.second, *plain) || *plain < 0) {
+                    error = "Setting " + key + " needs a non-negative integer";
+                    return false;
+                }
+                continue;
+            }
+
+            Axis axis{ key, {} };
+            stringstream values(setting.second);
+            string value;
+            while (getline(values, value, ',')) {
+                value.erase(0, value.find_first_not_of(" \t"));
+                value.erase(value.find_last_not_of(" \t") + 1);
+
+                GameConfig probe;
+                if (!probe.set(key, value, error)) {
+                    return false;
+                }
+                axis.values.push_back(value);
+            }
+            axes.push_back(axis);
+        }
+
+        if (mapPath.empty()) {
+            error = "Sweep file does not name a map";
+            return false;
+        }
+        return true;
+    }
+
+    bool run(ostream& csv, string& error) const {
+        LevelData level;
+        if (!LevelData::read(mapPath, level, error) || !level.validate(error)) {
+            return false;
+        }
+
+        size_t points = 1;
+        for (const Axis& axis : axes) {
+            points *= axis.values.size();
+        }
+
+        size_t runCount = static_cast<size_t>(runs);
+        size_t tasks = points * runCount;
+        vector<GameOutcome> outcomes(tasks);
+        atomic<size_t> nextTask{ 0 };
+
+        // One worker per core pulling games off a shared counter, since
+        // games differ a lot in length.
+        size_t workers = max<size_t>(1, thread::hardware_concurrency());
+        Parallel::forRange(workers, 1, [&](size_t, size_t) {
+            for (size_t task = nextTask++; task < tasks; task = nextTask++) {
+                uint32_t gameSeed = static_cast<uint32_t>(seed) + static_cast<uint32_t>(task % runCount);
+                outcomes[task] = play(configFor(task / runCount), level, gameSeed, maxTurns);
+            }
+        });
+
+        for (const Axis& axis : axes) {
+            csv << axis.key << ",";
+        }
+        csv << "runs,win_rate,mean_score,mean_turns\n";
+
+        for (size_t point = 0; point < points; ++point) {
+            double wins = 0;
+            double score = 0;
+            double turns = 0;
+            for (size_t run = 0; run < runCount; ++run) {
+                const GameOutcome& outcome = outcomes[point * runCount + run];
+                wins += outcome.won ? 1 : 0;
+                score += outcome.score;
+                turns += outcome.turns;
+            }
+
+            double divisor = runCount == 0 ? 1.0 : static_cast<double>(runCount);
+            for (size_t i = 0, rest = point; i < axes.size(); ++i) {
+                csv << axes[i].values[rest % axes[i].values.size()] << ",";
+                rest /= axes[i].values.size();
+            }
+            csv << runCount << "," << wins / divisor << "," << score / divisor << "," << turns / divisor << "\n";
+        }
+
+        return true;
+    }
+
+    static GameOutcome play(const GameConfig& config, const LevelData& level, uint32_t gameSeed, int turnLimit) {
+        ostream discard(nullptr);
+        World world;
+        world.setOutput(discard);
+        world.setConfig(config);
+        world.setSeed(gameSeed);
+        world.setHistoryCapacity(0);
+
+        GameOutcome outcome;
+        if (!world.loadLevel(level, false)) {
+            return outcome;
+        }
+
+        AutoPilot pilot(gameSeed);
+        while (outcome.turns < turnLimit && !world.isPlayerDead() && !world.isLevelCompleted()) {
+            Position step = pilot.nextStep(world);
+            world.requestPlayerMove(step.x, step.y);
+            outcome.turns++;
+        }
+
+        outcome.won = world.isLevelCompleted();
+        outcome.score = world.getPlayer().getScore();
+        return outcome;
+    }
+
+private:
+    struct Axis {
+        string key;
+        vector<string> values;
+    };
+
+    // Grid point index to config; the first axis varies fastest.
+    GameConfig configFor(size_t point) const {
+        GameConfig config = base;
+        string ignored;
+        for (const Axis& axis : axes) {
+            config.set(axis.key, axis.values[point % axis.values.size()], ignored);
+            point /= axis.values.size();
+        }
+        return config;
+    }
+
+    GameConfig base;
+    vector<Axis> axes;
+    string mapPath;
+    int runs = 100;
+    int maxTurns = 500;
+    int seed = 1;
+};
+
+// =====================
+// Training environments
+// =====================
+
+// A batch of independent Worlds on one level, stepped in lockstep for
+// reinforcement learning. All buffers belong to the caller and are laid out
+// environment after environment:
+//   actions       size() bytes, see Action
+//   observations  size() * OBSERVATION_SIZE bytes: the visibility window
+//                 around the player (World::ObservedCell codes) followed by
+//                 health, oxygen, battery and items left, clamped to 255
+//   rewards       size() floats: score gained, plus a bonus for finishing
+//                 the level or a penalty for dying
+//   dones         size() bytes, 1 when the episode ended on this step
+// An environment that reports done is reset before the call returns, and
+// its observation is the first one of the new episode.
+class VectorEnv {
+public:
+    enum Action : uint8_t {
+        MoveUp, MoveDown, MoveLeft, MoveRight,
+        LightUp, LightDown, LightLeft, LightRight,
+        ACTION_COUNT
+    };
+
+    static constexpr int WINDOW_RADIUS = 5;
+    static constexpr size_t WINDOW_CELLS = (2 * WINDOW_RADIUS + 1) * (2 * WINDOW_RADIUS + 1);
+    static constexpr size_t STAT_COUNT = 4;
+    static constexpr size_t OBSERVATION_SIZE = WINDOW_CELLS + STAT_COUNT;
+    static constexpr float COMPLETION_REWARD = 100.0f;
+    static constexpr float DEATH_PENALTY = -100.0f;
+
+    VectorEnv(LevelData levelData, size_t count, const GameConfig& config, uint32_t seed)
+        : level(std::move(levelData)), baseSeed(seed), envs(count) {
+        for (Env& env : envs) {
+            env.world.setOutput(env.discard);
+            env.world.setConfig(config);
+            // Enemies beyond the window cannot reach the diver soon.
+            env.world.setSimulationRadius(2 * WINDOW_RADIUS);
+            env.world.setHistoryCapacity(0);
+        }
+    }
+
+    size_t size() const {
+        return envs.size();
+    }
+
+    // Every environment records into the same journal, one ring per
+    // stepping thread.
+    void setJournal(EventJournal* journal) {
+        for (Env& env : envs) {
+            env.world.setJournal(journal);
+        }
+    }
+
+    // Starts a new episode in every environment.
+    bool reset(uint8_t* observations) {
+        bool ok = true;
+        for (size_t i = 0; i < envs.size(); ++i) {
+            ok = resetEnv(i) && ok;
+            observe(i, observations + i * OBSERVATION_SIZE);
+        }
+        return ok;
+    }
+
+    void step(const uint8_t* actions, uint8_t* observations, float* rewards, uint8_t* dones) {
+        Parallel::forRange(envs.size(), STEP_CHUNK, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                World& world = envs[i].world;
+                int scoreBefore = world.getPlayer().getScore();
+
+                applyAction(world, actions[i]);
+
+                float reward = static_cast<float>(world.getPlayer().getScore() - scoreBefore);
+                bool done = false;
+                if (world.isLevelCompleted()) {
+                    reward += COMPLETION_REWARD;
+                    done = true;
+                }
+                else if (world.isPlayerDead()) {
+                    reward += DEATH_PENALTY;
+                    done = true;
+                }
+
+                rewards[i] = reward;
+                dones[i] = done ? 1 : 0;
+                if (done) {
+                    resetEnv(i);
+                }
+                observe(i, observations + i * OBSERVATION_SIZE);
+            }
+        });
+    }
+
+private:
+    static constexpr size_t STEP_CHUNK = 64;
+
+    // Each env has its own sink: envs step on different threads, and even
+    // a stream without a buffer updates its state on every write.
+    struct Env {
+        ostream discard{ nullptr };
+        World world;
+        uint32_t episode = 0;
+    };
+
+    bool resetEnv(size_t index) {
+        Env& env = envs[index];
+        env.world.setSeed(baseSeed + static_cast<uint32_t>(index) + env.episode * static_cast<uint32_t>(envs.size()));
+        env.episode++;
+        return env.world.loadLevel(level, false);
+    }
+
+    static void applyAction(World& world, uint8_t action) {
+        static const int dirs[4][2] = { {0, -1}, {0, 1}, {-1, 0}, {1, 0} };
+        const int* dir = dirs[action % 4];
+        if (action < LightUp) {
+            world.requestPlayerMove(dir[0], dir[1]);
+        }
+        else {
+            world.illuminateTile(dir[0], dir[1]);
+        }
+    }
+
+    void observe(size_t index, uint8_t* out) const {
+        const World& world = envs[index].world;
+        world.observeWindow(WINDOW_RADIUS, out);
+
+        const Player& player = world.getPlayer();
+        uint8_t* stats = out + WINDOW_CELLS;
+        stats[0] = clampByte(player.getHealth());
+        stats[1] = clampByte(player.getOxygen());
+        stats[2] = clampByte(player.getBattery());
+        stats[3] = clampByte(world.getTotalItemsOnLevel() - world.getCollectedItemsOnLevel());
+    }
+
+    static uint8_t clampByte(int value) {
+        return static_cast<uint8_t>(min(255, max(0, value)));
+    }
+
+    LevelData level;
+    uint32_t baseSeed;
+    vector<Env> envs;
+};
+
+#endif
@@ -3,6 +3,10 @@
 * Holy diver - an epic adventure at object-oriented world way beneath the surface!
 * Template code for implementing the rich features to be specified later on.
 *
+* The routines below drive the engine of main.cpp through its C interface
+* (holy_diver.h). Build the engine library first (see holy_diver.h), then e.g.
+*   g++ holy_diver.cpp -L. -lholy_diver -o holy_diver
+*
 */
 
 
@@ -11,6 +15,8 @@
 #include <string>
 #include <iostream>
 
+#include "holy_diver.h"
+
 using namespace std;
 
 /****************************************************/
@@ -19,7 +25,7 @@ using namespace std;
 void start_splash_screen(void);
 void startup_routines(void);
 void quit_routines(void);
-void load_level(string); // a routine to load a level map from a file
+int load_level(string); // a routine to load a level map from a file
 int read_input(char *);
 void update_state(char);  // assuming only one input char (key press) at most at a time ("turn-based" execution flow)
 void render_screen(void);
@@ -28,10 +34,13 @@ void render_screen(void);
 /****************************************************/
 // global variables:
 /****************************************************/
-char ** map;// pointer pointer equals to array of arrays = 2-dimensional array of chars
+const char * const * map = NULL;// pointer pointer equals to array of arrays = 2-dimensional array of chars
 			// above is virtually identical, as a variable, compared to for example:
 			//	    char map[MAXSTR][MAXLEN] = {{0}}; // declare a static 2-dim array of chars, initialize to zero
-			// However pointer to pointer has not allocated memory yet attached to it, this is done dynamically when actual size known
+			// Here the rows belong to the engine: render_screen points map at them, nothing is copied or freed here
+
+hd_world * world = NULL; // the engine's game world, created in startup_routines
+bool game_over = false;
 
 const int MAX_HEALTH = 100;
 const int MAX_OXYGEN = 100;
@@ -64,6 +73,7 @@ int main (void)
 		if(0 > read_input(&input)) break; // exit loop in case input reader returns negative (e.g. user selected "quit")
 		update_state(input);
 		render_screen();
+		if(game_over) break;
 	}
 
 	quit_routines(); // cleanup, bye-bye messages, game save and whatnot
@@ -78,7 +88,7 @@ int main (void)
  * First weekly home assignment is to be implemented mostly here.
  * 
  * **************************************************************/
-void load_level(string filepath)
+int load_level(string filepath)
 {
 	// steps in short:
 	// 1) locate, check and open file, if failure, return value indicating error (and check on the calling side)
@@ -92,6 +102,13 @@ void load_level(string filepath)
 	// 3) close file
 	// 4) return with success value (e.g. zero when OK, negative if error)
 	// [  5) outside this function, remember to free() allocated memory eventually ]
+	// The engine does all of the above and owns the memory.
+	if(HD_OK != hd_load_level(world, filepath.c_str()))
+	{
+		cout << hd_last_error(world) << endl;
+		return -1;
+	}
+	return 0;
 }
 
 
@@ -127,7 +144,22 @@ int read_input(char * input)
  * **************************************************************/
 void update_state(char input)
 {
+	hd_step step;
+	if(1 != hd_update_state(world, &input, 1, &step)) return;
 
+	cout << hd_messages(world);
+	player_data.health = step.health;
+	player_data.oxygen = step.oxygen;
+	if(step.dead)
+	{
+		cout << "Game over!" << endl;
+		game_over = true;
+	}
+	else if(step.completed)
+	{
+		cout << "Level completed! Score: " << step.score << endl;
+		game_over = true;
+	}
 }
 
 /****************************************************************
@@ -139,7 +171,37 @@ void update_state(char input)
  * **************************************************************/
 void render_screen(void)
 {
+	hd_view view;
+	hd_render_screen(world, &view);
+	map = view.map;
+
+	// start from the terrain, hide what has not been seen, then draw items, enemies and the diver on top
+	string screen;
+	for(int y = 0; y < view.height; y++)
+	{
+		string row(map[y], view.width);
+		for(int x = 0; x < view.width; x++)
+		{
+			uint64_t word = view.visibility[y * view.visibility_words_per_row + x / 64];
+			if(!((word >> (x % 64)) & 1)) row[x] = ' ';
+		}
+		screen += row + "\n";
+	}
+	for(size_t i = 0; i < view.item_count; i++)
+	{
+		char & cell = screen[view.items[i].y * (view.width + 1) + view.items[i].x];
+		if(cell != ' ') cell = view.items[i].symbol;
+	}
+	for(size_t i = 0; i < view.enemy_count; i++)
+	{
+		char & cell = screen[view.enemies[i].y * (view.width + 1) + view.enemies[i].x];
+		if(cell != ' ') cell = view.enemies[i].symbol;
+	}
+	screen[view.player_y * (view.width + 1) + view.player_x] = 'P';
 
+	cout << screen;
+	cout << "Health: " << view.health << "  Oxygen: " << view.oxygen << "%  Battery: " << view.battery
+		<< "%  Items: " << view.items_collected << "/" << view.items_total << endl;
 }
 
 /****************************************************************
@@ -171,6 +233,22 @@ void startup_routines(void)
 {
 	
 	// For example if memory allocated here... (*)
+	world = hd_create();
+	if(world == NULL)
+	{
+		cout << "Could not start the engine." << endl;
+		exit(1);
+	}
+
+	string filepath;
+	cout << "Enter map file path: ";
+	getline(cin, filepath);
+	if(0 > load_level(filepath))
+	{
+		hd_destroy(world);
+		exit(1);
+	}
+	render_screen();
 }
 
 /****************************************************************
@@ -184,6 +262,8 @@ void quit_routines(void)
 {
 	
 	// (*) ... the memory should be free'ed here at latest.
+	hd_destroy(world);
+	world = NULL;
 	
 	cout <<endl<< "BYE! Welcome back soon."<<endl;
 }
@@ -0,0 +1,129 @@
+#ifndef HOLY_DIVER_H
+#define HOLY_DIVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// C interface to the Holy Diver engine, laid out like the routines of
+// holy_diver.cpp (load_level, read_input, update_state, render_screen) but
+// working on world handles, so a tool can run any number of dives in its
+// own process. The engine is main.cpp built as a shared library:
+//
+//   g++ -std=c++14 -O2 -pthread -shared -fPIC -fvisibility=hidden -DHOLY_DIVER_LIBRARY main.cpp -o libholy_diver.so
+//   cl /std:c++14 /O2 /EHsc /LD /DHOLY_DIVER_LIBRARY main.cpp /Fe:holy_diver.dll
+//
+// Separate worlds may be used from separate threads at the same time; a
+// single world must only be used by one thread at a time.
+//
+// No function throws. A NULL world or argument is refused: int results are
+// HD_ERROR, hd_update_state uses no input, hd_render_screen leaves a zeroed
+// view and the strings are empty (hd_last_error says "No world").
+
+#ifdef _WIN32
+#ifdef HOLY_DIVER_LIBRARY
+#define HD_API __declspec(dllexport)
+#else
+#define HD_API __declspec(dllimport)
+#endif
+#else
+#define HD_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct hd_world hd_world;
+
+enum {
+    HD_OK = 0,
+    HD_ERROR = -1,
+    HD_QUIT = -2
+};
+
+// What one input of hd_update_state did.
+typedef struct hd_step {
+    int applied;        // 0 if the input is not a command, or nothing to undo
+    int health;
+    int oxygen;
+    int score;
+    int dead;
+    int completed;
+} hd_step;
+
+// kind is 0 stationary ('S' in a map file) or 1 roaming ('R') for enemies,
+// 0 oxygen ('O') or 1 battery ('B') for items. A map's 'M' is an enemy of
+// either kind, rolled from the level seed.
+typedef struct hd_entity {
+    int x;
+    int y;
+    int kind;
+    char symbol;        // as drawn; enemies are 'M' whatever their kind
+    int active;         // enemies only: awake and hunting
+} hd_entity;
+
+// A read-only look at a world. Terrain and visibility point straight into
+// the engine's own buffers; the entity lists are refreshed by each
+// hd_render_screen. Everything stays valid until the next hd_update_state,
+// hd_load_level or hd_destroy on the same world.
+typedef struct hd_view {
+    int width;
+    int height;
+    // map[y][x], terrain only (walls and floor), like holy_diver.cpp's map.
+    const char* const* map;
+    // Cell (x, y) has been seen if bit x % 64 of
+    // visibility[y * visibility_words_per_row + x / 64] is set.
+    const uint64_t* visibility;
+    size_t visibility_words_per_row;
+    const hd_entity* enemies;
+    size_t enemy_count;
+    const hd_entity* items;
+    size_t item_count;
+    int player_x;
+    int player_y;
+    int health;
+    int oxygen;
+    int battery;
+    int score;
+    int items_collected;
+    int items_total;
+    int turn;
+    int dead;
+    int completed;
+} hd_view;
+
+// Returns NULL if the engine cannot be set up.
+HD_API hd_world* hd_create(void);
+HD_API void hd_destroy(hd_world* world);
+
+// Optional; a key = value file as taken by --config. Applies to the next
+// hd_load_level.
+HD_API int hd_load_config(hd_world* world, const char* path);
+// Fixes enemy placement and movement, for reproducible runs.
+HD_API void hd_set_seed(hd_world* world, uint32_t seed);
+
+// HD_OK, or HD_ERROR with the reason in hd_last_error.
+HD_API int hd_load_level(hd_world* world, const char* path);
+HD_API const char* hd_last_error(const hd_world* world);
+
+// Reads one key press from standard input, for console hosts: the first
+// non-blank character of a line, the rest of the line is dropped. HD_QUIT
+// for 'q', HD_ERROR when input ends.
+HD_API int hd_read_input(char* input);
+
+// Applies the inputs in order (w/a/s/d move, i/j/k/l illuminate, u undo,
+// anything else is ignored) and stops after an input that kills the diver
+// or completes the level. Returns how many inputs were used; steps, if not
+// NULL, gets one entry per used input.
+HD_API size_t hd_update_state(hd_world* world, const char* inputs, size_t count, hd_step* steps);
+
+// Text the engine printed during the last hd_update_state or hd_load_level.
+HD_API const char* hd_messages(const hd_world* world);
+
+HD_API void hd_render_screen(hd_world* world, hd_view* view);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef HOLY_DIVER_LEVEL_H
+#define HOLY_DIVER_LEVEL_H
+
+#include "memory.h"
+#include "entities.h"
+
+// =====================
+// Map scanning
+// =====================
+
+enum SymbolClass : uint8_t {
+    SymbolUnknown = 0,
+    SymbolFloor = 1 << 0,
+    SymbolWall = 1 << 1,
+    SymbolPlayer = 1 << 2,
+    SymbolEnemy = 1 << 3,
+    SymbolItem = 1 << 4
+};
+
+// Class and registry kind for every byte value. Bytes outside the map
+// legend are SymbolUnknown; like every byte but 'x' they play as floor.
+struct SymbolTable {
+    uint8_t classes[256];
+    uint8_t kinds[256];
+};
+
+constexpr SymbolTable buildSymbolTable() {
+    SymbolTable table{};
+    table.classes[static_cast<unsigned char>('o')] = SymbolFloor;
+    table.classes[static_cast<unsigned char>('x')] = SymbolWall;
+    table.classes[static_cast<unsigned char>('P')] = SymbolPlayer;
+    table.classes[static_cast<unsigned char>(Enemy::SYMBOL)] = SymbolEnemy;
+    table.kinds[static_cast<unsigned char>(Enemy::SYMBOL)] = Enemy::RANDOM_KIND;
+
+    for (size_t kind = EnemyTypes::table.size(); kind-- > 0;) {
+        unsigned char symbol = static_cast<unsigned char>(EnemyTypes::table[kind].symbol);
+        table.classes[symbol] = SymbolEnemy;
+        table.kinds[symbol] = static_cast<uint8_t>(kind);
+    }
+
+    for (size_t kind = ItemTypes::table.size(); kind-- > 0;) {
+        unsigned char symbol = static_cast<unsigned char>(ItemTypes::table[kind].symbol);
+        table.classes[symbol] = SymbolItem;
+        table.kinds[symbol] = static_cast<uint8_t>(kind);
+    }
+
+    return table;
+}
+
+// Classifies map rows in one pass. The vector paths compare 32 (AVX2) or
+// 16 (SSE2) bytes at a time against the two common symbols, writing wall
+// bits straight from the compare mask and leaving only the rare
+// non-floor, non-wall bytes for the table lookup. The AVX2 path is picked
+// at run time unless the build already targets AVX2.
+class MapScanner {
+public:
+    // A function-local table, so every translation unit shares one copy.
+    static const SymbolTable& symbols() {
+        static constexpr SymbolTable table = buildSymbolTable();
+        return table;
+    }
+
+    static uint8_t classify(char c) {
+        return symbols().classes[static_cast<unsigned char>(c)];
+    }
+
+    static uint8_t kindOf(char c) {
+        return symbols().kinds[static_cast<unsigned char>(c)];
+    }
+
+    // Sets the wall bits of one row (bit x of wallBits, which must be zeroed
+    // and hold at least (width + 63) / 64 words) and appends the x of every
+    // byte that is neither 'o' nor 'x' to special.
+    static void scanRow(const char* row, int width, uint64_t* wallBits, vector<int>& special) {
+        int x = 0;
+#if defined(__AVX2__)
+        x = scanAvx2(row, width, wallBits, special);
+#elif defined(HOLY_DIVER_AVX_DISPATCH)
+        if (CpuFeatures::hasAvx2()) {
+            x = scanAvx2(row, width, wallBits, special);
+        }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        const __m128i floor16 = _mm_set1_epi8('o');
+        const __m128i wall16 = _mm_set1_epi8('x');
+        for (; x + 16 <= width; x += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+            uint32_t walls = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, wall16)));
+            uint32_t floors = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, floor16)));
+            wallBits[x >> 6] |= static_cast<uint64_t>(walls) << (x & 63);
+            collect(~(walls | floors) & 0xFFFFu, x, special);
+        }
+#endif
+        for (; x < width; ++x) {
+            char c = row[x];
+            if (c == 'x') {
+                wallBits[x >> 6] |= uint64_t(1) << (x & 63);
+            }
+            else if (c != 'o') {
+                special.push_back(x);
+            }
+        }
+    }
+
+private:
+#if defined(__AVX2__) || defined(HOLY_DIVER_AVX_DISPATCH)
+    // Returns the first x it did not scan.
+    HOLY_DIVER_TARGET_AVX2
+    static int scanAvx2(const char* row, int width, uint64_t* wallBits, vector<int>& special) {
+        const __m256i floor32 = _mm256_set1_epi8('o');
+        const __m256i wall32 = _mm256_set1_epi8('x');
+        int x = 0;
+        for (; x + 32 <= width; x += 32) {
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+            uint32_t walls = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, wall32)));
+            uint32_t floors = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, floor32)));
+            wallBits[x >> 6] |= static_cast<uint64_t>(walls) << (x & 63);
+            collect(~(walls | floors), x, special);
+        }
+        return x;
+    }
+#endif
+
+    static void collect(uint32_t mask, int base, vector<int>& special) {
+        while (mask != 0) {
+            special.push_back(base + countTrailingZeros(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    static int countTrailingZeros(uint32_t mask) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+};
+
+// =====================
+// Levels
+// =====================
+
+// A level map as read from disk, before any entities are extracted.
+struct LevelData {
+    string path;
+    vector<string> tiles;
+    int width = 0;
+    int height = 0;
+
+    size_t memoryUsage() const {
+        size_t bytes = heapBytes(path) + heapBytes(tiles);
+        for (const string& row : tiles) {
+            bytes += heapBytes(row);
+        }
+        return bytes;
+    }
+
+    // Reads the map and pads or trims every row to the width of the first.
+    static bool read(const string& filePath, LevelData& level, string& error) {
+        level = LevelData();
+        level.path = filePath;
+
+        ifstream in(filePath);
+        if (!in) {
+            error = "Failed to open map file: " + filePath;
+            return false;
+        }
+
+        string line;
+        while (getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                level.tiles.push_back(line);
+            }
+        }
+
+        level.height = static_cast<int>(level.tiles.size());
+        level.width = level.height == 0 ? 0 : static_cast<int>(level.tiles[0].size());
+        if (level.width == 0) {
+            error = "Map file is empty or invalid.";
+            return false;
+        }
+
+        for (string& row : level.tiles) {
+            if ((int)row.size() < level.width) {
+                row += string(level.width - row.size(), 'x');
+            }
+            else if ((int)row.size() > level.width) {
+                row.resize(level.width);
+            }
+        }
+
+        return true;
+    }
+
+    // Checks what World needs to start the level: a 'P'. Bytes outside the
+    // map legend are floor, as they always were; when `warning` is given it
+    // names the first one and how many there are.
+    bool validate(string& error, string* warning = nullptr) const {
+        bool hasPlayer = false;
+        size_t unknownCount = 0;
+        vector<uint64_t> wallBits((static_cast<size_t>(width) + 63) / 64);
+        vector<int> special;
+
+        for (int y = 0; y < height; ++y) {
+            special.clear();
+            MapScanner::scanRow(tiles[y].data(), width, wallBits.data(), special);
+
+            for (int x : special) {
+                char c = tiles[y][x];
+                uint8_t symbolClass = MapScanner::classify(c);
+                if (symbolClass == SymbolUnknown && warning != nullptr) {
+                    if (unknownCount == 0) {
+                        *warning = "Unknown map symbol '" + string(1, c) + "' at line " + to_string(y + 1)
+                            + ", column " + to_string(x + 1) + " of " + path;
+                    }
+                    unknownCount++;
+                }
+                hasPlayer = hasPlayer || symbolClass == SymbolPlayer;
+            }
+        }
+
+        if (unknownCount > 1) {
+            *warning += " and " + to_string(unknownCount - 1) + " more";
+        }
+        if (unknownCount > 0) {
+            *warning += ", played as floor.";
+        }
+
+        if (!hasPlayer) {
+            error = "No 'P' found on the map!";
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif
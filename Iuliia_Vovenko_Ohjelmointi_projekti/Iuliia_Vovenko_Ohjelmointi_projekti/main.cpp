@@ -1,954 +1,560 @@
-﻿#include <iostream>
-#include <fstream>
-#include <vector>
-#include <string>
-#include <memory>
-#include <algorithm>
-#include <random>
-#include <limits>
-#include <cctype>
-
-using namespace std;
+﻿// Holy Diver. The engine lives in one header per subsystem, included in
+// dependency order. The headers may be included from several translation
+// units: functions outside classes are `inline`, and constants are in-class
+// `static constexpr` members that are only used by value.
+#include "benchmarks.h"
+
+#ifdef HOLY_DIVER_LIBRARY
+#include "holy_diver.h"
+#endif
 
 // =====================
-// Utility
+// Allocation counting
 // =====================
 
-struct Position {
-    int x = -1;
-    int y = -1;
-
-    bool operator==(const Position& other) const {
-        return x == other.x && y == other.y;
-    }
-};
-
-class Random {
-public:
-    static mt19937& engine() {
-        static mt19937 gen(random_device{}());
-        return gen;
-    }
+// Feeds ProcessStats::allocationCount. Bench builds only, and never in the
+// library: a host process keeps its own allocator. A replaced operator new
+// cannot be inline, so it lives in the program's source rather than in
+// memory.h.
+#if defined(HOLY_DIVER_COUNT_ALLOCATIONS) && !defined(HOLY_DIVER_LIBRARY)
+
+// Array and nothrow forms forward to these. Both are kept out of line:
+// once either is inlined, GCC pairs malloc() or free() with the replaced
+// operator at the call site and reports a mismatch.
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void* operator new(size_t size) {
+    ProcessStats::countAllocation();
+    void* memory = malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) {
+        throw bad_alloc();
+    }
+    return memory;
+}
 
-    static int nextInt(int left, int right) {
-        uniform_int_distribution<int> dist(left, right);
-        return dist(engine());
-    }
-};
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
 
-// =====================
-// Forward declarations
-// =====================
+void operator delete(void* memory, size_t) noexcept {
+    operator delete(memory);
+}
 
-class World;
+#endif
 
 // =====================
-// Player
+// Engine library
 // =====================
 
-class Player {
-public:
-    static constexpr int MAX_HEALTH = 100;
-    static constexpr int MAX_OXYGEN = 100;
-    static constexpr int MAX_BATTERY = 100;
+// The C interface of holy_diver.h, built with -DHOLY_DIVER_LIBRARY. Each
+// handle owns one World. No exception crosses the interface: every entry
+// point catches them, keeps the reason for hd_last_error and returns
+// HD_ERROR (or its function's nothing-done value).
+#ifdef HOLY_DIVER_LIBRARY
 
-    Player() = default;
-
-    void reset() {
-        health = MAX_HEALTH;
-        oxygen = MAX_OXYGEN;
-        battery = MAX_BATTERY;
-        score = 0;
-        pos = { -1, -1 };
-    }
+struct hd_world {
+    World world;
+    ostringstream messages;
+    string messageText;
+    string error;
+    bool loaded = false;
+
+    // Scratch for hd_render_screen; the terrain rows themselves are not
+    // copied.
+    vector<const char*> rows;
+    vector<hd_entity> enemies;
+    vector<hd_entity> items;
+};
 
-    void resetPositionOnly() {
-        pos = { -1, -1 };
+// Call from a catch block; the exception being handled becomes the
+// handle's hd_last_error.
+static int recordFailure(hd_world* handle) {
+    try {
+        throw;
     }
-
-    void refillForNewLevel() {
-        oxygen = MAX_OXYGEN;
-        battery = MAX_BATTERY;
+    catch (const exception& e) {
+        handle->error = e.what();
     }
-
-    void setPosition(Position p) {
-        pos = p;
+    catch (...) {
+        handle->error = "Unknown engine failure";
     }
+    return HD_ERROR;
+}
 
-    const Position& getPosition() const {
-        return pos;
-    }
+// The text printed so far becomes hd_messages; the stream starts over.
+static void takeMessages(hd_world* handle) {
+    handle->messageText = handle->messages.str();
+    handle->messages.str(string());
+}
 
-    int getHealth() const {
-        return health;
-    }
+static void fillStep(const World& world, hd_step& step) {
+    const Player& player = world.getPlayer();
+    step.health = player.getHealth();
+    step.oxygen = player.getOxygen();
+    step.score = player.getScore();
+    step.dead = world.isPlayerDead() ? 1 : 0;
+    step.completed = world.isLevelCompleted() ? 1 : 0;
+}
 
-    int getOxygen() const {
-        return oxygen;
+static bool applyInput(World& world, char input) {
+    switch (input) {
+    case 'w':
+        world.requestPlayerMove(0, -1);
+        return true;
+    case 's':
+        world.requestPlayerMove(0, 1);
+        return true;
+    case 'a':
+        world.requestPlayerMove(-1, 0);
+        return true;
+    case 'd':
+        world.requestPlayerMove(1, 0);
+        return true;
+    case 'i':
+        world.illuminateTile(0, -1);
+        return true;
+    case 'k':
+        world.illuminateTile(0, 1);
+        return true;
+    case 'j':
+        world.illuminateTile(-1, 0);
+        return true;
+    case 'l':
+        world.illuminateTile(1, 0);
+        return true;
+    case 'u':
+        return world.rewind(1) > 0;
+    default:
+        return false;
     }
+}
 
-    int getBattery() const {
-        return battery;
-    }
+// Fills view from the handle's world; see hd_view for what stays valid.
+static void fillView(hd_world& handle, hd_view& view) {
+    const World& engine = handle.world;
+    const Player& player = engine.getPlayer();
+
+    int height = engine.getHeight();
+    handle.rows.resize(static_cast<size_t>(height));
+    for (int y = 0; y < height; ++y) {
+        handle.rows[y] = engine.getTileRow(y);
+    }
+
+    handle.enemies.clear();
+    for (const Enemy* enemy : engine.getEnemies()) {
+        hd_entity entity;
+        entity.x = enemy->getPosition().x;
+        entity.y = enemy->getPosition().y;
+        entity.kind = enemy->getKind();
+        entity.symbol = enemy->getSymbol();
+        entity.active = enemy->isActive() ? 1 : 0;
+        handle.enemies.push_back(entity);
+    }
+
+    handle.items.clear();
+    for (const Item* item : engine.getItems()) {
+        hd_entity entity;
+        entity.x = item->getPosition().x;
+        entity.y = item->getPosition().y;
+        entity.kind = item->getKind();
+        entity.symbol = item->getSymbol();
+        entity.active = 0;
+        handle.items.push_back(entity);
+    }
+
+    view.width = engine.getWidth();
+    view.height = height;
+    view.map = handle.rows.data();
+    view.visibility = engine.getVisibilityBits();
+    view.visibility_words_per_row = engine.getVisibilityWordsPerRow();
+    view.enemies = handle.enemies.data();
+    view.enemy_count = handle.enemies.size();
+    view.items = handle.items.data();
+    view.item_count = handle.items.size();
+    view.player_x = player.getPosition().x;
+    view.player_y = player.getPosition().y;
+    view.health = player.getHealth();
+    view.oxygen = player.getOxygen();
+    view.battery = player.getBattery();
+    view.score = player.getScore();
+    view.items_collected = engine.getCollectedItemsOnLevel();
+    view.items_total = engine.getTotalItemsOnLevel();
+    view.turn = engine.getTurn();
+    view.dead = engine.isPlayerDead() ? 1 : 0;
+    view.completed = engine.isLevelCompleted() ? 1 : 0;
+}
 
-    int getScore() const {
-        return score;
-    }
+extern "C" {
 
-    void addScore(int amount) {
-        score += amount;
-        if (score < 0) {
-            score = 0;
-        }
+HD_API hd_world* hd_create(void) {
+    try {
+        hd_world* handle = new hd_world();
+        handle->world.setOutput(handle->messages);
+        return handle;
     }
-
-    void takeDamage(int amount) {
-        health -= amount;
-        if (health < 0) {
-            health = 0;
-        }
+    catch (...) {
+        return nullptr;
     }
+}
 
-    void consumeOxygen(int amount) {
-        oxygen -= amount;
-        if (oxygen < 0) {
-            oxygen = 0;
-        }
+HD_API void hd_destroy(hd_world* world) {
+    try {
+        delete world;
     }
-
-    void addOxygen(int amount) {
-        oxygen += amount;
-        if (oxygen > MAX_OXYGEN) {
-            oxygen = MAX_OXYGEN;
-        }
+    catch (...) {
     }
+}
 
-    void addBattery(int amount) {
-        battery += amount;
-        if (battery > MAX_BATTERY) {
-            battery = MAX_BATTERY;
-        }
+HD_API int hd_load_config(hd_world* world, const char* path) {
+    if (world == nullptr) {
+        return HD_ERROR;
     }
-
-    bool canSpendBattery(int amount) const {
-        return battery >= amount;
+    if (path == nullptr) {
+        world->error = "No config file given";
+        return HD_ERROR;
     }
 
-    void spendBattery(int amount) {
-        battery -= amount;
-        if (battery < 0) {
-            battery = 0;
+    try {
+        GameConfig config;
+        if (!config.loadFromFile(path, world->error)) {
+            return HD_ERROR;
         }
+        world->world.setConfig(config);
+        return HD_OK;
     }
-
-    bool isDead() const {
-        return health <= 0 || oxygen <= 0;
-    }
-
-private:
-    int health = MAX_HEALTH;
-    int oxygen = MAX_OXYGEN;
-    int battery = MAX_BATTERY;
-    int score = 0;
-    Position pos;
-};
-
-// =====================
-// Items
-// =====================
-
-class Item {
-public:
-    Item(Position pos, int value, char symbol, int scoreValue)
-        : pos(pos), value(value), symbol(symbol), scoreValue(scoreValue) {
-    }
-
-    virtual ~Item() = default;
-
-    const Position& getPosition() const {
-        return pos;
-    }
-
-    char getSymbol() const {
-        return symbol;
-    }
-
-    int getScoreValue() const {
-        return scoreValue;
-    }
-
-    virtual void apply(Player& player) const = 0;
-    virtual string getPickupMessage() const = 0;
-
-protected:
-    Position pos;
-    int value = 0;
-    char symbol = '?';
-    int scoreValue = 0;
-};
-
-class OxygenItem : public Item {
-public:
-    OxygenItem(Position pos, int value = 25, char symbol = 'O', int scoreValue = 10)
-        : Item(pos, value, symbol, scoreValue) {
+    catch (...) {
+        return recordFailure(world);
     }
+}
 
-    void apply(Player& player) const override {
-        player.addOxygen(value);
-        player.addScore(getScoreValue());
+HD_API void hd_set_seed(hd_world* world, uint32_t seed) {
+    if (world == nullptr) {
+        return;
     }
 
-    string getPickupMessage() const override {
-        return "Picked up extra oxygen! +10 score";
+    try {
+        world->world.setSeed(seed);
     }
-};
-
-class BatteryItem : public Item {
-public:
-    BatteryItem(Position pos, int value = 20, char symbol = 'B', int scoreValue = 10)
-        : Item(pos, value, symbol, scoreValue) {
+    catch (...) {
+        recordFailure(world);
     }
+}
 
-    void apply(Player& player) const override {
-        player.addBattery(value);
-        player.addScore(getScoreValue());
+HD_API int hd_load_level(hd_world* world, const char* path) {
+    if (world == nullptr) {
+        return HD_ERROR;
     }
-
-    string getPickupMessage() const override {
-        return "Picked up battery! +10 score";
+    if (path == nullptr) {
+        world->error = "No map file given";
+        return HD_ERROR;
     }
-};
 
-// =====================
-// Enemies
-// =====================
+    try {
+        world->loaded = false;
+        world->messages.str(string());
 
-class Enemy {
-public:
-    Enemy(Position pos, int damage, char symbol)
-        : pos(pos), damage(damage), symbol(symbol) {
-    }
-
-    virtual ~Enemy() = default;
+        LevelData level;
+        if (!LevelData::read(path, level, world->error) || !level.validate(world->error)) {
+            return HD_ERROR;
+        }
+        if (!world->world.loadLevel(std::move(level))) {
+            takeMessages(world);
+            world->error = world->messageText;
+            return HD_ERROR;
+        }
 
-    const Position& getPosition() const {
-        return pos;
+        takeMessages(world);
+        world->loaded = true;
+        return HD_OK;
     }
-
-    void setPosition(Position p) {
-        pos = p;
+    catch (...) {
+        return recordFailure(world);
     }
+}
 
-    int giveDamage() const {
-        return damage;
-    }
+HD_API const char* hd_last_error(const hd_world* world) {
+    return world == nullptr ? "No world" : world->error.c_str();
+}
 
-    char getSymbol() const {
-        return symbol;
+// Like holy_diver.cpp's read_input: the first non-blank character is the
+// key, the rest of the line is dropped. C stdio rather than cin, so the
+// host's streams are left alone.
+HD_API int hd_read_input(char* input) {
+    if (input == nullptr) {
+        return HD_ERROR;
     }
 
-    bool isActive() const {
-        return active;
+    int key = fgetc(stdin);
+    while (key != EOF && isspace(key)) {
+        key = fgetc(stdin);
     }
-
-    void activate() {
-        active = true;
+    if (key == EOF) {
+        return HD_ERROR;
     }
 
-    virtual void move(World& world) = 0;
-
-private:
-    Position pos;
-    int damage = 10;
-    char symbol = 'M';
-    bool active = false;
-};
-
-class StationaryEnemy : public Enemy {
-public:
-    StationaryEnemy(Position pos, int damage = 10, char symbol = 'M')
-        : Enemy(pos, damage, symbol) {
+    int rest = key;
+    while (rest != '\n' && rest != EOF) {
+        rest = fgetc(stdin);
     }
+    *input = static_cast<char>(key);
+    return *input == 'q' ? HD_QUIT : HD_OK;
+}
 
-    void move(World&) override {
-        // Stationary enemy does not move
-    }
-};
-
-class MovingEnemy : public Enemy {
-public:
-    MovingEnemy(Position pos, int damage = 10, char symbol = 'M')
-        : Enemy(pos, damage, symbol) {
+HD_API size_t hd_update_state(hd_world* world, const char* inputs, size_t count, hd_step* steps) {
+    if (world == nullptr || inputs == nullptr || !world->loaded) {
+        return 0;
     }
 
-    void move(World& world) override;
-};
-
-// =====================
-// World
-// =====================
-
-class World {
-public:
-    World() = default;
-
-    bool loadFromFile(const string& filePath, bool keepPlayerState = false) {
-        originalMapPath = filePath;
-
-        tiles.clear();
-        visible.clear();
-        enemies.clear();
-        items.clear();
-        width = 0;
-        height = 0;
-        totalItemsOnLevel = 0;
-        collectedItemsOnLevel = 0;
-
-        ifstream in(filePath);
-        if (!in) {
-            cout << "Failed to open map file: " << filePath << "\n";
-            return false;
-        }
-
-        string line;
-        while (getline(in, line)) {
-            if (!line.empty() && line.back() == '\r') {
-                line.pop_back();
-            }
-            if (!line.empty()) {
-                tiles.push_back(line);
+    World& engine = world->world;
+    size_t used = 0;
+    try {
+        while (used < count && !engine.isPlayerDead() && !engine.isLevelCompleted()) {
+            bool applied = applyInput(engine, inputs[used]);
+            if (steps != nullptr) {
+                steps[used].applied = applied ? 1 : 0;
+                fillStep(engine, steps[used]);
             }
+            used++;
         }
-
-        height = static_cast<int>(tiles.size());
-        if (height == 0) {
-            cout << "Map file is empty or invalid.\n";
-            return false;
-        }
-
-        width = static_cast<int>(tiles[0].size());
-        if (width == 0) {
-            cout << "Map file is empty or invalid.\n";
-            return false;
-        }
-
-        for (string& row : tiles) {
-            if ((int)row.size() < width) {
-                row += string(width - row.size(), 'x');
-            }
-            else if ((int)row.size() > width) {
-                row.resize(width);
-            }
-        }
-
-        visible.assign(height, vector<bool>(width, false));
-
-        if (!keepPlayerState) {
-            player.reset();
-        }
-        else {
-            player.resetPositionOnly();
-        }
-
-        if (!extractObjectsFromMap()) {
-            return false;
-        }
-
-        return true;
-    }
-
-    bool reload() {
-        if (originalMapPath.empty()) {
-            return false;
-        }
-        return loadFromFile(originalMapPath, false);
+        takeMessages(world);
     }
-
-    Player& getPlayer() {
-        return player;
-    }
-
-    const Player& getPlayer() const {
-        return player;
+    catch (...) {
+        recordFailure(world);
     }
+    return used;
+}
 
-    bool isPlayerDead() const {
-        return player.isDead();
-    }
+HD_API const char* hd_messages(const hd_world* world) {
+    return world == nullptr ? "" : world->messageText.c_str();
+}
 
-    bool isLevelCompleted() const {
-        return totalItemsOnLevel > 0 && collectedItemsOnLevel == totalItemsOnLevel && !player.isDead();
+HD_API void hd_render_screen(hd_world* world, hd_view* view) {
+    if (view == nullptr) {
+        return;
     }
-
-    int getCollectedItemsOnLevel() const {
-        return collectedItemsOnLevel;
+    *view = hd_view();
+    if (world == nullptr || !world->loaded) {
+        return;
     }
 
-    int getTotalItemsOnLevel() const {
-        return totalItemsOnLevel;
+    try {
+        fillView(*world, *view);
     }
-
-    int getLevelScore() const {
-        return player.getScore();
+    catch (...) {
+        *view = hd_view();
+        recordFailure(world);
     }
+}
 
-    void render() const {
-        cout << "\n--- MAP ---\n";
-
-        Position pp = player.getPosition();
-
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                if (pp.x == x && pp.y == y) {
-                    cout << 'P';
-                    continue;
-                }
+}
 
-                if (!isVisible(x, y)) {
-                    cout << ' ';
-                    continue;
+#else
+
+
+int main(int argc, char* argv[]) {
+    GameConfig config;
+    string sweepPath;
+    string outputPath;
+    string gymMapPath;
+    string baselinePath;
+    string journalPath;
+    string decodePath;
+    string spectatorBenchPath;
+    string memoryReportPath;
+    int spectatorPort = 0;
+    int pathBenchSize = 0;
+    int saveBenchSize = 0;
+    int loadBenchSize = 0;
+    int scanBenchGigabytes = 0;
+    bool recordBaseline = false;
+    int tolerancePercent = 10;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--record") {
+            recordBaseline = true;
+            continue;
+        }
+        if (i + 1 < argc && (arg == "--config" || arg == "--sweep" || arg == "--out" || arg == "--gym"
+            || arg == "--bench" || arg == "--tolerance" || arg == "--pathbench" || arg == "--savebench"
+            || arg == "--loadbench" || arg == "--scanbench" || arg == "--journal"
+            || arg == "--decode-journal" || arg == "--spectate" || arg == "--spectator-bench"
+            || arg == "--memory-report" || arg == "--memory-budget")) {
+            string value = argv[++i];
+            if (arg == "--config") {
+                string error;
+                if (!config.loadFromFile(value, error)) {
+                    cout << error << "\n";
+                    return 1;
                 }
-
-                const Enemy* enemy = getEnemyAt(x, y);
-                if (enemy != nullptr) {
-                    cout << enemy->getSymbol();
-                    continue;
+            }
+            else if (arg == "--sweep") {
+                sweepPath = value;
+            }
+            else if (arg == "--gym") {
+                gymMapPath = value;
+            }
+            else if (arg == "--bench") {
+                baselinePath = value;
+            }
+            else if (arg == "--journal") {
+                journalPath = value;
+            }
+            else if (arg == "--decode-journal") {
+                decodePath = value;
+            }
+            else if (arg == "--spectator-bench") {
+                spectatorBenchPath = value;
+            }
+            else if (arg == "--memory-report") {
+                memoryReportPath = value;
+            }
+            else if (arg == "--memory-budget") {
+                int megabytes = 0;
+                if (!parseInt(value, megabytes) || megabytes <= 0) {
+                    cout << "--memory-budget needs a size in MB\n";
+                    return 1;
                 }
-
-                const Item* item = getItemAt(x, y);
-                if (item != nullptr) {
-                    cout << item->getSymbol();
-                    continue;
+                MemoryBudget::setLimit(static_cast<size_t>(megabytes) * 1024 * 1024);
+            }
+            else if (arg == "--spectate") {
+                if (!parseInt(value, spectatorPort) || spectatorPort <= 0 || spectatorPort > 65535) {
+                    cout << "--spectate needs a port number\n";
+                    return 1;
                 }
-
-                cout << tiles[y][x];
             }
-            cout << "\n";
-        }
-
-        cout << "Health:   " << player.getHealth() << "\n";
-        cout << "Oxygen:   " << player.getOxygen() << "%\n";
-        cout << "Battery:  " << player.getBattery() << "%\n";
-        cout << "Score:    " << player.getScore() << "\n";
-        cout << "Items:    " << collectedItemsOnLevel << "/" << totalItemsOnLevel << "\n";
-    }
-
-    bool requestPlayerMove(int dx, int dy) {
-        player.consumeOxygen(2);
-
-        Position oldPos = player.getPosition();
-        Position newPos{ oldPos.x + dx, oldPos.y + dy };
-
-        if (!inBounds(newPos.x, newPos.y)) {
-            return false;
-        }
-
-        if (!isWalkableBase(newPos.x, newPos.y)) {
-            return false;
-        }
-
-        Enemy* enemy = getEnemyAtMutable(newPos.x, newPos.y);
-        if (enemy != nullptr) {
-            player.takeDamage(enemy->giveDamage());
-            enemy->activate();
-            cout << "You bumped into an enemy! -" << enemy->giveDamage() << " HP\n";
-            return false;
-        }
-
-        player.setPosition(newPos);
-        reveal(newPos.x, newPos.y);
-        handleItemPickup();
-        activateSeenEnemies();
-        moveEnemies();
-        return true;
-    }
-
-    bool illuminateTile(int dx, int dy) {
-        player.consumeOxygen(2);
-
-        Position pp = player.getPosition();
-        int tx = pp.x + dx;
-        int ty = pp.y + dy;
-
-        if (!inBounds(tx, ty)) {
-            cout << "Can't illuminate outside the map.\n";
-            return false;
-        }
-
-        if (!player.canSpendBattery(5)) {
-            cout << "Battery empty!\n";
-            return false;
-        }
-
-        player.spendBattery(5);
-        reveal(tx, ty);
-        cout << "Illuminated tile (" << tx << "," << ty << ") -5% battery\n";
-
-        activateSeenEnemies();
-        moveEnemies();
-        return true;
-    }
-
-    bool inBounds(int x, int y) const {
-        return x >= 0 && x < width && y >= 0 && y < height;
-    }
-
-    bool tryMoveEnemy(Enemy& enemy, int dx, int dy) {
-        Position oldPos = enemy.getPosition();
-        Position newPos{ oldPos.x + dx, oldPos.y + dy };
-
-        if (!inBounds(newPos.x, newPos.y)) {
-            return false;
-        }
-
-        if (!isWalkableBase(newPos.x, newPos.y)) {
-            return false;
-        }
-
-        if (isEnemyAt(newPos.x, newPos.y)) {
-            return false;
-        }
-
-        Position pp = player.getPosition();
-        if (pp == newPos) {
-            player.takeDamage(enemy.giveDamage());
-            cout << "Enemy hit you! -" << enemy.giveDamage() << " HP\n";
-            return false;
-        }
-
-        enemy.setPosition(newPos);
-        return true;
-    }
-
-private:
-    bool extractObjectsFromMap() {
-        Position playerPos = findFirst('P');
-        if (playerPos.x == -1) {
-            cout << "No 'P' found on the map!\n";
-            return false;
-        }
-
-        player.setPosition(playerPos);
-        reveal(playerPos.x, playerPos.y);
-        setTile(playerPos.x, playerPos.y, 'o');
-
-        vector<Position> enemyPositions = findAll('M');
-        for (const Position& pos : enemyPositions) {
-            setTile(pos.x, pos.y, 'o');
-
-            if (Random::nextInt(0, 1) == 0) {
-                enemies.push_back(make_unique<StationaryEnemy>(pos));
+            else if (arg == "--pathbench") {
+                if (!parseInt(value, pathBenchSize) || pathBenchSize <= 0) {
+                    cout << "--pathbench needs a map size\n";
+                    return 1;
+                }
             }
-            else {
-                enemies.push_back(make_unique<MovingEnemy>(pos));
+            else if (arg == "--savebench") {
+                if (!parseInt(value, saveBenchSize) || saveBenchSize < 3) {
+                    cout << "--savebench needs a map size\n";
+                    return 1;
+                }
             }
-        }
-
-        vector<Position> oxygenPositions = findAll('O');
-        for (const Position& pos : oxygenPositions) {
-            items.push_back(make_unique<OxygenItem>(pos, 25, 'O', 10));
-            setTile(pos.x, pos.y, 'o');
-        }
-
-        vector<Position> batteryPositions = findAll('B');
-        for (const Position& pos : batteryPositions) {
-            items.push_back(make_unique<BatteryItem>(pos, 20, 'B', 10));
-            setTile(pos.x, pos.y, 'o');
-        }
-
-        totalItemsOnLevel = static_cast<int>(items.size());
-        return true;
-    }
-
-    Position findFirst(char symbol) const {
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                if (tiles[y][x] == symbol) {
-                    return { x, y };
+            else if (arg == "--loadbench") {
+                if (!parseInt(value, loadBenchSize) || loadBenchSize < 3) {
+                    cout << "--loadbench needs a map size\n";
+                    return 1;
                 }
             }
-        }
-        return { -1, -1 };
-    }
-
-    vector<Position> findAll(char symbol) const {
-        vector<Position> result;
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                if (tiles[y][x] == symbol) {
-                    result.push_back({ x, y });
+            else if (arg == "--scanbench") {
+                if (!parseInt(value, scanBenchGigabytes) || scanBenchGigabytes <= 0) {
+                    cout << "--scanbench needs a size in GB\n";
+                    return 1;
                 }
             }
-        }
-        return result;
-    }
-
-    void setTile(int x, int y, char c) {
-        if (inBounds(x, y)) {
-            tiles[y][x] = c;
-        }
-    }
-
-    char getTile(int x, int y) const {
-        if (!inBounds(x, y)) {
-            return '\0';
-        }
-        return tiles[y][x];
-    }
-
-    bool isWalkableBase(int x, int y) const {
-        char c = getTile(x, y);
-        return c != '\0' && c != 'x';
-    }
-
-    bool isVisible(int x, int y) const {
-        if (!inBounds(x, y)) {
-            return false;
-        }
-        return visible[y][x];
-    }
-
-    void reveal(int x, int y) {
-        if (inBounds(x, y)) {
-            visible[y][x] = true;
-        }
-    }
-
-    const Enemy* getEnemyAt(int x, int y) const {
-        for (const auto& enemy : enemies) {
-            Position ep = enemy->getPosition();
-            if (ep.x == x && ep.y == y) {
-                return enemy.get();
+            else if (arg == "--tolerance") {
+                if (!parseInt(value, tolerancePercent) || tolerancePercent < 0) {
+                    cout << "--tolerance needs a non-negative percentage\n";
+                    return 1;
+                }
             }
-        }
-        return nullptr;
-    }
-
-    Enemy* getEnemyAtMutable(int x, int y) {
-        for (auto& enemy : enemies) {
-            Position ep = enemy->getPosition();
-            if (ep.x == x && ep.y == y) {
-                return enemy.get();
+            else {
+                outputPath = value;
             }
+            continue;
         }
-        return nullptr;
-    }
 
-    bool isEnemyAt(int x, int y) const {
-        return getEnemyAt(x, y) != nullptr;
+        cout << "Usage: " << argv[0] << " [--config FILE] [--sweep FILE [--out CSV] | --gym MAP"
+            << " | --bench BASELINE [--record] [--tolerance PCT] | --pathbench SIZE | --savebench SIZE"
+            << " | --loadbench SIZE | --scanbench GB"
+            << " | --decode-journal FILE [--out CSV] | --spectator-bench MAP | --memory-report MAP]"
+            << " [--journal FILE] [--spectate PORT] [--memory-budget MB]\n";
+        return 1;
     }
 
-    const Item* getItemAt(int x, int y) const {
-        for (const auto& item : items) {
-            Position ip = item->getPosition();
-            if (ip.x == x && ip.y == y) {
-                return item.get();
-            }
-        }
-        return nullptr;
+    if (pathBenchSize > 0) {
+        return runPathBenchmark(pathBenchSize) ? 0 : 1;
     }
 
-    bool inPlayerFieldOfView(const Position& enemyPos) const {
-        Position pp = player.getPosition();
-        int dx = enemyPos.x - pp.x;
-        int dy = enemyPos.y - pp.y;
-
-        return dx >= -1 && dx <= 1 && dy >= -1 && dy <= 1;
+    if (scanBenchGigabytes > 0) {
+        return runScanBenchmark(scanBenchGigabytes) ? 0 : 1;
     }
 
-    void activateSeenEnemies() {
-        for (auto& enemy : enemies) {
-            Position ep = enemy->getPosition();
-            if (isVisible(ep.x, ep.y) && inPlayerFieldOfView(ep)) {
-                enemy->activate();
-            }
-        }
+    if (saveBenchSize > 0) {
+        return runSaveBenchmark(saveBenchSize) ? 0 : 1;
     }
 
-    void moveEnemies() {
-        for (auto& enemy : enemies) {
-            if (enemy->isActive()) {
-                enemy->move(*this);
-            }
-        }
+    if (loadBenchSize > 0) {
+        return runLoadBenchmark(loadBenchSize) ? 0 : 1;
     }
 
-    void handleItemPickup() {
-        Position pp = player.getPosition();
-
-        auto it = find_if(items.begin(), items.end(),
-            [&](const unique_ptr<Item>& item) {
-                return item->getPosition() == pp;
-            });
-
-        if (it != items.end()) {
-            (*it)->apply(player);
-            collectedItemsOnLevel++;
-            cout << (*it)->getPickupMessage() << "\n";
-            cout << "Collected items: " << collectedItemsOnLevel << "/" << totalItemsOnLevel << "\n";
-            items.erase(it);
-
-            if (collectedItemsOnLevel == totalItemsOnLevel && totalItemsOnLevel > 0) {
-                cout << "\nAll items on this level collected!\n";
-            }
-        }
-    }
-
-private:
-    string originalMapPath;
-    vector<string> tiles;
-    vector<vector<bool>> visible;
-    int width = 0;
-    int height = 0;
-
-    int totalItemsOnLevel = 0;
-    int collectedItemsOnLevel = 0;
-
-    Player player;
-    vector<unique_ptr<Enemy>> enemies;
-    vector<unique_ptr<Item>> items;
-};
-
-void MovingEnemy::move(World& world) {
-    if (Random::nextInt(0, 99) < 30) {
-        return;
+    if (!baselinePath.empty()) {
+        return runRegressionBench(baselinePath, recordBaseline, tolerancePercent) ? 0 : 1;
     }
 
-    static const int dirs[4][2] = {
-        {0, -1},
-        {0, 1},
-        {-1, 0},
-        {1, 0}
-    };
-
-    for (int attempt = 0; attempt < 4; ++attempt) {
-        int index = Random::nextInt(0, 3);
-        int dx = dirs[index][0];
-        int dy = dirs[index][1];
-
-        if (world.tryMoveEnemy(*this, dx, dy)) {
-            return;
-        }
+    if (!spectatorBenchPath.empty()) {
+        return runSpectatorBenchmark(spectatorBenchPath, config) ? 0 : 1;
     }
-}
 
-// =====================
-// Game
-// =====================
-
-class Game {
-public:
-    explicit Game(string firstMapPath)
-        : currentMapPath(move(firstMapPath)) {
+    if (!memoryReportPath.empty()) {
+        return runMemoryReport(memoryReportPath, config) ? 0 : 1;
     }
 
-    void run() {
-        showIntro();
-
-        if (!world.loadFromFile(currentMapPath, false)) {
-            cout << "Could not start the game.\n";
-            waitForExit();
-            return;
-        }
-
-        running = true;
-        levelNumber = extractLevelNumber(currentMapPath);
-
-        while (running) {
-            world.render();
-
-            if (world.isPlayerDead()) {
-                showDeathMessage();
-                break;
-            }
-
-            if (world.isLevelCompleted()) {
-                finishCurrentLevel();
-                continue;
+    if (!decodePath.empty()) {
+        ofstream file;
+        if (!outputPath.empty()) {
+            file.open(outputPath);
+            if (!file) {
+                cout << "Failed to open output file: " << outputPath << "\n";
+                return 1;
             }
-
-            char command = readCommand();
-            handleCommand(command);
         }
 
-        waitForExit();
-    }
-
-private:
-    void showIntro() const {
-        cout << "Epic Holy Diver Game\n";
-        cout << "Commands:\n";
-        cout << "  w/a/s/d - move\n";
-        cout << "  i/j/k/l - illuminate adjacent tile\n";
-        cout << "  r       - reload field and game state\n";
-        cout << "  q       - quit\n\n";
-        cout << "Map symbols:\n";
-        cout << "  x - wall\n";
-        cout << "  o - floor\n";
-        cout << "  P - player start\n";
-        cout << "  M - enemy\n";
-        cout << "  O - oxygen item\n";
-        cout << "  B - battery item\n\n";
-    }
-
-    char readCommand() const {
-        cout << ">>> ";
-        char c;
-        cin >> c;
-        cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        return c;
-    }
-
-    void handleCommand(char command) {
-        switch (command) {
-        case 'w':
-            world.requestPlayerMove(0, -1);
-            break;
-        case 's':
-            world.requestPlayerMove(0, 1);
-            break;
-        case 'a':
-            world.requestPlayerMove(-1, 0);
-            break;
-        case 'd':
-            world.requestPlayerMove(1, 0);
-            break;
-        case 'i':
-            world.illuminateTile(0, -1);
-            break;
-        case 'k':
-            world.illuminateTile(0, 1);
-            break;
-        case 'j':
-            world.illuminateTile(-1, 0);
-            break;
-        case 'l':
-            world.illuminateTile(1, 0);
-            break;
-        case 'r':
-            if (world.reload()) {
-                cout << "Game state reloaded.\n";
-                totalCollectedItems = 0;
-            }
-            else {
-                cout << "Reload failed.\n";
-            }
-            break;
-        case 'q':
-            running = false;
-            cout << "Quitting game.\n";
-            break;
-        default:
-            cout << "Unknown command.\n";
-            break;
+        string error;
+        if (!EventJournal::decode(decodePath, outputPath.empty() ? cout : file, error)) {
+            cout << error << "\n";
+            return 1;
         }
+        return 0;
     }
 
-    void finishCurrentLevel() {
-        totalCollectedItems += world.getCollectedItemsOnLevel();
-
-        cout << "\n=== LEVEL COMPLETED ===\n";
-        cout << "Level " << levelNumber << " finished.\n";
-        cout << "Session collected items: " << totalCollectedItems << "\n";
-        cout << "Total score: " << world.getPlayer().getScore() << "\n";
-
-        string nextMapPath = buildNextLevelPath(currentMapPath);
-
-        world.getPlayer().refillForNewLevel();
-
-        if (!world.loadFromFile(nextMapPath, true)) {
-            cout << "\nNo next level found. You completed all available levels!\n";
-            cout << "Final score: " << world.getPlayer().getScore() << "\n";
-            cout << "Total collected items: " << totalCollectedItems << "\n";
-            running = false;
-            return;
+    EventJournal journal;
+    if (!journalPath.empty()) {
+        string error;
+        if (!journal.open(journalPath, error)) {
+            cout << error << "\n";
+            return 1;
         }
-
-        currentMapPath = nextMapPath;
-        levelNumber++;
-
-        cout << "\nLoading next level: " << currentMapPath << "\n";
-        cout << "Oxygen and battery restored for the new level.\n\n";
     }
+    EventJournal* activeJournal = journal.isOpen() ? &journal : nullptr;
 
-    void showDeathMessage() const {
-        const Player& player = world.getPlayer();
-
-        if (player.getHealth() <= 0) {
-            cout << "\nGame Over: health reached 0.\n";
-        }
-        else if (player.getOxygen() <= 0) {
-            cout << "\nGame Over: oxygen reached 0.\n";
-        }
-        else {
-            cout << "\nGame Over.\n";
-        }
-
-        cout << "Final score: " << player.getScore() << "\n";
-        cout << "Collected items in session: " << totalCollectedItems + world.getCollectedItemsOnLevel() << "\n";
+    if (!gymMapPath.empty()) {
+        return runGymBenchmark(gymMapPath, config, activeJournal) ? 0 : 1;
     }
 
-    void waitForExit() const {
-        cout << "Press Enter to exit...";
-        cin.get();
-    }
-
-    int extractLevelNumber(const string& path) const {
-        int number = 0;
-        bool found = false;
-
-        for (char c : path) {
-            if (isdigit(static_cast<unsigned char>(c))) {
-                found = true;
-                number = number * 10 + (c - '0');
-            }
+    if (!sweepPath.empty()) {
+        ParameterSweep sweep;
+        string error;
+        if (!sweep.load(sweepPath, config, error)) {
+            cout << error << "\n";
+            return 1;
         }
 
-        return found ? number : 1;
-    }
-
-    string buildNextLevelPath(const string& currentPath) const {
-        string result = currentPath;
-
-        int lastDigitPos = -1;
-        for (int i = static_cast<int>(result.size()) - 1; i >= 0; --i) {
-            if (isdigit(static_cast<unsigned char>(result[i]))) {
-                lastDigitPos = i;
-                break;
+        ofstream file;
+        if (!outputPath.empty()) {
+            file.open(outputPath);
+            if (!file) {
+                cout << "Failed to open output file: " << outputPath << "\n";
+                return 1;
             }
         }
 
-        if (lastDigitPos == -1) {
-            return result + "2";
+        if (!sweep.run(outputPath.empty() ? cout : file, error)) {
+            cout << error << "\n";
+            return 1;
         }
-
-        int firstDigitPos = lastDigitPos;
-        while (firstDigitPos - 1 >= 0 &&
-            isdigit(static_cast<unsigned char>(result[firstDigitPos - 1]))) {
-            firstDigitPos--;
-        }
-
-        int currentNumber = stoi(result.substr(firstDigitPos, lastDigitPos - firstDigitPos + 1));
-        int nextNumber = currentNumber + 1;
-
-        result.replace(firstDigitPos, lastDigitPos - firstDigitPos + 1, to_string(nextNumber));
-        return result;
+        return 0;
     }
 
-private:
-    string currentMapPath;
-    World world;
-    bool running = false;
-
-    int totalCollectedItems = 0;
-    int levelNumber = 1;
-};
-
-// =====================
-// Main
-// =====================
-
-int main() {
     string mapPath;
 
     cout << "Enter map file path: ";
@@ -963,8 +569,22 @@ int main() {
         return 1;
     }
 
-    Game game(mapPath);
+    SpectatorServer spectators;
+    if (spectatorPort > 0) {
+        string error;
+        if (!spectators.start(spectatorPort, error)) {
+            cout << error << "\n";
+            return 1;
+        }
+        cout << "Spectators can watch with: nc 127.0.0.1 " << spectators.getPort() << "\n";
+    }
+
+    Game game(mapPath, config);
+    game.setJournal(activeJournal);
+    game.setSpectators(spectatorPort > 0 ? &spectators : nullptr);
     game.run();
 
     return 0;
-}
\ No newline at end of file
+}
+
+#endif
\ No newline at end of file
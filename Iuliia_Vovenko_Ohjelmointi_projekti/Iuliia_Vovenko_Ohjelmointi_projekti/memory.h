@@ -0,0 +1,352 @@
+#ifndef HOLY_DIVER_MEMORY_H
+#define HOLY_DIVER_MEMORY_H
+
+#include "common.h"
+
+// =====================
+// Memory accounting
+// =====================
+
+// Heap bytes a container has reserved, from its capacity: what the code
+// asked for, not what the allocator rounded it up to.
+template <typename T>
+size_t heapBytes(const vector<T>& values) {
+    return values.capacity() * sizeof(T);
+}
+
+inline size_t heapBytes(const vector<bool>& bits) {
+    return bits.capacity() / 8;
+}
+
+inline size_t heapBytes(const string& text) {
+    // Short strings are stored inside the object.
+    static const size_t inlineCapacity = string().capacity();
+    return text.capacity() > inlineCapacity ? text.capacity() + 1 : 0;
+}
+
+// Heap use by subsystem, for one World or a whole process.
+struct MemoryUsage {
+    enum Subsystem {
+        Terrain,        // map rows, wall bits
+        Visibility,
+        Entities,       // pools, enemy grid, per-turn scratch
+        Ocean,
+        History,        // rewind ring
+        Distances,      // shared by every World on the same level
+        Prefetch,       // levels the campaign parsed ahead
+        SUBSYSTEM_COUNT
+    };
+
+    size_t bytes[SUBSYSTEM_COUNT] = {};
+
+    size_t total() const {
+        size_t sum = 0;
+        for (size_t value : bytes) {
+            sum += value;
+        }
+        return sum;
+    }
+
+    static const char* name(int subsystem) {
+        static const char* const names[SUBSYSTEM_COUNT] = {
+            "terrain", "visibility", "entities", "ocean", "history", "distances", "prefetch"
+        };
+        return names[subsystem];
+    }
+
+    void print(ostream& out) const {
+        for (int i = 0; i < SUBSYSTEM_COUNT; ++i) {
+            out << "  " << name(i) << string(12 - strlen(name(i)), ' ') << bytes[i] / 1024 << " KB\n";
+        }
+        out << "  total       " << total() / 1024 << " KB\n";
+    }
+};
+
+// Process-wide limit on accounted memory. Every owner of a large buffer
+// keeps a MemoryAccount with its current size; Worlds allocate through
+// their MemoryLedger, so theirs is exact. Caches check the limit as they
+// grow and give way before anything else does: the campaign stops parsing
+// levels ahead and drops a parsed level larger than the room left, the
+// rewind history drops its oldest turns, entity pools hand back their
+// spare blocks and distance caches stop adding per-item and landmark
+// fields (queries then fall back to A*).
+class MemoryBudget {
+public:
+    // Bytes; 0 (the default) means no limit.
+    static void setLimit(size_t bytes) {
+        limit() = bytes;
+    }
+
+    static size_t getLimit() {
+        return limit();
+    }
+
+    static size_t accountedBytes() {
+        return total();
+    }
+
+    // Whether `extra` more bytes stay within the limit.
+    static bool fits(size_t extra) {
+        size_t cap = limit();
+        return cap == 0 || accountedBytes() + extra <= cap;
+    }
+
+private:
+    friend class MemoryAccount;
+
+    static atomic<size_t>& limit() {
+        static atomic<size_t> bytes{ 0 };
+        return bytes;
+    }
+
+    static atomic<size_t>& total() {
+        static atomic<size_t> bytes{ 0 };
+        return bytes;
+    }
+};
+
+// One owner's share of MemoryBudget's total. Safe to change from any
+// thread. A copy starts out empty, so nothing is counted twice.
+class MemoryAccount {
+public:
+    MemoryAccount() = default;
+
+    MemoryAccount(const MemoryAccount&) {
+    }
+
+    MemoryAccount& operator=(const MemoryAccount&) {
+        return *this;
+    }
+
+    ~MemoryAccount() {
+        set(0);
+    }
+
+    void add(size_t bytes) {
+        current += bytes;
+        MemoryBudget::total() += bytes;
+    }
+
+    void remove(size_t bytes) {
+        current -= bytes;
+        MemoryBudget::total() -= bytes;
+    }
+
+    // For owners that measure their buffers instead of allocating through
+    // the account.
+    void set(size_t bytes) {
+        size_t previous = current.exchange(bytes);
+        MemoryBudget::total() += bytes;
+        MemoryBudget::total() -= previous;
+    }
+
+    size_t get() const {
+        return current;
+    }
+
+private:
+    atomic<size_t> current{ 0 };
+};
+
+// Charges a MemoryAccount for every block a container allocates. It shares
+// ownership of the account, so a container moved out of its owner can
+// still pay back. A default-constructed one charges nobody.
+template <typename T>
+class AccountedAllocator {
+public:
+    using value_type = T;
+
+    AccountedAllocator() = default;
+
+    explicit AccountedAllocator(shared_ptr<MemoryAccount> owner) : account(std::move(owner)) {
+    }
+
+    template <typename U>
+    AccountedAllocator(const AccountedAllocator<U>& other) : account(other.getAccount()) {
+    }
+
+    T* allocate(size_t count) {
+        T* block = allocator<T>().allocate(count);
+        if (account) {
+            account->add(count * sizeof(T));
+        }
+        return block;
+    }
+
+    void deallocate(T* block, size_t count) {
+        if (account) {
+            account->remove(count * sizeof(T));
+        }
+        allocator<T>().deallocate(block, count);
+    }
+
+    const shared_ptr<MemoryAccount>& getAccount() const {
+        return account;
+    }
+
+private:
+    shared_ptr<MemoryAccount> account;
+};
+
+template <typename T, typename U>
+bool operator==(const AccountedAllocator<T>& a, const AccountedAllocator<U>& b) {
+    return a.getAccount() == b.getAccount();
+}
+
+template <typename T, typename U>
+bool operator!=(const AccountedAllocator<T>& a, const AccountedAllocator<U>& b) {
+    return !(a == b);
+}
+
+template <typename T>
+using AccountedVector = vector<T, AccountedAllocator<T>>;
+
+using AccountedString = basic_string<char, char_traits<char>, AccountedAllocator<char>>;
+
+// One account per subsystem for a World's own containers, which take their
+// allocator from allocatorFor. The distance and prefetch entries stay
+// empty: those buffers are shared or owned by the campaign.
+class MemoryLedger {
+public:
+    template <typename T>
+    AccountedAllocator<T> allocatorFor(MemoryUsage::Subsystem subsystem) const {
+        return AccountedAllocator<T>(shared_ptr<MemoryAccount>(accounts, &accounts->bySubsystem[subsystem]));
+    }
+
+    MemoryUsage usage() const {
+        MemoryUsage result;
+        for (int i = 0; i < MemoryUsage::SUBSYSTEM_COUNT; ++i) {
+            result.bytes[i] = accounts->bySubsystem[i].get();
+        }
+        return result;
+    }
+
+private:
+    struct Accounts {
+        MemoryAccount bySubsystem[MemoryUsage::SUBSYSTEM_COUNT];
+    };
+
+    shared_ptr<Accounts> accounts = make_shared<Accounts>();
+};
+
+// Typed pool for level entities. Objects live in fixed-size blocks that are
+// never returned to the heap; clear() destroys everything at once and keeps
+// the blocks for the next level, so reloads do not churn the allocator.
+template <typename T, size_t BlockSize = 256>
+class ObjectPool {
+public:
+    ObjectPool() = default;
+
+    // Blocks are allocated through `allocator`.
+    explicit ObjectPool(const AccountedAllocator<T>& allocator) : blocks(allocator) {
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    ~ObjectPool() {
+        clear();
+    }
+
+    template <typename... Args>
+    T* create(Args&&... args) {
+        if (used == blocks.size() * BlockSize) {
+            addBlock();
+        }
+        T* object = slotAt(used);
+        new (object) T(std::forward<Args>(args)...);
+        used++;
+        return object;
+    }
+
+    void reserve(size_t count) {
+        while (blocks.size() * BlockSize < count) {
+            addBlock();
+        }
+    }
+
+    void clear() {
+        for (size_t i = 0; i < used; ++i) {
+            slotAt(i)->~T();
+        }
+        used = 0;
+    }
+
+    size_t size() const {
+        return used;
+    }
+
+    size_t blockCount() const {
+        return blocks.size();
+    }
+
+    // Frees the blocks the live objects do not need.
+    void releaseUnused() {
+        blocks.resize((used + BlockSize - 1) / BlockSize);
+        blocks.shrink_to_fit();
+    }
+
+private:
+    using Slot = typename aligned_storage<sizeof(T), alignof(T)>::type;
+    using Block = AccountedVector<Slot>;
+
+    // A block's buffer never moves, only the Block object does.
+    void addBlock() {
+        blocks.emplace_back(BlockSize, Slot(), blocks.get_allocator());
+    }
+
+    T* slotAt(size_t index) {
+        return reinterpret_cast<T*>(&blocks[index / BlockSize][index % BlockSize]);
+    }
+
+    AccountedVector<Block> blocks;
+    size_t used = 0;
+};
+
+// Process-wide counters for the regression bench: heap allocations made
+// through operator new and the peak resident set size. Allocations are only
+// counted in builds with HOLY_DIVER_COUNT_ALLOCATIONS defined, which replace
+// the global operator new in main.cpp; other builds keep the standard
+// allocator.
+class ProcessStats {
+public:
+    static bool countsAllocations() {
+#if defined(HOLY_DIVER_COUNT_ALLOCATIONS) && !defined(HOLY_DIVER_LIBRARY)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static void countAllocation() {
+        allocations().fetch_add(1, memory_order_relaxed);
+    }
+
+    static uint64_t allocationCount() {
+        return allocations().load(memory_order_relaxed);
+    }
+
+    static uint64_t peakResidentBytes() {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return counters.PeakWorkingSetSize;
+        }
+        return 0;
+#else
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+    }
+
+private:
+    static atomic<uint64_t>& allocations() {
+        static atomic<uint64_t> count{ 0 };
+        return count;
+    }
+};
+
+#endif
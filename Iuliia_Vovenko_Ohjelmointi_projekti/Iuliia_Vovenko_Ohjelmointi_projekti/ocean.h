@@ -0,0 +1,410 @@
+#ifndef HOLY_DIVER_OCEAN_H
+#define HOLY_DIVER_OCEAN_H
+
+#include "memory.h"
+#include "entities.h"
+
+// =====================
+// Ocean
+// =====================
+
+// Dissolved oxygen in the water, one level per cell between 0 and 1. Each
+// turn a diffusion stencil spreads it between open neighbours (walls hold
+// none and pass none), every cell recovers towards BASE_LEVEL, oxygen items
+// keep their cell at SOURCE_LEVEL and the diver's breathing drains its own
+// cell. The resulting differences drive the currents.
+//
+// Levels are kept per TILE_SIZE square tile. Only active tiles (those that
+// changed noticeably on the last step) and their neighbours are updated,
+// row bands of tiles in parallel and each row with AVX when the CPU has it
+// (picked at run time unless the build targets AVX), else SSE2. Storage has a one-cell border of wall around the tiled area,
+// so the stencil never needs bounds checks.
+class OceanField {
+public:
+    static constexpr int TILE_SIZE = 16;
+    static constexpr float BASE_LEVEL = 0.5f;
+    static constexpr float SOURCE_LEVEL = 1.0f;
+    // A tile whose cells moved less than this on a step is settled.
+    static constexpr float SETTLED = 1.0f / 1024;
+    static constexpr int MAX_SETTLE_STEPS = 400;
+
+    struct TileBackup {
+        int tile;
+        float levels[TILE_SIZE * TILE_SIZE];
+    };
+
+    OceanField() = default;
+
+    // Every buffer is allocated through `allocator`.
+    explicit OceanField(const AccountedAllocator<float>& allocator)
+        : levels(allocator), next(allocator), selfWeight(allocator), openMask(allocator), tileSources(allocator),
+          activeTiles(allocator), updateTiles(allocator), bandStarts(allocator), tileChanges(allocator) {
+    }
+
+    bool isEnabled() const {
+        return tilesX > 0;
+    }
+
+    // Releases everything; the ocean stays still until the next reset.
+    void clear() {
+        tilesX = tilesY = 0;
+        stride = 0;
+        levels.clear();
+        next.clear();
+        selfWeight.clear();
+        openMask.clear();
+        tileSources.clear();
+        activeTiles.clear();
+    }
+
+    // Fills the open cells of a level with BASE_LEVEL, pins the sources and
+    // lets the field settle, so a level starts from its steady state.
+    void reset(int width, int height, const uint64_t* wallBits, size_t wordsPerRow,
+        const vector<Position>& sources, const GameConfig& config) {
+        clear();
+        if (width <= 0 || height <= 0) {
+            return;
+        }
+
+        tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        stride = static_cast<size_t>(tilesX) * TILE_SIZE + 2;
+        size_t cells = stride * (static_cast<size_t>(tilesY) * TILE_SIZE + 2);
+
+        diffusion = min(max(config.oceanDiffusionPercent, 0), 20) / 100.0f;
+        recovery = min(max(config.oceanRecoveryPercent, 0), 20) / 100.0f;
+        breath = max(config.oceanBreathPercent, 0) / 100.0f;
+        driftThreshold = max(config.oceanDriftPercent, 1) / 100.0f;
+
+        levels.assign(cells, 0.0f);
+        next.assign(cells, 0.0f);
+        openMask.assign(cells, 0.0f);
+        selfWeight.assign(cells, 0.0f);
+        tileSources.assign(static_cast<size_t>(tilesX) * tilesY, AccountedVector<size_t>(tileSources.get_allocator()));
+
+        auto isOpen = [&](int x, int y) {
+            return x >= 0 && x < width && y >= 0 && y < height
+                && ((wallBits[y * wordsPerRow + (x >> 6)] >> (x & 63)) & 1) == 0;
+        };
+
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (!isOpen(x, y)) {
+                    continue;
+                }
+                int openNeighbours = isOpen(x, y - 1) + isOpen(x, y + 1) + isOpen(x - 1, y) + isOpen(x + 1, y);
+                size_t cell = index(x, y);
+                levels[cell] = BASE_LEVEL;
+                openMask[cell] = 1.0f;
+                selfWeight[cell] = 1.0f - diffusion * openNeighbours - recovery;
+            }
+        }
+
+        for (const Position& source : sources) {
+            setSource(source.x, source.y, true);
+        }
+        for (int step = 0; step < MAX_SETTLE_STEPS && !activeTiles.empty(); ++step) {
+            advance(nullptr);
+        }
+    }
+
+    float levelAt(int x, int y) const {
+        return isEnabled() ? levels[index(x, y)] : BASE_LEVEL;
+    }
+
+    // Starts or stops pinning a cell at SOURCE_LEVEL.
+    void setSource(int x, int y, bool on) {
+        if (!isEnabled()) {
+            return;
+        }
+        int tile = tileOf(x, y);
+        AccountedVector<size_t>& list = tileSources[tile];
+        size_t cell = index(x, y);
+        auto it = find(list.begin(), list.end(), cell);
+        if (on && it == list.end()) {
+            list.push_back(cell);
+        }
+        else if (!on && it != list.end()) {
+            list.erase(it);
+        }
+        activate(tile);
+    }
+
+    // Which way the water pushes at a cell: towards its lowest open
+    // neighbour, when the open neighbours differ by more than the drift
+    // threshold. The cell itself is left out, so a diver draining its own
+    // cell is not held in place by it. {0, 0} in still water.
+    Position currentAt(int x, int y) const {
+        Position push{ 0, 0 };
+        if (!isEnabled()) {
+            return push;
+        }
+
+        static const int dirs[4][2] = { {0, -1}, {0, 1}, {-1, 0}, {1, 0} };
+        size_t cell = index(x, y);
+        float lowest = SOURCE_LEVEL + 1.0f;
+        float highest = -1.0f;
+        for (const auto& dir : dirs) {
+            size_t neighbour = cell + dir[0] + static_cast<ptrdiff_t>(dir[1]) * static_cast<ptrdiff_t>(stride);
+            if (openMask[neighbour] == 0.0f) {
+                continue;
+            }
+            highest = max(highest, levels[neighbour]);
+            if (levels[neighbour] < lowest) {
+                lowest = levels[neighbour];
+                push = { dir[0], dir[1] };
+            }
+        }
+        return highest - lowest > driftThreshold ? push : Position{ 0, 0 };
+    }
+
+    // Oxygen the diver uses for an action at a cell: the base cost in water
+    // at BASE_LEVEL, half of it at a source, one and a half times it in
+    // exhausted water.
+    int oxygenCost(int baseCost, Position at) const {
+        if (!isEnabled()) {
+            return baseCost;
+        }
+        float scale = 1.0f + BASE_LEVEL - levelAt(at.x, at.y);
+        return static_cast<int>(baseCost * scale + 0.5f);
+    }
+
+    // The diver breathes at a cell: its level drops before the next step.
+    void breathe(Position at) {
+        if (!isEnabled() || breath <= 0.0f) {
+            return;
+        }
+        activate(tileOf(at.x, at.y));
+        pendingBreath = at;
+    }
+
+    // One turn of the ocean. When `undo` is given, the levels of every tile
+    // about to change are appended to it first.
+    void advance(AccountedVector<TileBackup>* undo) {
+        if (!isEnabled() || activeTiles.empty()) {
+            return;
+        }
+
+        collectUpdateTiles();
+
+        if (undo != nullptr) {
+            for (int tile : updateTiles) {
+                undo->emplace_back();
+                TileBackup& backup = undo->back();
+                backup.tile = tile;
+                forEachTileRow(tile, [&](size_t first, int row) {
+                    copy(&levels[first], &levels[first] + TILE_SIZE, backup.levels + row * TILE_SIZE);
+                });
+            }
+        }
+
+        if (pendingBreath.x >= 0) {
+            float& level = levels[index(pendingBreath.x, pendingBreath.y)];
+            level = max(0.0f, level - breath);
+            pendingBreath = Position();
+        }
+
+        // Tiles are sorted, so each band (one row of tiles) is a contiguous
+        // range of updateTiles. Bands only read from each other.
+        bandStarts.clear();
+        for (size_t i = 0; i < updateTiles.size(); ++i) {
+            if (i == 0 || updateTiles[i] / tilesX != updateTiles[i - 1] / tilesX) {
+                bandStarts.push_back(i);
+            }
+        }
+        bandStarts.push_back(updateTiles.size());
+        tileChanges.assign(updateTiles.size(), 0.0f);
+
+        size_t bands = bandStarts.size() - 1;
+        Parallel::forRange(bands, BANDS_PER_TASK, [this](size_t begin, size_t end) {
+            for (size_t i = bandStarts[begin]; i < bandStarts[end]; ++i) {
+                stencilTile(updateTiles[i]);
+            }
+        });
+        Parallel::forRange(bands, BANDS_PER_TASK, [this](size_t begin, size_t end) {
+            for (size_t i = bandStarts[begin]; i < bandStarts[end]; ++i) {
+                tileChanges[i] = commitTile(updateTiles[i]);
+            }
+        });
+
+        activeTiles.clear();
+        for (size_t i = 0; i < updateTiles.size(); ++i) {
+            if (tileChanges[i] > SETTLED) {
+                activeTiles.push_back(updateTiles[i]);
+            }
+        }
+    }
+
+    const AccountedVector<int>& getActiveTiles() const {
+        return activeTiles;
+    }
+
+    // Puts back levels saved by advance() and the active tiles of that
+    // moment.
+    void restore(const AccountedVector<TileBackup>& backups, const AccountedVector<int>& active) {
+        if (!isEnabled()) {
+            return;
+        }
+        for (const TileBackup& backup : backups) {
+            forEachTileRow(backup.tile, [&](size_t first, int row) {
+                copy(backup.levels + row * TILE_SIZE, backup.levels + (row + 1) * TILE_SIZE, &levels[first]);
+            });
+        }
+        activeTiles = active;
+        pendingBreath = Position();
+    }
+
+private:
+    static constexpr size_t BANDS_PER_TASK = 4;
+
+    size_t index(int x, int y) const {
+        return (static_cast<size_t>(y) + 1) * stride + x + 1;
+    }
+
+    int tileOf(int x, int y) const {
+        return (y / TILE_SIZE) * tilesX + x / TILE_SIZE;
+    }
+
+    void activate(int tile) {
+        auto it = lower_bound(activeTiles.begin(), activeTiles.end(), tile);
+        if (it == activeTiles.end() || *it != tile) {
+            activeTiles.insert(it, tile);
+        }
+    }
+
+    // Active tiles and their four neighbours, sorted.
+    void collectUpdateTiles() {
+        updateTiles.clear();
+        for (int tile : activeTiles) {
+            int tx = tile % tilesX;
+            int ty = tile / tilesX;
+            updateTiles.push_back(tile);
+            if (tx > 0) {
+                updateTiles.push_back(tile - 1);
+            }
+            if (tx + 1 < tilesX) {
+                updateTiles.push_back(tile + 1);
+            }
+            if (ty > 0) {
+                updateTiles.push_back(tile - tilesX);
+            }
+            if (ty + 1 < tilesY) {
+                updateTiles.push_back(tile + tilesX);
+            }
+        }
+        sort(updateTiles.begin(), updateTiles.end());
+        updateTiles.erase(unique(updateTiles.begin(), updateTiles.end()), updateTiles.end());
+    }
+
+    // Calls fn(index of the row's first cell, row) for each row of a tile.
+    template <typename Fn>
+    void forEachTileRow(int tile, Fn fn) const {
+        int left = (tile % tilesX) * TILE_SIZE;
+        int top = (tile / tilesX) * TILE_SIZE;
+        for (int row = 0; row < TILE_SIZE; ++row) {
+            fn(index(left, top + row), row);
+        }
+    }
+
+    // next = selfWeight * level + openMask * (diffusion * (up + down + left
+    // + right) + recovery * BASE_LEVEL), in that order on every path so the
+    // vector and scalar results are identical.
+    void stencilTile(int tile) {
+        const float rest = recovery * BASE_LEVEL;
+#if !defined(__AVX__) && defined(HOLY_DIVER_AVX_DISPATCH)
+        const bool useAvx = CpuFeatures::hasAvx();
+#endif
+        forEachTileRow(tile, [&](size_t first, int) {
+            const float* level = &levels[first];
+            const float* up = level - stride;
+            const float* down = level + stride;
+            const float* weight = &selfWeight[first];
+            const float* mask = &openMask[first];
+            float* out = &next[first];
+
+            int x = 0;
+#if defined(__AVX__)
+            x = stencilRowAvx(level, up, down, weight, mask, out, diffusion, rest);
+#elif defined(HOLY_DIVER_AVX_DISPATCH)
+            if (useAvx) {
+                x = stencilRowAvx(level, up, down, weight, mask, out, diffusion, rest);
+            }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+            const __m128 diffusion4 = _mm_set1_ps(diffusion);
+            const __m128 rest4 = _mm_set1_ps(rest);
+            for (; x + 4 <= TILE_SIZE; x += 4) {
+                __m128 vertical = _mm_add_ps(_mm_loadu_ps(up + x), _mm_loadu_ps(down + x));
+                __m128 horizontal = _mm_add_ps(_mm_loadu_ps(level + x - 1), _mm_loadu_ps(level + x + 1));
+                __m128 inflow = _mm_add_ps(_mm_mul_ps(diffusion4, _mm_add_ps(vertical, horizontal)), rest4);
+                __m128 kept = _mm_mul_ps(_mm_loadu_ps(weight + x), _mm_loadu_ps(level + x));
+                _mm_storeu_ps(out + x, _mm_add_ps(kept, _mm_mul_ps(_mm_loadu_ps(mask + x), inflow)));
+            }
+#endif
+            for (; x < TILE_SIZE; ++x) {
+                float inflow = diffusion * ((up[x] + down[x]) + (level[x - 1] + level[x + 1])) + rest;
+                out[x] = weight[x] * level[x] + mask[x] * inflow;
+            }
+        });
+    }
+
+#if defined(__AVX__) || defined(HOLY_DIVER_AVX_DISPATCH)
+    // One tile row, 8 cells at a time. Returns the first x it did not do.
+    HOLY_DIVER_TARGET_AVX
+    static int stencilRowAvx(const float* level, const float* up, const float* down, const float* weight,
+        const float* mask, float* out, float diffusion, float rest) {
+        const __m256 diffusion8 = _mm256_set1_ps(diffusion);
+        const __m256 rest8 = _mm256_set1_ps(rest);
+        int x = 0;
+        for (; x + 8 <= TILE_SIZE; x += 8) {
+            __m256 vertical = _mm256_add_ps(_mm256_loadu_ps(up + x), _mm256_loadu_ps(down + x));
+            __m256 horizontal = _mm256_add_ps(_mm256_loadu_ps(level + x - 1), _mm256_loadu_ps(level + x + 1));
+            __m256 inflow = _mm256_add_ps(_mm256_mul_ps(diffusion8, _mm256_add_ps(vertical, horizontal)), rest8);
+            __m256 kept = _mm256_mul_ps(_mm256_loadu_ps(weight + x), _mm256_loadu_ps(level + x));
+            _mm256_storeu_ps(out + x, _mm256_add_ps(kept, _mm256_mul_ps(_mm256_loadu_ps(mask + x), inflow)));
+        }
+        return x;
+    }
+#endif
+
+    // Pins the tile's sources, copies its new levels in and returns the
+    // largest change.
+    float commitTile(int tile) {
+        for (size_t cell : tileSources[tile]) {
+            next[cell] = SOURCE_LEVEL;
+        }
+
+        float change = 0.0f;
+        forEachTileRow(tile, [&](size_t first, int) {
+            for (size_t cell = first; cell < first + TILE_SIZE; ++cell) {
+                change = max(change, fabs(next[cell] - levels[cell]));
+                levels[cell] = next[cell];
+            }
+        });
+        return change;
+    }
+
+    int tilesX = 0;
+    int tilesY = 0;
+    size_t stride = 0;
+    float diffusion = 0.0f;
+    float recovery = 0.0f;
+    float breath = 0.0f;
+    float driftThreshold = 0.0f;
+
+    AccountedVector<float> levels;
+    AccountedVector<float> next;
+    // Per cell: 1 - diffusion * open neighbours - recovery, 0 for walls.
+    AccountedVector<float> selfWeight;
+    // 1 for open cells, 0 for walls and the border.
+    AccountedVector<float> openMask;
+    AccountedVector<AccountedVector<size_t>> tileSources;
+
+    AccountedVector<int> activeTiles;
+    AccountedVector<int> updateTiles;
+    AccountedVector<size_t> bandStarts;
+    AccountedVector<float> tileChanges;
+    Position pendingBreath;
+};
+
+#endif
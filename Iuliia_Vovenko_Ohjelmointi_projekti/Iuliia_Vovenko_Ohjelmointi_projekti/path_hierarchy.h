@@ -0,0 +1,418 @@
+#ifndef HOLY_DIVER_PATH_HIERARCHY_H
+#define HOLY_DIVER_PATH_HIERARCHY_H
+
+#include "memory.h"
+
+// =====================
+// Path hierarchy
+// =====================
+
+// Hierarchical pathfinding (HPA*) for maps too large for per-level distance
+// fields. The grid is cut into CLUSTER_SIZE square clusters. Every run of
+// open cells along a cluster border gets an entrance on both sides (one in
+// the middle, or one at each end of a long run), and each cluster stores
+// the walking distances between its own entrance cells. A query searches
+// that small graph, entering and leaving it through the clusters of its
+// end points, and a path is refined into cells one cluster at a time.
+// Results are near-optimal rather than exact.
+class PathHierarchy {
+public:
+    static constexpr int CLUSTER_SIZE = 32;
+    static constexpr int LONG_ENTRANCE = 6;
+
+    PathHierarchy(int mapWidth, int mapHeight, const vector<uint64_t>& wallBits, size_t rowWords)
+        : width(mapWidth), height(mapHeight), wordsPerRow(rowWords), walls(wallBits),
+        clustersX((mapWidth + CLUSTER_SIZE - 1) / CLUSTER_SIZE),
+        clustersY((mapHeight + CLUSTER_SIZE - 1) / CLUSTER_SIZE),
+        clusters(static_cast<size_t>(clustersX) * clustersY),
+        dirty(clusters.size(), false) {
+    }
+
+    // Builds every cluster, spread over all cores.
+    void build() {
+        Parallel::forRange(clusters.size(), 64, [this](size_t begin, size_t end) {
+            for (size_t id = begin; id < end; ++id) {
+                buildCluster(static_cast<int>(id));
+            }
+        });
+    }
+
+    // Changes one cell; call rebuildDirty() before the next query.
+    void setWall(int x, int y, bool wall) {
+        if (!inBounds(x, y)) {
+            return;
+        }
+        uint64_t bit = uint64_t(1) << (x & 63);
+        uint64_t& word = walls[y * wordsPerRow + (x >> 6)];
+        word = wall ? (word | bit) : (word & ~bit);
+        dirty[clusterOf({ x, y })] = true;
+    }
+
+    // Rebuilds the changed clusters and their four neighbours, whose
+    // entrances on the shared borders may have moved. Returns how many
+    // clusters were rebuilt.
+    size_t rebuildDirty() {
+        vector<int> pending;
+        for (size_t id = 0; id < clusters.size(); ++id) {
+            if (!dirty[id]) {
+                continue;
+            }
+            int cx = static_cast<int>(id) % clustersX;
+            int cy = static_cast<int>(id) / clustersX;
+            pending.push_back(static_cast<int>(id));
+            if (cx > 0) {
+                pending.push_back(static_cast<int>(id) - 1);
+            }
+            if (cx + 1 < clustersX) {
+                pending.push_back(static_cast<int>(id) + 1);
+            }
+            if (cy > 0) {
+                pending.push_back(static_cast<int>(id) - clustersX);
+            }
+            if (cy + 1 < clustersY) {
+                pending.push_back(static_cast<int>(id) + clustersX);
+            }
+            dirty[id] = false;
+        }
+
+        sort(pending.begin(), pending.end());
+        pending.erase(unique(pending.begin(), pending.end()), pending.end());
+        for (int id : pending) {
+            buildCluster(id);
+        }
+        return pending.size();
+    }
+
+    size_t nodeCount() const {
+        size_t count = 0;
+        for (const Cluster& cluster : clusters) {
+            count += cluster.nodes.size();
+        }
+        return count;
+    }
+
+    size_t memoryUsage() const {
+        size_t bytes = heapBytes(walls) + heapBytes(clusters) + heapBytes(dirty);
+        for (const Cluster& cluster : clusters) {
+            bytes += heapBytes(cluster.nodes) + heapBytes(cluster.distances);
+        }
+        return bytes;
+    }
+
+    // Length of the path findPath would return, -1 if there is none.
+    int distance(Position from, Position to) const {
+        vector<Position> waypoints;
+        return search(from, to, waypoints);
+    }
+
+    // Cells from `from` to `to`, both included. False if there is no path.
+    bool findPath(Position from, Position to, vector<Position>& path) const {
+        path.clear();
+        vector<Position> waypoints;
+        if (search(from, to, waypoints) < 0) {
+            return false;
+        }
+
+        path.push_back(from);
+        for (size_t i = 1; i < waypoints.size(); ++i) {
+            Position a = waypoints[i - 1];
+            Position b = waypoints[i];
+            if (clusterOf(a) != clusterOf(b)) {
+                path.push_back(b); // border crossing
+            }
+            else {
+                localSearch(a, &b, nullptr, &path);
+            }
+        }
+        return true;
+    }
+
+private:
+    struct Cluster {
+        vector<Position> nodes;
+        // nodes.size() squared, UNREACHABLE between disconnected nodes.
+        vector<uint16_t> distances;
+    };
+
+    static constexpr uint16_t UNREACHABLE = 0xFFFF;
+
+    bool inBounds(int x, int y) const {
+        return x >= 0 && x < width && y >= 0 && y < height;
+    }
+
+    bool isWalkable(int x, int y) const {
+        return inBounds(x, y) && ((walls[y * wordsPerRow + (x >> 6)] >> (x & 63)) & 1) == 0;
+    }
+
+    int clusterOf(Position p) const {
+        return (p.y / CLUSTER_SIZE) * clustersX + p.x / CLUSTER_SIZE;
+    }
+
+    int nodeIndex(const Cluster& cluster, Position p) const {
+        for (size_t i = 0; i < cluster.nodes.size(); ++i) {
+            if (cluster.nodes[i] == p) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    // Walks one side of a cluster: cells first + k * step for k < length,
+    // each facing the cell at + across in the neighbour. Both clusters scan
+    // the shared border in the same order, so they pick the same entrances.
+    template <typename Fn>
+    void scanBorder(Position first, Position step, Position across, int length, Fn fn) const {
+        int runStart = -1;
+        for (int k = 0; k <= length; ++k) {
+            Position inside{ first.x + k * step.x, first.y + k * step.y };
+            bool open = k < length && isWalkable(inside.x, inside.y)
+                && isWalkable(inside.x + across.x, inside.y + across.y);
+            if (open && runStart < 0) {
+                runStart = k;
+            }
+            if (!open && runStart >= 0) {
+                int runEnd = k - 1;
+                if (runEnd - runStart + 1 < LONG_ENTRANCE) {
+                    int middle = (runStart + runEnd) / 2;
+                    fn(Position{ first.x + middle * step.x, first.y + middle * step.y });
+                }
+                else {
+                    fn(Position{ first.x + runStart * step.x, first.y + runStart * step.y });
+                    fn(Position{ first.x + runEnd * step.x, first.y + runEnd * step.y });
+                }
+                runStart = -1;
+            }
+        }
+    }
+
+    void buildCluster(int id) {
+        Cluster& cluster = clusters[id];
+        cluster.nodes.clear();
+
+        int cx = id % clustersX;
+        int cy = id / clustersX;
+        int left = cx * CLUSTER_SIZE;
+        int top = cy * CLUSTER_SIZE;
+        int right = min(width, left + CLUSTER_SIZE) - 1;
+        int bottom = min(height, top + CLUSTER_SIZE) - 1;
+        auto add = [&cluster](Position p) {
+            cluster.nodes.push_back(p);
+        };
+
+        if (cy > 0) {
+            scanBorder({ left, top }, { 1, 0 }, { 0, -1 }, right - left + 1, add);
+        }
+        if (cy + 1 < clustersY) {
+            scanBorder({ left, bottom }, { 1, 0 }, { 0, 1 }, right - left + 1, add);
+        }
+        if (cx > 0) {
+            scanBorder({ left, top }, { 0, 1 }, { -1, 0 }, bottom - top + 1, add);
+        }
+        if (cx + 1 < clustersX) {
+            scanBorder({ right, top }, { 0, 1 }, { 1, 0 }, bottom - top + 1, add);
+        }
+
+        // A corner cell can be an entrance on two sides.
+        sort(cluster.nodes.begin(), cluster.nodes.end(), [](const Position& a, const Position& b) {
+            return a.y != b.y ? a.y < b.y : a.x < b.x;
+        });
+        cluster.nodes.erase(unique(cluster.nodes.begin(), cluster.nodes.end()), cluster.nodes.end());
+
+        size_t count = cluster.nodes.size();
+        cluster.distances.assign(count * count, static_cast<uint16_t>(UNREACHABLE));
+        vector<int> toNodes;
+        for (size_t i = 0; i < count; ++i) {
+            localSearch(cluster.nodes[i], nullptr, &toNodes, nullptr);
+            for (size_t j = 0; j < count; ++j) {
+                cluster.distances[i * count + j] = toNodes[j] < 0 ? UNREACHABLE : static_cast<uint16_t>(toNodes[j]);
+            }
+        }
+    }
+
+    // Breadth-first search from `origin` that stays inside its cluster.
+    // Fills the distance to every node of the cluster (-1 if unreachable)
+    // and, when `target` is given, returns the distance to it and appends
+    // the cells after `origin` up to the target to `path`.
+    int localSearch(Position origin, const Position* target, vector<int>* toNodes, vector<Position>* path) const {
+        int id = clusterOf(origin);
+        const Cluster& cluster = clusters[id];
+        int left = (id % clustersX) * CLUSTER_SIZE;
+        int top = (id / clustersX) * CLUSTER_SIZE;
+        int clusterWidth = min(width - left, static_cast<int>(CLUSTER_SIZE));
+        int clusterHeight = min(height - top, static_cast<int>(CLUSTER_SIZE));
+
+        // Local cell -> previous local cell, -1 when not reached yet.
+        int previous[CLUSTER_SIZE * CLUSTER_SIZE];
+        int distanceTo[CLUSTER_SIZE * CLUSTER_SIZE];
+        int frontier[CLUSTER_SIZE * CLUSTER_SIZE];
+        fill(previous, previous + clusterWidth * clusterHeight, -1);
+
+        int start = (origin.y - top) * clusterWidth + (origin.x - left);
+        previous[start] = start;
+        distanceTo[start] = 0;
+        frontier[0] = start;
+        int tail = 1;
+
+        static const int dirs[4][2] = { {0, -1}, {0, 1}, {-1, 0}, {1, 0} };
+        for (int head = 0; head < tail; ++head) {
+            int cell = frontier[head];
+            int x = cell % clusterWidth;
+            int y = cell / clusterWidth;
+            for (const auto& dir : dirs) {
+                int nx = x + dir[0];
+                int ny = y + dir[1];
+                if (nx < 0 || nx >= clusterWidth || ny < 0 || ny >= clusterHeight) {
+                    continue;
+                }
+                int next = ny * clusterWidth + nx;
+                if (previous[next] < 0 && isWalkable(left + nx, top + ny)) {
+                    previous[next] = cell;
+                    distanceTo[next] = distanceTo[cell] + 1;
+                    frontier[tail++] = next;
+                }
+            }
+        }
+
+        if (toNodes != nullptr) {
+            toNodes->assign(cluster.nodes.size(), -1);
+            for (size_t i = 0; i < cluster.nodes.size(); ++i) {
+                int cell = (cluster.nodes[i].y - top) * clusterWidth + (cluster.nodes[i].x - left);
+                if (previous[cell] >= 0) {
+                    (*toNodes)[i] = distanceTo[cell];
+                }
+            }
+        }
+
+        if (target == nullptr || clusterOf(*target) != id) {
+            return -1;
+        }
+        int goal = (target->y - top) * clusterWidth + (target->x - left);
+        if (previous[goal] < 0) {
+            return -1;
+        }
+
+        if (path != nullptr) {
+            size_t first = path->size();
+            for (int cell = goal; cell != start; cell = previous[cell]) {
+                path->push_back({ left + cell % clusterWidth, top + cell / clusterWidth });
+            }
+            reverse(path->begin() + first, path->end());
+        }
+        return distanceTo[goal];
+    }
+
+    // A* over the entrance graph. Fills the visited waypoints from `from`
+    // to `to` and returns the path length, or -1.
+    int search(Position from, Position to, vector<Position>& waypoints) const {
+        waypoints.clear();
+        if (!isWalkable(from.x, from.y) || !isWalkable(to.x, to.y)) {
+            return -1;
+        }
+
+        const Cluster& goalCluster = clusters[clusterOf(to)];
+        vector<int> fromStart;
+        vector<int> toGoal;
+        int best = localSearch(from, &to, &fromStart, nullptr);
+        localSearch(to, nullptr, &toGoal, nullptr);
+        if (best < 0) {
+            best = numeric_limits<int>::max();
+        }
+
+        auto key = [this](Position p) {
+            return static_cast<size_t>(p.y) * width + p.x;
+        };
+        auto estimate = [&to](Position p) {
+            return abs(p.x - to.x) + abs(p.y - to.y);
+        };
+
+        typedef pair<int, size_t> Entry; // (f, cell)
+        priority_queue<Entry, vector<Entry>, greater<Entry>> open;
+        unordered_map<size_t, int> cost;
+        unordered_map<size_t, size_t> parent;
+        const size_t START = numeric_limits<size_t>::max();
+        size_t last = START;
+
+        auto relax = [&](Position p, int g, size_t via) {
+            size_t cell = key(p);
+            auto found = cost.find(cell);
+            if (found == cost.end() || g < found->second) {
+                cost[cell] = g;
+                parent[cell] = via;
+                open.push({ g + estimate(p), cell });
+            }
+        };
+
+        const Cluster& startCluster = clusters[clusterOf(from)];
+        for (size_t i = 0; i < startCluster.nodes.size(); ++i) {
+            if (fromStart[i] >= 0) {
+                relax(startCluster.nodes[i], fromStart[i], START);
+            }
+        }
+
+        static const int dirs[4][2] = { {0, -1}, {0, 1}, {-1, 0}, {1, 0} };
+        while (!open.empty()) {
+            int f = open.top().first;
+            size_t cell = open.top().second;
+            open.pop();
+            if (f >= best) {
+                break;
+            }
+
+            Position here{ static_cast<int>(cell % width), static_cast<int>(cell / width) };
+            int g = cost[cell];
+            if (f > g + estimate(here)) {
+                continue; // stale entry
+            }
+
+            int id = clusterOf(here);
+            const Cluster& cluster = clusters[id];
+            int index = nodeIndex(cluster, here);
+
+            if (&cluster == &goalCluster && toGoal[index] >= 0 && g + toGoal[index] < best) {
+                best = g + toGoal[index];
+                last = cell;
+            }
+
+            size_t count = cluster.nodes.size();
+            for (size_t j = 0; j < count; ++j) {
+                uint16_t d = cluster.distances[index * count + j];
+                if (d != UNREACHABLE && static_cast<int>(j) != index) {
+                    relax(cluster.nodes[j], g + d, cell);
+                }
+            }
+
+            for (const auto& dir : dirs) {
+                Position next{ here.x + dir[0], here.y + dir[1] };
+                if (!isWalkable(next.x, next.y) || clusterOf(next) == id) {
+                    continue;
+                }
+                if (nodeIndex(clusters[clusterOf(next)], next) >= 0) {
+                    relax(next, g + 1, cell);
+                }
+            }
+        }
+
+        if (best == numeric_limits<int>::max()) {
+            return -1;
+        }
+
+        waypoints.push_back(to);
+        for (size_t cell = last; cell != START; cell = parent[cell]) {
+            waypoints.push_back({ static_cast<int>(cell % width), static_cast<int>(cell / width) });
+        }
+        waypoints.push_back(from);
+        reverse(waypoints.begin(), waypoints.end());
+        return best;
+    }
+
+    int width;
+    int height;
+    size_t wordsPerRow;
+    vector<uint64_t> walls;
+    int clustersX;
+    int clustersY;
+    vector<Cluster> clusters;
+    vector<bool> dirty;
+};
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef HOLY_DIVER_REGRESSION_BENCH_H
+#define HOLY_DIVER_REGRESSION_BENCH_H
+
+#include "game.h"
+
+// =====================
+// Regression bench
+// =====================
+
+// Border walls, about a quarter inner walls, enemyPercent enemies and
+// itemPercent items (1% each by default), and the diver in the middle.
+inline bool writeGeneratedLevel(const string& path, int width, int height, uint32_t seed, string& error,
+    int enemyPercent = 1, int itemPercent = 1) {
+    RandomStream rng(seed);
+    ofstream out(path, ios::trunc);
+    if (!out) {
+        error = "Failed to write " + path;
+        return false;
+    }
+
+    string row;
+    for (int y = 0; y < height; ++y) {
+        row.assign(width, 'o');
+        for (int x = 0; x < width; ++x) {
+            int roll = rng.nextInt(0, 99);
+            bool border = x == 0 || y == 0 || x == width - 1 || y == height - 1;
+            if (border || roll < 25) {
+                row[x] = 'x';
+            }
+            else if (roll < 25 + enemyPercent) {
+                row[x] = 'M';
+            }
+            else if (roll < 25 + enemyPercent + itemPercent) {
+                row[x] = rng.nextInt(0, 1) == 0 ? 'O' : 'B';
+            }
+        }
+        if (y == height / 2) {
+            row[width / 2] = 'P';
+        }
+        out << row << '\n';
+    }
+    return static_cast<bool>(out);
+}
+
+// Replays fixed seeded command scripts through the whole Game (input queue,
+// presenter, render) with cout sent to a null sink, and measures turns per
+// second, peak RSS and, in HOLY_DIVER_COUNT_ALLOCATIONS builds, heap
+// allocations per case. The results are written to or checked against a
+// baseline file of "case.metric = value" lines.
+//
+// The game runs with the default GameConfig. Each script is made by playing
+// the level on a copy of the world first and leaving out commands that
+// would kill the diver or finish the level, so every script runs to its
+// end; a case that stops early fails the bench.
+class RegressionBench {
+public:
+    struct Result {
+        string name;
+        int turns = 0;
+        double turnsPerSecond = 0;
+        uint64_t peakResidentKb = 0;
+        uint64_t allocations = 0;   // only in builds that count them
+    };
+
+    // Plays every case once. The generated levels are written next to the
+    // working directory as bench_*.map. Peak RSS is a process-wide high-water
+    // mark, so cases run from the smallest level up.
+    bool run(vector<Result>& results, string& error) {
+        for (const Case& benchCase : cases()) {
+            if (benchCase.width > 0
+                && !writeGeneratedLevel(benchCase.mapPath, benchCase.width, benchCase.height, benchCase.seed, error)) {
+                return false;
+            }
+
+            Result result;
+            if (!play(benchCase, result, error)) {
+                return false;
+            }
+            results.push_back(result);
+        }
+        return true;
+    }
+
+    static bool writeBaseline(const string& path, const vector<Result>& results, string& error) {
+        ofstream out(path, ios::trunc);
+        if (!out) {
+            error = "Failed to open baseline file: " + path;
+            return false;
+        }
+
+        out << "# Regression bench baseline, written by --bench --record\n";
+        for (const Result& result : results) {
+            out << result.name << ".turns_per_second = " << static_cast<uint64_t>(result.turnsPerSecond) << "\n";
+            out << result.name << ".peak_rss_kb = " << result.peakResidentKb << "\n";
+            if (ProcessStats::countsAllocations()) {
+                out << result.name << ".allocations = " << result.allocations << "\n";
+            }
+        }
+        return true;
+    }
+
+    // Prints one line per metric. Throughput may not drop, and peak RSS and
+    // allocations may not grow, by more than tolerancePercent. Returns false
+    // when any metric fails or is missing from the baseline. Allocations are
+    // skipped by builds that do not count them.
+    static bool compare(const string& path, const vector<Result>& results, int tolerancePercent,
+        ostream& out, string& error) {
+        vector<pair<string, string>> settings;
+        if (!readSettings(path, settings, error)) {
+            return false;
+        }
+        map<string, double> baseline;
+        for (const auto& setting : settings) {
+            baseline[setting.first] = atof(setting.second.c_str());
+        }
+
+        double tolerance = tolerancePercent / 100.0;
+        bool passed = true;
+        for (const Result& result : results) {
+            passed = check(out, baseline, result.name + ".turns_per_second", result.turnsPerSecond, false, tolerance) && passed;
+            passed = check(out, baseline, result.name + ".peak_rss_kb", static_cast<double>(result.peakResidentKb), true, tolerance) && passed;
+            if (ProcessStats::countsAllocations()) {
+                passed = check(out, baseline, result.name + ".allocations", static_cast<double>(result.allocations), true, tolerance) && passed;
+            }
+        }
+        return passed;
+    }
+
+private:
+    struct Case {
+        const char* name;
+        const char* mapPath;
+        int width;       // 0 for a map shipped with the game
+        int height;
+        uint32_t seed;
+        int turns;
+    };
+
+    static const vector<Case>& cases() {
+        static const vector<Case> list = {
+            { "level_0", "level_0.map", 0, 0, 1, 2000 },
+            { "level", "level.map", 0, 0, 2, 2000 },
+            { "large", "bench_large.map", 256, 256, 3, 2000 },
+            { "huge", "bench_huge.map", 1024, 1024, 4, 1000 }
+        };
+        return list;
+    }
+
+    // A null sink for cout that still goes through the stream machinery.
+    class NullBuffer : public streambuf {
+    protected:
+        int overflow(int c) override {
+            return traits_type::not_eof(c);
+        }
+
+        streamsize xsputn(const char*, streamsize count) override {
+            return count;
+        }
+    };
+
+    static constexpr int MAX_TRIES = 8;
+
+    // Mostly moves, with some illumination and the odd undo. Every command is
+    // tried on a world set up exactly like the game's; one that kills the
+    // diver or finishes the level is undone there and another one rolled.
+    // When nothing works the script reloads the level. The copy keeps one
+    // more turn of history than the game, so undoing a try never loses a
+    // turn the game could still undo.
+    static bool buildScript(const Case& benchCase, const GameConfig& config, string& script, string& error) {
+        static const char moves[] = { 'w', 'a', 's', 'd' };
+        static const char lights[] = { 'i', 'j', 'k', 'l' };
+
+        LevelData level;
+        if (!LevelData::read(benchCase.mapPath, level, error)) {
+            return false;
+        }
+
+        ostream discard(nullptr);
+        World world;
+        world.setOutput(discard);
+        world.setConfig(config);
+        world.setSeed(benchCase.seed);
+        size_t gameHistory = world.getHistoryCapacity();
+        world.setHistoryCapacity(gameHistory + 1);
+        if (!world.loadLevel(std::move(level), false)) {
+            error = string("Failed to load ") + benchCase.mapPath;
+            return false;
+        }
+
+        RandomStream rng(benchCase.seed);
+        size_t undoDepth = 0;   // as the game sees it
+        script.clear();
+        for (int i = 0; i < benchCase.turns; ++i) {
+            char command = 'r';
+            for (int attempt = 0; attempt < MAX_TRIES; ++attempt) {
+                int roll = rng.nextInt(0, 99);
+                char candidate = roll < 80 ? moves[rng.nextInt(0, 3)] : roll < 98 ? lights[rng.nextInt(0, 3)] : 'u';
+                if (candidate == 'u') {
+                    if (undoDepth > 0) {
+                        world.rewind(1);
+                        undoDepth--;
+                        command = candidate;
+                        break;
+                    }
+                    continue;
+                }
+
+                int turnBefore = world.getTurn();
+                applyCommand(world, candidate);
+                if (!world.isPlayerDead() && !world.isLevelCompleted()) {
+                    if (world.getTurn() != turnBefore) {
+                        undoDepth = min(undoDepth + 1, gameHistory);
+                    }
+                    command = candidate;
+                    break;
+                }
+                world.rewind(1);
+            }
+
+            if (command == 'r') {
+                if (!world.reload()) {
+                    error = string("Failed to reload ") + benchCase.mapPath;
+                    return false;
+                }
+                undoDepth = 0;
+            }
+            script += command;
+            script += '\n';
+        }
+        script += "q\n";
+        return true;
+    }
+
+    static void applyCommand(World& world, char command) {
+        switch (command) {
+        case 'w':
+            world.requestPlayerMove(0, -1);
+            break;
+        case 's':
+            world.requestPlayerMove(0, 1);
+            break;
+        case 'a':
+            world.requestPlayerMove(-1, 0);
+            break;
+        case 'd':
+            world.requestPlayerMove(1, 0);
+            break;
+        case 'i':
+            world.illuminateTile(0, -1);
+            break;
+        case 'k':
+            world.illuminateTile(0, 1);
+            break;
+        case 'j':
+            world.illuminateTile(-1, 0);
+            break;
+        case 'l':
+            world.illuminateTile(1, 0);
+            break;
+        }
+    }
+
+    static bool play(const Case& benchCase, Result& result, string& error) {
+        GameConfig config;
+        string script;
+        if (!buildScript(benchCase, config, script, error)) {
+            return false;
+        }
+
+        NullBuffer sink;
+        streambuf* terminal = cout.rdbuf(&sink);
+
+        uint64_t allocationsBefore = ProcessStats::allocationCount();
+        auto started = chrono::steady_clock::now();
+        int turns = 0;
+        {
+            Game game(benchCase.mapPath, config);
+            game.setSeed(benchCase.seed);
+            game.runScript(script);
+            turns = game.getCommandCount();
+        }
+        if (turns != benchCase.turns + 1) {
+            error = string("Bench script for ") + benchCase.name + " stopped after " + to_string(turns)
+                + " of " + to_string(benchCase.turns + 1) + " commands";
+            return false;
+        }
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+        cout.rdbuf(terminal);
+
+        result.name = benchCase.name;
+        result.turns = turns;
+        result.turnsPerSecond = elapsed > 0 ? turns / elapsed : 0;
+        result.peakResidentKb = ProcessStats::peakResidentBytes() / 1024;
+        result.allocations = ProcessStats::allocationCount() - allocationsBefore;
+        return true;
+    }
+
+    static bool check(ostream& out, const map<string, double>& baseline, const string& key, double value,
+        bool lowerIsBetter, double tolerance) {
+        auto it = baseline.find(key);
+        if (it == baseline.end()) {
+            out << "MISSING " << key << " = " << value << "\n";
+            return false;
+        }
+
+        double limit = lowerIsBetter ? it->second * (1 + tolerance) : it->second * (1 - tolerance);
+        bool passed = lowerIsBetter ? value <= limit : value >= limit;
+        out << (passed ? "ok      " : "FAILED  ") << key << " = " << static_cast<uint64_t>(value)
+            << " (baseline " << static_cast<uint64_t>(it->second) << ")\n";
+        return passed;
+    }
+};
+
+#endif
@@ -0,0 +1,363 @@
+#ifndef HOLY_DIVER_SAVE_FILE_H
+#define HOLY_DIVER_SAVE_FILE_H
+
+#include "common.h"
+
+// =====================
+// Save files
+// =====================
+
+// Appends plain values to a byte buffer in host byte order.
+class ByteWriter {
+public:
+    template <typename T>
+    void put(const T& value) {
+        static_assert(is_trivially_copyable<T>::value, "ByteWriter::put needs a trivially copyable type");
+        const char* bytes = reinterpret_cast<const char*>(&value);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    void putArray(const vector<T>& values) {
+        put(static_cast<uint32_t>(values.size()));
+        const char* bytes = reinterpret_cast<const char*>(values.data());
+        buffer.insert(buffer.end(), bytes, bytes + values.size() * sizeof(T));
+    }
+
+    void putString(const string& value) {
+        put(static_cast<uint32_t>(value.size()));
+        buffer.insert(buffer.end(), value.begin(), value.end());
+    }
+
+    // LEB128 varint, used for run lengths.
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            buffer.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back(static_cast<char>(value));
+    }
+
+    vector<char>& data() {
+        return buffer;
+    }
+
+private:
+    vector<char> buffer;
+};
+
+// Reads values written by ByteWriter. Any read past the end marks the
+// reader as failed and yields zeroes, so callers check ok() once at the end.
+class ByteReader {
+public:
+    ByteReader(const char* data, size_t size)
+        : cursor(data), end(data + size) {
+    }
+
+    template <typename T>
+    T get() {
+        T value{};
+        if (!take(&value, sizeof(T))) {
+            return T{};
+        }
+        return value;
+    }
+
+    template <typename T>
+    bool getArray(vector<T>& values) {
+        uint32_t count = get<uint32_t>();
+        if (!ok || static_cast<size_t>(end - cursor) / sizeof(T) < count) {
+            ok = false;
+            return false;
+        }
+        values.resize(count);
+        return take(values.data(), count * sizeof(T));
+    }
+
+    string getString() {
+        uint32_t length = get<uint32_t>();
+        if (!ok || static_cast<size_t>(end - cursor) < length) {
+            ok = false;
+            return string();
+        }
+        string value(cursor, length);
+        cursor += length;
+        return value;
+    }
+
+    uint64_t getVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (cursor == end) {
+                ok = false;
+                return 0;
+            }
+            unsigned char byte = static_cast<unsigned char>(*cursor++);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+
+    bool isOk() const {
+        return ok;
+    }
+
+    bool atEnd() const {
+        return cursor == end;
+    }
+
+private:
+    bool take(void* out, size_t size) {
+        if (!ok || static_cast<size_t>(end - cursor) < size) {
+            ok = false;
+            return false;
+        }
+        memcpy(out, cursor, size);
+        cursor += size;
+        return true;
+    }
+
+    const char* cursor;
+    const char* end;
+    bool ok = true;
+};
+
+// Read-only memory mapping of a whole file, used to resume from a save
+// without copying it through a stream first.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const string& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr) {
+            close();
+            return false;
+        }
+        bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) != 0 || info.st_size == 0) {
+            close();
+            return false;
+        }
+        void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (view == MAP_FAILED) {
+            close();
+            return false;
+        }
+        bytes = static_cast<const char*>(view);
+        length = static_cast<size_t>(info.st_size);
+#endif
+        if (bytes == nullptr) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (bytes != nullptr) {
+            UnmapViewOfFile(bytes);
+        }
+        if (mapping != nullptr) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes != nullptr) {
+            munmap(const_cast<char*>(bytes), length);
+        }
+        if (descriptor >= 0) {
+            ::close(descriptor);
+        }
+        descriptor = -1;
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const char* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int descriptor = -1;
+#endif
+    const char* bytes = nullptr;
+    size_t length = 0;
+};
+
+// Writes save buffers on a background thread so a turn never waits for the
+// disk. The file is written next to the target and then renamed over it,
+// which replaces it atomically: there is always a complete save on disk.
+// Saves to the same file that are still waiting are merged, so only the
+// latest state is written.
+class SaveWriter {
+public:
+    enum class Status { Idle, Done, Failed };
+
+    SaveWriter() = default;
+    SaveWriter(const SaveWriter&) = delete;
+    SaveWriter& operator=(const SaveWriter&) = delete;
+
+    ~SaveWriter() {
+        {
+            lock_guard<mutex> lock(guard);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    void start(const string& path, vector<char> data) {
+        {
+            lock_guard<mutex> lock(guard);
+            if (!worker.joinable()) {
+                worker = thread([this] { writeLoop(); });
+            }
+
+            if (!queue.empty() && queue.back().path == path) {
+                queue.back().data = std::move(data);
+                queue.back().requests++;
+            }
+            else {
+                queue.push_back({ path, std::move(data), 1 });
+            }
+        }
+        wake.notify_all();
+    }
+
+    // Blocks until every save started so far is written or has failed.
+    void wait() {
+        unique_lock<mutex> lock(guard);
+        idle.wait(lock, [this] { return queue.empty() && !writing; });
+    }
+
+    // One result per start(), oldest first; Idle when none is ready. A
+    // merged save reports the outcome of the write that replaced it.
+    Status takeResult() {
+        lock_guard<mutex> lock(guard);
+        if (results.empty()) {
+            return Status::Idle;
+        }
+        Status result = results.front();
+        results.pop_front();
+        return result;
+    }
+
+private:
+    struct Request {
+        string path;
+        vector<char> data;
+        int requests;
+    };
+
+    void writeLoop() {
+        unique_lock<mutex> lock(guard);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+
+            Request request = std::move(queue.front());
+            queue.pop_front();
+            writing = true;
+            lock.unlock();
+
+            Status result = writeFile(request.path, request.data) ? Status::Done : Status::Failed;
+
+            lock.lock();
+            writing = false;
+            results.insert(results.end(), request.requests, result);
+            idle.notify_all();
+        }
+    }
+
+    // The temp file is written, flushed to disk and closed before it
+    // replaces the save; if any of that fails it is deleted instead, so a
+    // failed write never costs the previous save.
+    static bool writeFile(const string& path, const vector<char>& bytes) {
+        string tempPath = path + ".tmp";
+        FILE* out = fopen(tempPath.c_str(), "wb");
+        if (out == nullptr) {
+            return false;
+        }
+        bool written = fwrite(bytes.data(), 1, bytes.size(), out) == bytes.size() && fflush(out) == 0
+            && syncToDisk(out);
+        if (fclose(out) != 0 || !written) {
+            remove(tempPath.c_str());
+            return false;
+        }
+#ifdef _WIN32
+        bool replaced = MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        bool replaced = rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+        if (!replaced) {
+            remove(tempPath.c_str());
+        }
+        return replaced;
+    }
+
+    static bool syncToDisk(FILE* file) {
+#ifdef _WIN32
+        return FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file)))) != 0;
+#else
+        return fsync(fileno(file)) == 0;
+#endif
+    }
+
+    mutex guard;
+    condition_variable wake;
+    condition_variable idle;
+    deque<Request> queue;
+    deque<Status> results;
+    bool writing = false;
+    bool stopping = false;
+    thread worker;
+};
+
+#endif
@@ -0,0 +1,668 @@
+#ifndef HOLY_DIVER_SPECTATOR_H
+#define HOLY_DIVER_SPECTATOR_H
+
+#include "terminal.h"
+
+// =====================
+// Spectators
+// =====================
+
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+typedef WSAPOLLFD SocketPoll;
+#else
+typedef int SocketHandle;
+typedef pollfd SocketPoll;
+#endif
+
+// The few socket calls the spectator server needs, over Winsock or POSIX.
+// Sockets are non-blocking loopback TCP.
+class Sockets {
+public:
+    struct Buffer {
+        const char* data;
+        size_t size;
+    };
+
+#ifdef _WIN32
+    static constexpr SocketHandle INVALID = INVALID_SOCKET;
+#else
+    static constexpr SocketHandle INVALID = -1;
+#endif
+
+    static bool startup() {
+#ifdef _WIN32
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+#if !defined(MSG_NOSIGNAL) && !defined(SO_NOSIGPIPE)
+        // No per-call or per-socket way to keep a closed viewer from
+        // raising SIGPIPE, so the process ignores it.
+        signal(SIGPIPE, SIG_IGN);
+#endif
+        return true;
+#endif
+    }
+
+    static void cleanup() {
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    static void close(SocketHandle socket) {
+#ifdef _WIN32
+        closesocket(socket);
+#else
+        ::close(socket);
+#endif
+    }
+
+    static bool setNonBlocking(SocketHandle socket) {
+#ifdef _WIN32
+        u_long enabled = 1;
+        return ioctlsocket(socket, FIONBIO, &enabled) == 0;
+#else
+        int flags = fcntl(socket, F_GETFL, 0);
+        return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+    }
+
+    static bool wouldBlock() {
+#ifdef _WIN32
+        return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+    }
+
+    // Binds to 127.0.0.1; port 0 picks a free one, which is returned in
+    // boundPort.
+    static SocketHandle listenLoopback(int port, int& boundPort, string& error) {
+        SocketHandle listener = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listener == INVALID) {
+            error = "Failed to create the spectator socket";
+            return INVALID;
+        }
+
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+        sockaddr_in address = loopback(port);
+        socklen_t length = sizeof(address);
+        if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || ::listen(listener, SOMAXCONN) != 0 || !setNonBlocking(listener)
+            || getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+            error = "Failed to listen for spectators on port " + to_string(port);
+            close(listener);
+            return INVALID;
+        }
+
+        boundPort = ntohs(address.sin_port);
+        return listener;
+    }
+
+    static SocketHandle connectLoopback(int port) {
+        SocketHandle socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (socket == INVALID) {
+            return INVALID;
+        }
+        sockaddr_in address = loopback(port);
+        if (::connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            close(socket);
+            return INVALID;
+        }
+        disableSigpipe(socket);
+        return socket;
+    }
+
+    // Accepted sockets are made non-blocking. Returns INVALID when nobody is
+    // waiting.
+    static SocketHandle accept(SocketHandle listener) {
+        SocketHandle socket = ::accept(listener, nullptr, nullptr);
+        if (socket != INVALID && !setNonBlocking(socket)) {
+            close(socket);
+            return INVALID;
+        }
+        if (socket != INVALID) {
+            disableSigpipe(socket);
+        }
+        return socket;
+    }
+
+    // Port of this end (local) or the other end of a connected socket; 0 on
+    // failure.
+    static int port(SocketHandle socket, bool local) {
+        sockaddr_in address{};
+        socklen_t length = sizeof(address);
+        sockaddr* raw = reinterpret_cast<sockaddr*>(&address);
+        int result = local ? getsockname(socket, raw, &length) : getpeername(socket, raw, &length);
+        return result == 0 ? ntohs(address.sin_port) : 0;
+    }
+
+    // One gather write of as much of the buffers as the socket takes without
+    // blocking. Returns the bytes sent (0 if it is full) or -1 on error.
+    static long long send(SocketHandle socket, const Buffer* buffers, size_t count) {
+#ifdef _WIN32
+        WSABUF parts[MAX_GATHER];
+        count = min(count, static_cast<size_t>(MAX_GATHER));
+        for (size_t i = 0; i < count; ++i) {
+            parts[i].buf = const_cast<char*>(buffers[i].data);
+            parts[i].len = static_cast<ULONG>(buffers[i].size);
+        }
+        DWORD sent = 0;
+        if (WSASend(socket, parts, static_cast<DWORD>(count), &sent, 0, nullptr, nullptr) != 0) {
+            return wouldBlock() ? 0 : -1;
+        }
+        return sent;
+#else
+        iovec parts[MAX_GATHER];
+        count = min(count, static_cast<size_t>(MAX_GATHER));
+        for (size_t i = 0; i < count; ++i) {
+            parts[i].iov_base = const_cast<char*>(buffers[i].data);
+            parts[i].iov_len = buffers[i].size;
+        }
+        msghdr message{};
+        message.msg_iov = parts;
+        message.msg_iovlen = count;
+        ssize_t sent = sendmsg(socket, &message, NO_SIGNAL);
+        if (sent < 0) {
+            return wouldBlock() ? 0 : -1;
+        }
+        return sent;
+#endif
+    }
+
+    // Reads and throws away whatever arrived. False once the peer closed.
+    static bool discardInput(SocketHandle socket) {
+        char scratch[512];
+        while (true) {
+            long long received = ::recv(socket, scratch, sizeof(scratch), 0);
+            if (received > 0) {
+                continue;
+            }
+            return received < 0 && wouldBlock();
+        }
+    }
+
+    static int poll(SocketPoll* sockets, size_t count, int timeoutMs) {
+#ifdef _WIN32
+        return WSAPoll(sockets, static_cast<ULONG>(count), timeoutMs);
+#else
+        return ::poll(sockets, static_cast<nfds_t>(count), timeoutMs);
+#endif
+    }
+
+    static constexpr size_t MAX_GATHER = 64;
+
+private:
+    // Writing to a viewer that hung up must not raise SIGPIPE: Linux has
+    // MSG_NOSIGNAL per send, the BSDs and macOS SO_NOSIGPIPE per socket,
+    // and elsewhere startup() ignores the signal.
+#ifdef MSG_NOSIGNAL
+    static constexpr int NO_SIGNAL = MSG_NOSIGNAL;
+#else
+    static constexpr int NO_SIGNAL = 0;
+#endif
+
+    static void disableSigpipe(SocketHandle socket) {
+#if !defined(_WIN32) && !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+        int enabled = 1;
+        setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled));
+#else
+        (void)socket;
+#endif
+    }
+
+    static sockaddr_in loopback(int port) {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return address;
+    }
+};
+
+// Streams the game's frames to viewers on loopback TCP; a plain terminal
+// client (`nc 127.0.0.1 PORT`) shows them. The game thread only queues each
+// screen patch and wakes the sender thread. The sender encodes the patch
+// once into an immutable buffer, the changed cells and status lines as
+// ANSI cursor moves, and every viewer gets the buffers it has not seen in
+// one gather write. A viewer that falls more than MAX_BACKLOG frames
+// behind skips to a keyframe (the whole screen), so a slow viewer never
+// holds up the game or the others.
+class SpectatorServer {
+public:
+    static constexpr size_t MAX_BACKLOG = 32;
+    static constexpr size_t MAX_VIEWERS = 1000;
+
+    SpectatorServer() = default;
+    SpectatorServer(const SpectatorServer&) = delete;
+    SpectatorServer& operator=(const SpectatorServer&) = delete;
+
+    ~SpectatorServer() {
+        stop();
+    }
+
+    // Port 0 picks a free port; see getPort.
+    bool start(int port, string& error) {
+        stop();
+        if (!Sockets::startup()) {
+            error = "Failed to initialise sockets";
+            return false;
+        }
+
+        listener = Sockets::listenLoopback(port, boundPort, error);
+        if (listener == Sockets::INVALID) {
+            Sockets::cleanup();
+            return false;
+        }
+        if (!openWakeup()) {
+            error = "Failed to set up the spectator wakeup socket";
+            Sockets::close(listener);
+            listener = Sockets::INVALID;
+            Sockets::cleanup();
+            return false;
+        }
+
+        stopping = false;
+        wakePending = false;
+        sender = thread([this]() { sendLoop(); });
+        return true;
+    }
+
+    void stop() {
+        if (!sender.joinable()) {
+            return;
+        }
+
+        stopping = true;
+        wake();
+        sender.join();
+
+        Sockets::close(wakeReader);
+        Sockets::close(wakeWriter);
+        wakeReader = wakeWriter = Sockets::INVALID;
+        for (Viewer& viewer : viewers) {
+            Sockets::close(viewer.socket);
+        }
+        viewers.clear();
+        log.clear();
+        pending.clear();
+        viewerCount = 0;
+        Sockets::close(listener);
+        listener = Sockets::INVALID;
+        Sockets::cleanup();
+    }
+
+    int getPort() const {
+        return boundPort;
+    }
+
+    size_t getViewerCount() const {
+        return viewerCount.load(memory_order_relaxed);
+    }
+
+    // Called by the game for every frame; queues the patch and wakes the
+    // sender.
+    void publish(shared_ptr<const World::ScreenPatch> patch) {
+        {
+            lock_guard<mutex> lock(guard);
+            pending.push_back(std::move(patch));
+        }
+        wake();
+    }
+
+private:
+    // Only a safety net: publish() and stop() wake the sender, and viewers
+    // with unsent data are polled for writability.
+    static constexpr int POLL_INTERVAL_MS = 500;
+    static constexpr int WAKEUP_CONNECT_MS = 1000;
+    // The screen starts with an empty line and the "--- MAP ---" header.
+    static constexpr int MAP_TOP_ROW = 3;
+
+    // Buffers are shared with the viewers still sending them, so the log
+    // can drop a frame while a viewer is halfway through it. The keyframe
+    // is only made for the newest frame, from the sender's Screen.
+    struct Frame {
+        uint64_t sequence = 0;
+        shared_ptr<const string> delta;
+        shared_ptr<const string> keyframe;
+    };
+
+    struct Viewer {
+        SocketHandle socket;
+        uint64_t nextSequence = 0;
+        bool needsKeyframe = true;
+        // A buffer that was only partly sent; it is finished before
+        // anything else so the stream stays well formed.
+        shared_ptr<const string> partial;
+        size_t partialOffset = 0;
+    };
+
+    // A connected pair through the listener: wake() writes a byte to it to
+    // end the sender's poll.
+    bool openWakeup() {
+        wakeWriter = Sockets::connectLoopback(boundPort);
+        if (wakeWriter == Sockets::INVALID || !Sockets::setNonBlocking(wakeWriter)) {
+            return closeWakeup();
+        }
+
+        // Skips anyone else who connected in the meantime.
+        int writerPort = Sockets::port(wakeWriter, true);
+        auto deadline = chrono::steady_clock::now() + chrono::milliseconds(static_cast<int>(WAKEUP_CONNECT_MS));
+        while (wakeReader == Sockets::INVALID && chrono::steady_clock::now() < deadline) {
+            SocketPoll entry;
+            entry.fd = listener;
+            entry.events = POLLIN;
+            entry.revents = 0;
+            Sockets::poll(&entry, 1, WAKEUP_CONNECT_MS);
+
+            SocketHandle socket = Sockets::accept(listener);
+            if (socket != Sockets::INVALID && Sockets::port(socket, false) == writerPort) {
+                wakeReader = socket;
+            }
+            else if (socket != Sockets::INVALID) {
+                Sockets::close(socket);
+            }
+        }
+        return wakeReader != Sockets::INVALID || closeWakeup();
+    }
+
+    bool closeWakeup() {
+        if (wakeWriter != Sockets::INVALID) {
+            Sockets::close(wakeWriter);
+            wakeWriter = Sockets::INVALID;
+        }
+        return false;
+    }
+
+    // At most one byte is in flight; the sender clears the flag before it
+    // looks at the queue, so no publish is missed.
+    void wake() {
+        if (!wakePending.exchange(true)) {
+            Sockets::Buffer byte = { "!", 1 };
+            Sockets::send(wakeWriter, &byte, 1);
+        }
+    }
+
+    bool hasUnsent(const Viewer& viewer) const {
+        return viewer.partial != nullptr
+            || (!log.empty() && (viewer.needsKeyframe || viewer.nextSequence < nextSequence));
+    }
+
+    void sendLoop() {
+        vector<SocketPoll> polled;
+        vector<shared_ptr<const World::ScreenPatch>> arrived;
+
+        while (!stopping) {
+            wakePending = false;
+            {
+                lock_guard<mutex> lock(guard);
+                arrived.swap(pending);
+            }
+            for (const shared_ptr<const World::ScreenPatch>& patch : arrived) {
+                World::ScreenStatus statusBefore = screen.getStatus();
+                screen.apply(*patch);
+                appendFrame(*patch, statusBefore);
+            }
+            arrived.clear();
+
+            for (size_t i = 0; i < viewers.size();) {
+                if (sendTo(viewers[i])) {
+                    ++i;
+                }
+                else {
+                    dropViewer(i);
+                }
+            }
+
+            // Listener and wakeup socket first, then one entry per viewer.
+            polled.resize(2 + viewers.size());
+            polled[0].fd = listener;
+            polled[1].fd = wakeReader;
+            for (size_t i = 0; i < viewers.size(); ++i) {
+                polled[i + 2].fd = viewers[i].socket;
+            }
+            for (size_t i = 0; i < polled.size(); ++i) {
+                bool writable = i >= 2 && hasUnsent(viewers[i - 2]);
+                polled[i].events = static_cast<short>(writable ? POLLIN | POLLOUT : POLLIN);
+                polled[i].revents = 0;
+            }
+            if (Sockets::poll(polled.data(), polled.size(), POLL_INTERVAL_MS) <= 0) {
+                continue;
+            }
+
+            if (polled[1].revents != 0) {
+                Sockets::discardInput(wakeReader);
+            }
+
+            // Anything a viewer sends is ignored; reading it is how a closed
+            // connection shows up. Backwards so dropping keeps indices valid.
+            for (size_t i = viewers.size(); i-- > 0;) {
+                if ((polled[i + 2].revents & ~POLLOUT) != 0 && !Sockets::discardInput(viewers[i].socket)) {
+                    dropViewer(i);
+                }
+            }
+            if (polled[0].revents != 0) {
+                acceptViewers();
+            }
+        }
+    }
+
+    // Called after the patch was applied to screen.
+    void appendFrame(const World::ScreenPatch& patch, const World::ScreenStatus& statusBefore) {
+        Frame frame;
+        frame.sequence = nextSequence++;
+        if (!viewers.empty() && !log.empty()) {
+            frame.delta = make_shared<const string>(patch.full ? encodeKeyframe() : encodeDelta(patch, statusBefore));
+        }
+
+        log.push_back(std::move(frame));
+        // Without viewers only the newest frame is needed, for the next
+        // keyframe.
+        size_t keep = viewers.empty() ? 1 : MAX_BACKLOG;
+        while (log.size() > keep) {
+            log.pop_front();
+        }
+    }
+
+    void acceptViewers() {
+        while (true) {
+            SocketHandle socket = Sockets::accept(listener);
+            if (socket == Sockets::INVALID) {
+                return;
+            }
+            if (viewers.size() >= MAX_VIEWERS) {
+                Sockets::close(socket);
+                continue;
+            }
+            Viewer viewer;
+            viewer.socket = socket;
+            viewers.push_back(viewer);
+            viewerCount = viewers.size();
+        }
+    }
+
+    void dropViewer(size_t index) {
+        Sockets::close(viewers[index].socket);
+        viewers[index] = std::move(viewers.back());
+        viewers.pop_back();
+        viewerCount = viewers.size();
+    }
+
+    // Sends what the socket takes right now. False if the viewer is gone.
+    bool sendTo(Viewer& viewer) {
+        if (log.empty()) {
+            return true;
+        }
+
+        uint64_t oldest = log.front().sequence;
+        if (viewer.nextSequence < oldest
+            || (viewer.nextSequence < nextSequence && log[viewer.nextSequence - oldest].delta == nullptr)) {
+            viewer.needsKeyframe = true;
+        }
+
+        // Each buffer with the sequence the viewer is at once it is out.
+        Sockets::Buffer buffers[Sockets::MAX_GATHER];
+        const shared_ptr<const string>* owners[Sockets::MAX_GATHER];
+        uint64_t sequenceAfter[Sockets::MAX_GATHER];
+        size_t count = 0;
+
+        if (viewer.partial != nullptr) {
+            const string& rest = *viewer.partial;
+            buffers[count] = { rest.data() + viewer.partialOffset, rest.size() - viewer.partialOffset };
+            owners[count] = &viewer.partial;
+            sequenceAfter[count++] = viewer.nextSequence;
+        }
+
+        if (viewer.needsKeyframe) {
+            Frame& latest = log.back();
+            if (latest.keyframe == nullptr) {
+                latest.keyframe = make_shared<const string>(encodeKeyframe());
+            }
+            buffers[count] = { latest.keyframe->data(), latest.keyframe->size() };
+            owners[count] = &latest.keyframe;
+            sequenceAfter[count++] = latest.sequence + 1;
+        }
+        else {
+            for (uint64_t sequence = viewer.nextSequence; sequence < nextSequence && count < Sockets::MAX_GATHER; ++sequence) {
+                const shared_ptr<const string>& delta = log[sequence - oldest].delta;
+                buffers[count] = { delta->data(), delta->size() };
+                owners[count] = &delta;
+                sequenceAfter[count++] = sequence + 1;
+            }
+        }
+
+        if (count == 0) {
+            return true;
+        }
+
+        long long sent = Sockets::send(viewer.socket, buffers, count);
+        if (sent < 0) {
+            return false;
+        }
+
+        size_t remaining = static_cast<size_t>(sent);
+        for (size_t i = 0; i < count && (remaining > 0 || buffers[i].size == 0); ++i) {
+            bool isPartial = owners[i] == &viewer.partial;
+            viewer.nextSequence = sequenceAfter[i];
+            if (!isPartial) {
+                viewer.needsKeyframe = false;
+            }
+
+            if (remaining >= buffers[i].size) {
+                remaining -= buffers[i].size;
+                if (isPartial) {
+                    viewer.partial = nullptr;
+                }
+                continue;
+            }
+
+            // Cut off mid-buffer: the viewer's reference keeps it alive even
+            // after the log drops the frame.
+            if (isPartial) {
+                viewer.partialOffset += remaining;
+            }
+            else {
+                viewer.partial = *owners[i];
+                viewer.partialOffset = remaining;
+            }
+            break;
+        }
+        return true;
+    }
+
+    // The whole current screen.
+    string encodeKeyframe() const {
+        string text;
+        screen.compose(text);
+        string out = "\x1b[H\x1b[2J";
+        out.reserve(out.size() + text.size() * 2);
+        appendLines(out, text, 0, text.size());
+        return out;
+    }
+
+    // Redraws the cells the patch changed, one cursor move per run of
+    // neighbouring cells on a row, then rewrites the status lines that
+    // differ; lines the new status no longer has are cleared.
+    string encodeDelta(const World::ScreenPatch& patch, const World::ScreenStatus& statusBefore) {
+        size_t cellCount = static_cast<size_t>(screen.getWidth()) * screen.getHeight();
+        changedCells.clear();
+        for (const World::ScreenPatch::Cell& cell : patch.cells) {
+            if (cell.index < cellCount) {
+                changedCells.push_back(cell.index);
+            }
+        }
+        sort(changedCells.begin(), changedCells.end());
+        changedCells.erase(unique(changedCells.begin(), changedCells.end()), changedCells.end());
+
+        string out;
+        uint32_t width = static_cast<uint32_t>(screen.getWidth());
+        for (size_t i = 0; i < changedCells.size(); ++i) {
+            uint32_t index = changedCells[i];
+            if (i == 0 || index != changedCells[i - 1] + 1 || index % width == 0) {
+                out += "\x1b[" + to_string(index / width + MAP_TOP_ROW) + ";" + to_string(index % width + 1) + "H";
+            }
+            out += screen.symbolAt(index);
+        }
+
+        string before;
+        string after;
+        World::composeStatus(statusBefore, before);
+        World::composeStatus(screen.getStatus(), after);
+        size_t oldPos = 0;
+        size_t newPos = 0;
+        int row = screen.getHeight() + MAP_TOP_ROW;
+        while (newPos < after.size()) {
+            size_t newEnd = after.find('\n', newPos);
+            size_t oldEnd = oldPos < before.size() ? before.find('\n', oldPos) : before.size();
+            bool same = oldPos < before.size() && oldEnd - oldPos == newEnd - newPos
+                && before.compare(oldPos, oldEnd - oldPos, after, newPos, newEnd - newPos) == 0;
+            if (!same) {
+                out += "\x1b[" + to_string(row) + ";1H";
+                out.append(after, newPos, newEnd - newPos);
+                out += "\x1b[K";
+            }
+            oldPos = min(before.size(), oldEnd + 1);
+            newPos = newEnd + 1;
+            row++;
+        }
+        if (oldPos < before.size()) {
+            out += "\x1b[" + to_string(row) + ";1H\x1b[J";
+        }
+        return out;
+    }
+
+    // Terminals in raw mode need the carriage returns.
+    static void appendLines(string& out, const string& text, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (text[i] == '\n') {
+                out += '\r';
+            }
+            out += text[i];
+        }
+    }
+
+    SocketHandle listener = Sockets::INVALID;
+    int boundPort = 0;
+    thread sender;
+    atomic<bool> stopping{ false };
+    atomic<size_t> viewerCount{ 0 };
+
+    SocketHandle wakeReader = Sockets::INVALID;
+    SocketHandle wakeWriter = Sockets::INVALID;
+    atomic<bool> wakePending{ false };
+
+    mutex guard;
+    vector<shared_ptr<const World::ScreenPatch>> pending;
+
+    // Only touched by the sender thread.
+    Screen screen;
+    vector<uint32_t> changedCells;
+    deque<Frame> log;
+    uint64_t nextSequence = 0;
+    vector<Viewer> viewers;
+};
+
+#endif
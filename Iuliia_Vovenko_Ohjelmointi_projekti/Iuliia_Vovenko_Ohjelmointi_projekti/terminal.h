@@ -0,0 +1,256 @@
+#ifndef HOLY_DIVER_TERMINAL_H
+#define HOLY_DIVER_TERMINAL_H
+
+#include "world.h"
+
+// =====================
+// Terminal I/O
+// =====================
+
+// Reads command lines on a background thread, so the game can keep working
+// while the player types and can apply several queued commands at once.
+// Each line yields its first non-blank character, or '\n' for an empty
+// line.
+class InputQueue {
+public:
+    InputQueue()
+        : state(make_shared<State>()) {
+    }
+
+    void start() {
+        if (scripted) {
+            return;
+        }
+
+        // cin is tied to cout by default; the reader thread must not flush
+        // cout behind the game's back.
+        cin.tie(nullptr);
+
+        shared_ptr<State> shared = state;
+        // The reader may stay blocked in getline until the process exits,
+        // so it is detached and only touches the shared state.
+        thread([shared]() {
+            string line;
+            while (getline(cin, line)) {
+                size_t first = line.find_first_not_of(" \t\r");
+                char c = first == string::npos ? '\n' : line[first];
+
+                lock_guard<mutex> lock(shared->guard);
+                shared->lines.push_back(c);
+                shared->ready.notify_one();
+            }
+
+            lock_guard<mutex> lock(shared->guard);
+            shared->closed = true;
+            shared->ready.notify_one();
+        }).detach();
+    }
+
+    // Blocks for the next line. Returns false once input has ended.
+    bool next(char& c) {
+        unique_lock<mutex> lock(state->guard);
+        state->ready.wait(lock, [this]() { return !state->lines.empty() || state->closed; });
+        return pop(c);
+    }
+
+    // A fed script is replayed one command per frame, as if typed.
+    bool tryNext(char& c) {
+        if (scripted) {
+            return false;
+        }
+        lock_guard<mutex> lock(state->guard);
+        return pop(c);
+    }
+
+    // Queues every line of a script and ends the input after it, instead of
+    // reading cin.
+    void feed(const string& script) {
+        istringstream lines(script);
+        string line;
+
+        lock_guard<mutex> lock(state->guard);
+        while (getline(lines, line)) {
+            size_t first = line.find_first_not_of(" \t\r");
+            state->lines.push_back(first == string::npos ? '\n' : line[first]);
+        }
+        state->closed = true;
+        scripted = true;
+    }
+
+private:
+    struct State {
+        mutex guard;
+        condition_variable ready;
+        deque<char> lines;
+        bool closed = false;
+    };
+
+    bool pop(char& c) {
+        if (state->lines.empty()) {
+            return false;
+        }
+        c = state->lines.front();
+        state->lines.pop_front();
+        return true;
+    }
+
+    shared_ptr<State> state;
+    bool scripted = false;
+};
+
+// A copy of the game screen owned by a presenter or sender thread. Patches
+// from World::collectScreenChanges are applied in order, and the text is
+// composed here instead of on the game thread.
+class Screen {
+public:
+    void apply(const World::ScreenPatch& patch) {
+        if (patch.full) {
+            width = patch.width;
+            height = patch.height;
+            grid = patch.grid;
+        }
+        else {
+            for (const World::ScreenPatch::Cell& cell : patch.cells) {
+                if (cell.index < grid.size()) {
+                    grid[cell.index] = cell.symbol;
+                }
+            }
+        }
+        status = patch.status;
+    }
+
+    void compose(string& out) const {
+        World::composeScreen(grid, width, height, status, out);
+    }
+
+    int getWidth() const {
+        return width;
+    }
+
+    int getHeight() const {
+        return height;
+    }
+
+    // index is y * width + x, as in ScreenPatch::Cell.
+    char symbolAt(size_t index) const {
+        return grid[index];
+    }
+
+    const World::ScreenStatus& getStatus() const {
+        return status;
+    }
+
+private:
+    int width = 0;
+    int height = 0;
+    string grid;
+    World::ScreenStatus status;
+};
+
+// Owns the terminal while the game runs. The game hands over what changed
+// on screen; a background thread applies it to its own Screen, composes
+// the frame and writes it out together with everything the game printed to
+// cout in between. If the terminal falls behind, the patches pile up and
+// are applied at once, so only the latest frame is composed and shown and
+// the game never waits on the terminal.
+class FramePresenter {
+public:
+    FramePresenter() = default;
+    FramePresenter(const FramePresenter&) = delete;
+    FramePresenter& operator=(const FramePresenter&) = delete;
+
+    ~FramePresenter() {
+        stop();
+    }
+
+    void start() {
+        terminal = cout.rdbuf(captured.rdbuf());
+        stopping = false;
+        writer = thread([this]() { writeLoop(); });
+    }
+
+    void present(shared_ptr<const World::ScreenPatch> patch, bool withPrompt) {
+        string messages = captured.str();
+        captured.str(string());
+
+        lock_guard<mutex> lock(guard);
+        pendingMessages += messages;
+        pendingPatches.push_back(std::move(patch));
+        pendingPrompt = withPrompt;
+        ready.notify_one();
+    }
+
+    // Writes out everything still pending and gives cout back.
+    void stop() {
+        if (!writer.joinable()) {
+            return;
+        }
+
+        {
+            lock_guard<mutex> lock(guard);
+            closingMessages = captured.str();
+            captured.str(string());
+            stopping = true;
+            ready.notify_one();
+        }
+
+        writer.join();
+        cout.rdbuf(terminal);
+    }
+
+private:
+    void writeLoop() {
+        vector<shared_ptr<const World::ScreenPatch>> patches;
+        unique_lock<mutex> lock(guard);
+        while (true) {
+            ready.wait(lock, [this]() { return stopping || !pendingMessages.empty() || !pendingPatches.empty(); });
+
+            string text;
+            text.swap(pendingMessages);
+            patches.swap(pendingPatches);
+            bool withPrompt = pendingPrompt;
+            bool last = stopping;
+            string closing;
+            closing.swap(closingMessages);
+            lock.unlock();
+
+            if (!patches.empty()) {
+                for (const shared_ptr<const World::ScreenPatch>& patch : patches) {
+                    screen.apply(*patch);
+                }
+                patches.clear();
+                screen.compose(text);
+                if (withPrompt) {
+                    text += ">>> ";
+                }
+            }
+            text += closing;
+
+            if (!text.empty()) {
+                terminal->sputn(text.data(), static_cast<streamsize>(text.size()));
+                terminal->pubsync();
+            }
+
+            lock.lock();
+            if (last && pendingMessages.empty() && pendingPatches.empty()) {
+                return;
+            }
+        }
+    }
+
+    streambuf* terminal = nullptr;
+    ostringstream captured;
+    thread writer;
+    mutex guard;
+    condition_variable ready;
+    string pendingMessages;
+    vector<shared_ptr<const World::ScreenPatch>> pendingPatches;
+    bool pendingPrompt = false;
+    string closingMessages;
+    bool stopping = false;
+
+    // Only touched by the writer thread.
+    Screen screen;
+};
+
+#endif
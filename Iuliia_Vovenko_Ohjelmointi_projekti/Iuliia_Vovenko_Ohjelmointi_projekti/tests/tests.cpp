@@ -0,0 +1,666 @@
+// Engine tests. Each one drives a World, or a SpectatorServer fed by one,
+// through its public calls and checks the outcome. Build and run from this
+// directory:
+//
+//   g++ -std=c++14 -O2 -pthread -I.. tests.cpp -o holy_diver_tests && ./holy_diver_tests
+//
+// or build the holy_diver_tests project of the solution. Every failed check
+// is printed, and the exit code is 1 if there was one.
+#include "spectator.h"
+
+static int failures = 0;
+
+static void check(bool passed, const char* condition, const char* file, int line) {
+    if (!passed) {
+        cout << file << ":" << line << ": CHECK(" << condition << ") failed\n";
+        failures++;
+    }
+}
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static const int MOVES[4][2] = { { 0, -1 }, { 0, 1 }, { -1, 0 }, { 1, 0 } };
+
+// A size x size level with border walls, the diver in the middle and the
+// rest of the cells rolled: wallPercent walls, enemyPercent 'M' enemies and
+// itemPercent items.
+static LevelData generateLevel(const string& name, int size, int wallPercent, int enemyPercent, int itemPercent,
+    uint32_t seed) {
+    RandomStream rng(seed);
+    LevelData level;
+    level.path = name;
+    level.width = size;
+    level.height = size;
+    for (int y = 0; y < size; ++y) {
+        string row(size, 'o');
+        for (int x = 0; x < size; ++x) {
+            int roll = rng.nextInt(0, 99);
+            if (x == 0 || y == 0 || x == size - 1 || y == size - 1 || roll < wallPercent) {
+                row[x] = 'x';
+            }
+            else if (roll < wallPercent + enemyPercent) {
+                row[x] = 'M';
+            }
+            else if (roll < wallPercent + enemyPercent + itemPercent) {
+                row[x] = rng.nextInt(0, 1) == 0 ? 'O' : 'B';
+            }
+        }
+        if (y == size / 2) {
+            row[size / 2] = 'P';
+        }
+        level.tiles.push_back(row);
+    }
+    return level;
+}
+
+static bool writeLevelFile(const string& path, const LevelData& level) {
+    ofstream out(path, ios::trunc);
+    for (const string& row : level.tiles) {
+        out << row << "\n";
+    }
+    return static_cast<bool>(out);
+}
+
+static string renderToString(const World& world) {
+    ostringstream out;
+    world.render(out);
+    return out.str();
+}
+
+// Reads at most `limit` bytes of the file.
+static string readFile(const string& path, size_t limit) {
+    ifstream in(path, ios::binary);
+    string bytes(limit, '\0');
+    in.read(&bytes[0], static_cast<streamsize>(limit));
+    bytes.resize(static_cast<size_t>(in.gcount()));
+    return bytes;
+}
+
+// Makes writing `path` fail. On Linux it becomes a link to /dev/full, which
+// opens fine and loses the data when it is flushed; elsewhere it becomes a
+// directory, which cannot be opened for writing.
+static bool blockFile(const string& path) {
+#if defined(__linux__)
+    return symlink("/dev/full", path.c_str()) == 0;
+#elif defined(_WIN32)
+    return CreateDirectoryA(path.c_str(), nullptr) != 0;
+#else
+    return mkdir(path.c_str(), 0700) == 0;
+#endif
+}
+
+static void unblockFile(const string& path) {
+#ifdef _WIN32
+    RemoveDirectoryA(path.c_str());
+#else
+    remove(path.c_str());
+#endif
+}
+
+// Plays the same seeded mix of moves and illuminations on every world it
+// is given, so two worlds in the same state stay comparable.
+static void playActions(World& world, uint32_t seed, int actions) {
+    mt19937 rng(seed);
+    for (int i = 0; i < actions && !world.isPlayerDead() && !world.isLevelCompleted(); ++i) {
+        const int* move = MOVES[rng() % 4];
+        if (rng() % 4 != 0) {
+            world.requestPlayerMove(move[0], move[1]);
+        }
+        else {
+            world.illuminateTile(move[0], move[1]);
+        }
+    }
+}
+
+// [user-027] Enemy intents are planned in parallel chunks but committed in
+// id order, so the same seed gives the same turns on any number of threads.
+// Harmless enemies leave the diver alive for every turn; otherwise the
+// diver has maxHealth and the run stops when the diver dies.
+static vector<uint64_t> playCrowdedLevel(const LevelData& level, unsigned threads, bool harmless, int turns,
+    size_t& awake) {
+    ostream discard(nullptr);
+    GameConfig config;
+    config.enemiesStartAwake = 1;
+    config.maxHealth = 1500;
+    config.maxOxygen = 100000;
+    for (int& damage : config.enemyDamage) {
+        damage = harmless ? 0 : damage;
+    }
+
+    Parallel::threadLimit() = threads;
+    World world;
+    world.setOutput(discard);
+    world.setConfig(config);
+    world.setSeed(11);
+    world.setHistoryCapacity(0);
+    CHECK(world.loadLevel(level));
+
+    awake = 0;
+    for (const Enemy* enemy : world.getEnemies()) {
+        awake += enemy->isActive() ? 1 : 0;
+    }
+
+    mt19937 rng(3);
+    vector<uint64_t> hashes;
+    for (int turn = 0; turn < turns && !world.isPlayerDead(); ++turn) {
+        const int* move = MOVES[rng() % 4];
+        world.requestPlayerMove(move[0], move[1]);
+        hashes.push_back(world.getStateHash());
+    }
+    Parallel::threadLimit() = 0;
+    return hashes;
+}
+
+static void testThreadCountDeterminism() {
+    // About 50,000 enemies: more than two planning chunks, so the plan is
+    // really split between threads. At this density many enemies want the
+    // same free cells every turn.
+    LevelData level = generateLevel("crowded", 320, 10, 50, 1, 5);
+    size_t awake = 0;
+    vector<uint64_t> single = playCrowdedLevel(level, 1, true, 300, awake);
+    CHECK(awake > 2 * 16384); // World::ENEMY_PLAN_CHUNK
+    CHECK(single.size() == 300);
+
+    size_t awakeThreaded = 0;
+    CHECK(playCrowdedLevel(level, 2, true, 300, awakeThreaded) == single);
+    CHECK(playCrowdedLevel(level, 4, true, 300, awakeThreaded) == single);
+    CHECK(playCrowdedLevel(level, 7, true, 300, awakeThreaded) == single);
+
+    // With damage on, the diver dies part way through, on the same turn
+    // whatever the thread count.
+    vector<uint64_t> lethal = playCrowdedLevel(level, 1, false, 300, awake);
+    CHECK(lethal.size() > 1 && lethal.size() < 300);
+    CHECK(playCrowdedLevel(level, 4, false, 300, awakeThreaded) == lethal);
+}
+
+// [user-027] As before the plan/commit split, a moving enemy tries up to
+// four directions and one that reaches the diver is an attack, so it can
+// attack twice, or attack and then move, in one turn.
+static void testEnemyAttacksThenKeepsTrying() {
+    ostream discard(nullptr);
+    GameConfig config;
+    config.enemiesStartAwake = 1;
+    config.movingEnemyIdlePercent = 0;
+    config.maxHealth = 1000;
+    int damage = EnemyTypes::table[EnemyTypes::table.kindForSymbol(MovingEnemy::symbol)].damage;
+
+    LevelData level;
+    level.path = "corridor";
+    level.tiles = { "xxxxx", "xPRox", "xxxxx" };
+    level.width = 5;
+    level.height = 3;
+
+    bool sawDoubleAttack = false;
+    bool sawAttackThenMove = false;
+    for (uint32_t seed = 1; seed <= 64; ++seed) {
+        World world;
+        world.setOutput(discard);
+        world.setConfig(config);
+        world.setSeed(seed);
+        CHECK(world.loadLevel(level));
+
+        world.illuminateTile(0, -1);
+        int attacks = (1000 - world.getPlayer().getHealth()) / damage;
+        bool moved = world.getEnemies()[0]->getPosition().x == 3;
+        CHECK(attacks * damage == 1000 - world.getPlayer().getHealth());
+        CHECK(attacks <= 4);
+        sawDoubleAttack = sawDoubleAttack || attacks >= 2;
+        sawAttackThenMove = sawAttackThenMove || (attacks >= 1 && moved);
+    }
+    CHECK(sawDoubleAttack);
+    CHECK(sawAttackThenMove);
+}
+
+// [user-029] The state hash is kept up to date move by move; after every
+// move, illumination and rewind it must equal a full recompute.
+static void testIncrementalHashMatchesRecompute() {
+    LevelData level = generateLevel("hashed", 40, 10, 4, 15, 9);
+    ostringstream output;
+    World world;
+    world.setOutput(output);
+    world.setSeed(21);
+    world.setHashVerification(true);
+    CHECK(world.loadLevel(level));
+    CHECK(world.getStateHash() == world.computeStateHash());
+
+    mt19937 rng(8);
+    int actions = 0;
+    int mismatches = 0;
+    for (; actions < 2000; ++actions) {
+        if (world.isPlayerDead() || world.isLevelCompleted()) {
+            CHECK(world.loadLevel(level));
+        }
+
+        unsigned roll = rng() % 10;
+        const int* move = MOVES[rng() % 4];
+        if (roll < 6) {
+            world.requestPlayerMove(move[0], move[1]);
+        }
+        else if (roll < 9) {
+            world.illuminateTile(move[0], move[1]);
+        }
+        else {
+            world.rewind(1 + static_cast<int>(rng() % 3));
+        }
+
+        mismatches += world.getStateHash() != world.computeStateHash() ? 1 : 0;
+    }
+
+    CHECK(mismatches == 0);
+    CHECK(output.str().find("State hash mismatch") == string::npos);
+}
+
+// [user-030] A save written by the background writer and read back through
+// a mapped file restores the same state, and play continues identically.
+static void testSaveRoundTrip() {
+    const string mapPath = "save_round_trip.map";
+    const string savePath = "save_round_trip.sav";
+    CHECK(writeLevelFile(mapPath, generateLevel("saved", 48, 12, 3, 8, 17)));
+
+    // Awake enemies that cannot drown or kill the diver, so the save is
+    // taken mid-hunt and play goes on after it.
+    GameConfig config;
+    config.enemiesStartAwake = 1;
+    config.maxHealth = 100000;
+    config.maxOxygen = 100000;
+
+    ostream discard(nullptr);
+    World original;
+    original.setOutput(discard);
+    original.setConfig(config);
+    original.setSeed(5);
+    CHECK(original.loadFromFile(mapPath));
+    playActions(original, 31, 100);
+    int savedTurn = original.getTurn();
+    CHECK(savedTurn > 0 && !original.isPlayerDead());
+
+    ByteWriter out;
+    original.writeSave(out);
+    SaveWriter writer;
+    writer.start(savePath, std::move(out.data()));
+    writer.wait();
+    CHECK(writer.takeResult() == SaveWriter::Status::Done);
+
+    World restored;
+    restored.setOutput(discard);
+    restored.setConfig(config);
+    restored.setSeed(5);
+    {
+        MappedFile file;
+        CHECK(file.open(savePath));
+        ByteReader in(file.data(), file.size());
+        CHECK(restored.loadFromSave(in));
+    }
+
+    CHECK(restored.getTurn() == original.getTurn());
+    CHECK(restored.getStateHash() == original.getStateHash());
+    CHECK(restored.getStateHash() == restored.computeStateHash());
+    CHECK(renderToString(restored) == renderToString(original));
+
+    playActions(original, 47, 100);
+    playActions(restored, 47, 100);
+    CHECK(original.getTurn() > savedTurn);
+    CHECK(restored.getStateHash() == original.getStateHash());
+    CHECK(renderToString(restored) == renderToString(original));
+
+    remove(mapPath.c_str());
+    remove(savePath.c_str());
+}
+
+// [user-030] A save whose temp file cannot be written fully reports
+// Failed, and the previous save stays as it was.
+static void testFailedSaveKeepsPreviousSave() {
+    const string savePath = "failed_save.sav";
+    const string tempPath = savePath + ".tmp";
+    SaveWriter writer;
+
+    writer.start(savePath, vector<char>(100, 'a'));
+    writer.wait();
+    CHECK(writer.takeResult() == SaveWriter::Status::Done);
+
+    CHECK(blockFile(tempPath));
+    writer.start(savePath, vector<char>(100, 'b'));
+    writer.wait();
+    CHECK(writer.takeResult() == SaveWriter::Status::Failed);
+    CHECK(readFile(savePath, 1000) == string(100, 'a'));
+    CHECK(!ifstream(tempPath).good());
+
+    unblockFile(tempPath);
+    remove(savePath.c_str());
+}
+
+// [user-032] Bytes outside the map legend are floor, as they always were;
+// validate only warns about them.
+static void testUnknownSymbolsAreFloor() {
+    LevelData level;
+    level.path = "decorated";
+    level.tiles = { "xxxxxx", "xP.# x", "xxxxxx" };
+    level.width = 6;
+    level.height = 3;
+
+    string error;
+    string warning;
+    CHECK(level.validate(error, &warning));
+    CHECK(warning.find("'.' at line 2, column 3") != string::npos);
+    CHECK(warning.find("and 2 more") != string::npos);
+
+    ostream discard(nullptr);
+    World world;
+    world.setOutput(discard);
+    CHECK(world.loadLevel(level));
+    for (int step = 0; step < 3; ++step) {
+        world.requestPlayerMove(1, 0);
+    }
+    CHECK(world.getPlayer().getPosition().x == 4);
+}
+
+// [user-038] Rewinding restores exactly the state of an earlier turn, and
+// no more turns than the history capacity can be undone.
+static void testRewindRestoresEarlierTurns() {
+    const size_t capacity = 24;
+    // Enemies wake up as the diver sees them, so undo also has to put them
+    // back to sleep, and an enemy woken and moved in one turn is recorded
+    // twice.
+    GameConfig config;
+    config.maxHealth = 100000;
+    config.maxOxygen = 100000;
+
+    ostream discard(nullptr);
+    World world;
+    world.setOutput(discard);
+    world.setConfig(config);
+    world.setSeed(13);
+    world.setHistoryCapacity(capacity);
+    CHECK(world.loadLevel(generateLevel("rewound", 36, 12, 15, 10, 23)));
+
+    // The state after every turn still in history, oldest first; the first
+    // entry is the oldest state a rewind can reach.
+    struct Snapshot {
+        uint64_t hash;
+        string screen;
+    };
+    deque<Snapshot> snapshots;
+    snapshots.push_back({ world.getStateHash(), renderToString(world) });
+
+    mt19937 rng(4);
+    auto playTurn = [&]() {
+        const int* move = MOVES[rng() % 4];
+        if (rng() % 4 != 0) {
+            world.requestPlayerMove(move[0], move[1]);
+        }
+        else {
+            world.illuminateTile(move[0], move[1]);
+        }
+        snapshots.push_back({ world.getStateHash(), renderToString(world) });
+        if (snapshots.size() > capacity + 1) {
+            snapshots.pop_front();
+        }
+        CHECK(world.getUndoDepth() == snapshots.size() - 1);
+    };
+
+    int rewinds = 0;
+    int wrongStates = 0;
+    for (int action = 0; action < 600; ++action) {
+        if (rng() % 5 == 0) {
+            int turns = 1 + static_cast<int>(rng() % 8);
+            int expected = min(turns, static_cast<int>(snapshots.size()) - 1);
+            CHECK(world.rewind(turns) == expected);
+            snapshots.resize(snapshots.size() - expected);
+            wrongStates += world.getStateHash() != snapshots.back().hash
+                || renderToString(world) != snapshots.back().screen ? 1 : 0;
+            rewinds++;
+            continue;
+        }
+
+        playTurn();
+    }
+
+    CHECK(rewinds > 50);
+    CHECK(wrongStates == 0);
+
+    // Unwinding everything stops at the capacity.
+    for (size_t turn = 0; turn < capacity; ++turn) {
+        playTurn();
+    }
+    CHECK(world.getUndoDepth() == capacity);
+    CHECK(world.rewind(1000) == static_cast<int>(capacity));
+    CHECK(world.getStateHash() == snapshots.front().hash);
+    CHECK(renderToString(world) == snapshots.front().screen);
+    CHECK(world.rewind(1) == 0);
+
+    world.setHistoryCapacity(0);
+    world.requestPlayerMove(1, 0);
+    CHECK(world.getUndoDepth() == 0);
+    CHECK(world.rewind(1) == 0);
+}
+
+// [user-041] The single search for the nearest item finds the same
+// distance as an exact search to every item of the kind.
+static void testNearestItemDistance() {
+    ostream discard(nullptr);
+    GameConfig config;
+    config.maxOxygen = 100000;
+    World world;
+    world.setOutput(discard);
+    world.setConfig(config);
+    world.setSeed(5);
+    CHECK(world.loadLevel(generateLevel("nearest", 64, 30, 0, 4, 21)));
+
+    const DistanceCache& distances = world.getDistances();
+    mt19937 rng(9);
+    for (int turn = 0; turn < 200 && !world.isPlayerDead() && !world.isLevelCompleted(); ++turn) {
+        Position diver = world.getPlayer().getPosition();
+        for (uint8_t kind = 0; kind < ItemTypes::table.size(); ++kind) {
+            int expected = -1;
+            for (const Item* item : world.getItems()) {
+                int d = item->getKind() == kind ? distances.distance(diver, item->getPosition()) : -1;
+                if (d >= 0 && (expected < 0 || d < expected)) {
+                    expected = d;
+                }
+            }
+            CHECK(world.distanceToNearestItem(kind) == expected);
+        }
+        const int* move = MOVES[rng() % 4];
+        world.requestPlayerMove(move[0], move[1]);
+    }
+
+    LevelData walledOff;
+    walledOff.path = "walled off";
+    walledOff.tiles = { "xxxxxxx", "xPoxOox", "xxxxxxx" };
+    walledOff.width = 7;
+    walledOff.height = 3;
+    CHECK(world.loadLevel(walledOff));
+    CHECK(world.distanceToNearestItem(static_cast<uint8_t>(ItemTypes::table.kindForSymbol(OxygenItem::symbol))) == -1);
+}
+
+// Plays back the ANSI stream a spectator receives: cursor moves, clears and
+// plain text, which is all SpectatorServer sends.
+struct TerminalGrid {
+    vector<string> rows;
+    size_t row = 0;
+    size_t column = 0;
+
+    void feed(const string& bytes) {
+        pending += bytes;
+        size_t i = 0;
+        while (i < pending.size()) {
+            char c = pending[i];
+            if (c == '\x1b') {
+                size_t end = i + 2;
+                while (end < pending.size() && !isalpha(static_cast<unsigned char>(pending[end]))) {
+                    end++;
+                }
+                if (end >= pending.size()) {
+                    break; // the rest of the sequence is still on its way
+                }
+                control(pending.substr(i + 2, end - i - 2), pending[end]);
+                i = end + 1;
+                continue;
+            }
+            if (c == '\r') {
+                column = 0;
+            }
+            else if (c == '\n') {
+                row++;
+            }
+            else {
+                put(c);
+            }
+            i++;
+        }
+        pending.erase(0, i);
+    }
+
+    string text() const {
+        size_t count = rows.size();
+        while (count > 0 && rows[count - 1].empty()) {
+            count--;
+        }
+        string out;
+        for (size_t i = 0; i < count; ++i) {
+            out += rows[i] + "\n";
+        }
+        return out;
+    }
+
+private:
+    void put(char c) {
+        if (rows.size() <= row) {
+            rows.resize(row + 1);
+        }
+        if (rows[row].size() <= column) {
+            rows[row].resize(column + 1, ' ');
+        }
+        rows[row][column++] = c;
+    }
+
+    void control(const string& arguments, char command) {
+        if (command == 'H') {
+            size_t separator = arguments.find(';');
+            row = arguments.empty() ? 0 : static_cast<size_t>(atoi(arguments.c_str()) - 1);
+            column = arguments.empty() ? 0 : static_cast<size_t>(atoi(arguments.c_str() + separator + 1) - 1);
+        }
+        else if (command == 'J' && arguments == "2") {
+            rows.clear();
+        }
+        else if (command == 'J' || command == 'K') {
+            if (row < rows.size()) {
+                rows[row].resize(min(rows[row].size(), column));
+            }
+            if (command == 'J' && row < rows.size()) {
+                rows.resize(row + 1);
+            }
+        }
+    }
+
+    string pending;
+};
+
+// [user-044] A viewer that stops reading falls behind, is moved on to a
+// keyframe, and once it reads again ends up showing exactly the screen the
+// game composed.
+static void testSlowSpectatorResyncs() {
+    SpectatorServer server;
+    string error;
+    CHECK(server.start(0, error));
+    SocketHandle viewer = Sockets::connectLoopback(server.getPort());
+    CHECK(viewer != Sockets::INVALID);
+    int receiveBuffer = 4096;
+    setsockopt(viewer, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&receiveBuffer), sizeof(receiveBuffer));
+    for (int wait = 0; server.getViewerCount() < 1 && wait < 200; ++wait) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    CHECK(server.getViewerCount() == 1);
+
+    ostream discard(nullptr);
+    GameConfig config;
+    config.maxOxygen = 100000;
+    World world;
+    world.setOutput(discard);
+    world.setConfig(config);
+    world.setSeed(3);
+    world.setHistoryCapacity(0);
+    LevelData level = generateLevel("watched", 120, 20, 0, 2, 13);
+    CHECK(world.loadLevel(level));
+
+    // The game's own view of every frame it published.
+    Screen expected;
+    mt19937 rng(17);
+    for (int frame = 0; frame < 1000; ++frame) {
+        if (frame > 0) {
+            const int* move = MOVES[rng() % 4];
+            world.illuminateTile(move[0], move[1]);
+            world.requestPlayerMove(move[0], move[1]);
+        }
+        shared_ptr<World::ScreenPatch> patch = make_shared<World::ScreenPatch>();
+        world.collectScreenChanges(*patch);
+        patch->status = world.getScreenStatus();
+        expected.apply(*patch);
+        server.publish(std::move(patch));
+    }
+
+    string composed;
+    expected.compose(composed);
+    TerminalGrid want;
+    for (char c : composed) {
+        want.feed(c == '\n' ? string("\r\n") : string(1, c));
+    }
+
+    // Reads until the viewer shows the last frame, or gives up after a few
+    // quiet seconds.
+    TerminalGrid got;
+    size_t keyframes = 0;
+    string received;
+    char buffer[65536];
+    for (int idle = 0; idle < 40 && got.text() != want.text();) {
+        SocketPoll entry{};
+        entry.fd = viewer;
+        entry.events = POLLIN;
+        if (Sockets::poll(&entry, 1, 50) <= 0) {
+            idle++;
+            continue;
+        }
+        long long count = ::recv(viewer, buffer, static_cast<int>(sizeof(buffer)), 0);
+        if (count <= 0) {
+            break;
+        }
+        string bytes(buffer, static_cast<size_t>(count));
+        received += bytes;
+        got.feed(bytes);
+    }
+    for (size_t at = received.find("\x1b[2J"); at != string::npos; at = received.find("\x1b[2J", at + 1)) {
+        keyframes++;
+    }
+
+    // The first keyframe is the screen on connect; the level is never
+    // reloaded, so any more are resyncs.
+    CHECK(keyframes >= 2);
+    CHECK(got.text() == want.text());
+
+    Sockets::close(viewer);
+    server.stop();
+}
+
+int main() {
+    static const struct {
+        const char* name;
+        void (*run)();
+    } tests[] = {
+        { "enemy turns do not depend on the thread count", testThreadCountDeterminism },
+        { "an enemy keeps trying directions after an attack", testEnemyAttacksThenKeepsTrying },
+        { "incremental state hash matches a recompute", testIncrementalHashMatchesRecompute },
+        { "a saved game loads back into the same state", testSaveRoundTrip },
+        { "a failed save keeps the previous save", testFailedSaveKeepsPreviousSave },
+        { "unknown map symbols are floor", testUnknownSymbolsAreFloor },
+        { "rewind restores earlier turns up to the history capacity", testRewindRestoresEarlierTurns },
+        { "nearest item distance matches a search per item", testNearestItemDistance },
+        { "a slow spectator resyncs to the composed screen", testSlowSpectatorResyncs },
+    };
+
+    for (const auto& test : tests) {
+        int before = failures;
+        test.run();
+        cout << (failures == before ? "ok      " : "FAILED  ") << test.name << "\n";
+    }
+    return failures == 0 ? 0 : 1;
+}
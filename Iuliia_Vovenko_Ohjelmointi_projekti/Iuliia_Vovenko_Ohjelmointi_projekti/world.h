@@ -0,0 +1,1541 @@
+#ifndef HOLY_DIVER_WORLD_H
+#define HOLY_DIVER_WORLD_H
+
+#include "level.h"
+#include "distance_cache.h"
+#include "ocean.h"
+#include "event_journal.h"
+
+// =====================
+// World
+// =====================
+
+class World {
+public:
+    // What the last turn (a move, an illumination or a rewind) changed, so
+    // renderers, snapshots and sync can skip rescanning the grid. After a
+    // level load fullRefresh is set and the lists are empty.
+    struct ChangeSet {
+        struct EnemyMove {
+            int id;
+            Position from;
+            Position to;
+        };
+
+        bool fullRefresh = true;
+        vector<Position> revealedCells;
+        vector<Position> hiddenCells;       // only by rewind
+        vector<EnemyMove> enemyMoves;       // in order; an enemy may move more than once
+        vector<int> activationChanges;      // enemy ids whose active flag flipped
+        vector<Position> removedItems;
+        vector<Position> restoredItems;     // only by rewind
+
+        // Player before the turn; compare with getPlayer() for stat deltas.
+        Position playerFrom;
+        int healthBefore = 0;
+        int oxygenBefore = 0;
+        int batteryBefore = 0;
+        int scoreBefore = 0;
+
+        // Every cell whose on-screen symbol may differ after the turn.
+        // Cells can repeat.
+        template <typename Fn>
+        void forEachDirtyCell(Position playerTo, Fn fn) const {
+            fn(playerFrom);
+            fn(playerTo);
+            for (const Position& cell : revealedCells) {
+                fn(cell);
+            }
+            for (const Position& cell : hiddenCells) {
+                fn(cell);
+            }
+            for (const EnemyMove& move : enemyMoves) {
+                fn(move.from);
+                fn(move.to);
+            }
+            for (const Position& cell : removedItems) {
+                fn(cell);
+            }
+            for (const Position& cell : restoredItems) {
+                fn(cell);
+            }
+        }
+    };
+
+    // The numbers under the map.
+    struct ScreenStatus {
+        int health = 0;
+        int oxygen = 0;
+        int battery = 0;
+        int score = 0;
+        int collectedItems = 0;
+        int totalItems = 0;
+        int waterPercent = -1;      // -1 without the ocean layer
+    };
+
+    // Screen changes in a form another thread can apply to its own copy of
+    // the screen: either the whole map (full) or single cells, with the
+    // status as of the last change. See collectScreenChanges.
+    struct ScreenPatch {
+        struct Cell {
+            uint32_t index;         // y * width + x
+            char symbol;
+        };
+
+        bool full = false;
+        int width = 0;
+        int height = 0;
+        string grid;                // full only: width * height symbols, row by row
+        vector<Cell> cells;
+        ScreenStatus status;
+    };
+
+    World() {
+        setHistoryCapacity(DEFAULT_HISTORY_TURNS);
+    }
+
+    // Applies new gameplay constants; player caps take effect immediately.
+    void setConfig(const GameConfig& newConfig) {
+        config = newConfig;
+        player.setLimits(config.maxHealth, config.maxOxygen, config.maxBattery);
+    }
+
+    const GameConfig& getConfig() const {
+        return config;
+    }
+
+    // Seeds enemy placement and enemy random streams for the next load.
+    void setSeed(uint32_t seed) {
+        random.seed(seed);
+    }
+
+    // Where gameplay messages go; cout by default. Headless runs pass a
+    // stream without a buffer to discard them.
+    void setOutput(ostream& out) {
+        output = &out;
+    }
+
+    bool loadFromFile(const string& filePath, bool keepPlayerState = false) {
+        LevelData level;
+        string error;
+        string warning;
+        if (!LevelData::read(filePath, level, error) || !level.validate(error, &warning)) {
+            messages() << error << "\n";
+            return false;
+        }
+        if (!warning.empty()) {
+            messages() << warning << "\n";
+        }
+        return loadLevel(std::move(level), keepPlayerState);
+    }
+
+    // Starts a level from an already parsed map, e.g. one prefetched by the
+    // campaign, without touching the disk.
+    bool loadLevel(LevelData level, bool keepPlayerState = false) {
+        originalMapPath = std::move(level.path);
+        // Copied into the accounted rows, reusing their buffers on reloads.
+        tiles.resize(level.tiles.size(), AccountedString(tiles.get_allocator()));
+        for (size_t y = 0; y < tiles.size(); ++y) {
+            tiles[y].assign(level.tiles[y].data(), level.tiles[y].size());
+        }
+        width = level.width;
+        height = level.height;
+
+        clearEntities();
+        clearHistory();
+        resetChanges(true);
+        turn = 0;
+        worldHash = 0;
+        totalItemsOnLevel = 0;
+        collectedItemsOnLevel = 0;
+
+        clearVisibility();
+
+        if (!keepPlayerState) {
+            player.reset();
+        }
+        else {
+            player.resetPositionOnly();
+        }
+
+        if (!extractObjectsFromMap()) {
+            return false;
+        }
+
+        // Spare pool blocks left by a bigger level are the first thing to
+        // go when memory is tight.
+        if (!MemoryBudget::fits(0)) {
+            enemyPool.releaseUnused();
+            itemPool.releaseUnused();
+        }
+
+        distances = DistanceCache::acquire(originalMapPath, width, height, wallBits.data(), wallWordsPerRow,
+            player.getPosition());
+        resetOcean();
+
+        recordEvent(EventJournal::LevelStart, player.getPosition(), totalItemsOnLevel);
+        return true;
+    }
+
+    bool reload() {
+        if (originalMapPath.empty()) {
+            return false;
+        }
+        return loadFromFile(originalMapPath, false);
+    }
+
+    const string& getMapPath() const {
+        return originalMapPath;
+    }
+
+    // Save layout: level template path and counters, player, enemies as
+    // parallel arrays, remaining items, then the visibility grid as
+    // alternating hidden/visible run lengths.
+    void writeSave(ByteWriter& out) const {
+        out.putString(originalMapPath);
+        out.put(static_cast<int32_t>(width));
+        out.put(static_cast<int32_t>(height));
+        out.put(static_cast<int32_t>(turn));
+        out.put(static_cast<int32_t>(totalItemsOnLevel));
+        out.put(static_cast<int32_t>(collectedItemsOnLevel));
+
+        Position pp = player.getPosition();
+        out.put(static_cast<int32_t>(pp.x));
+        out.put(static_cast<int32_t>(pp.y));
+        out.put(static_cast<int32_t>(player.getHealth()));
+        out.put(static_cast<int32_t>(player.getOxygen()));
+        out.put(static_cast<int32_t>(player.getBattery()));
+        out.put(static_cast<int32_t>(player.getScore()));
+
+        size_t enemyCount = enemies.size();
+        vector<int32_t> enemyX(enemyCount);
+        vector<int32_t> enemyY(enemyCount);
+        vector<uint8_t> enemyKind(enemyCount);
+        vector<uint8_t> enemyActive(enemyCount);
+        vector<int32_t> enemyTurn(enemyCount);
+        vector<uint64_t> enemyRandom(enemyCount);
+
+        for (size_t id = 0; id < enemyCount; ++id) {
+            const Enemy* enemy = enemies[id];
+            enemyX[id] = enemy->getPosition().x;
+            enemyY[id] = enemy->getPosition().y;
+            enemyKind[id] = enemy->getKind();
+            enemyActive[id] = enemy->isActive() ? 1 : 0;
+            enemyTurn[id] = enemy->getLastSimulatedTurn();
+            enemyRandom[id] = enemy->getRandomState();
+        }
+
+        out.putArray(enemyX);
+        out.putArray(enemyY);
+        out.putArray(enemyKind);
+        out.putArray(enemyActive);
+        out.putArray(enemyTurn);
+        out.putArray(enemyRandom);
+
+        vector<int32_t> itemX;
+        vector<int32_t> itemY;
+        vector<uint8_t> itemKind;
+        for (const Item* item : items) {
+            itemX.push_back(item->getPosition().x);
+            itemY.push_back(item->getPosition().y);
+            itemKind.push_back(item->getKind());
+        }
+
+        out.putArray(itemX);
+        out.putArray(itemY);
+        out.putArray(itemKind);
+
+        bool runVisible = false;
+        uint64_t runLength = 0;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (isVisible(x, y) != runVisible) {
+                    out.putVarint(runLength);
+                    runVisible = !runVisible;
+                    runLength = 0;
+                }
+                runLength++;
+            }
+        }
+        out.putVarint(runLength);
+    }
+
+    // Reloads the level template named in the save, then replaces its
+    // dynamic state with the saved one.
+    bool loadFromSave(ByteReader& in) {
+        string mapPath = in.getString();
+        int savedWidth = in.get<int32_t>();
+        int savedHeight = in.get<int32_t>();
+        int savedTurn = in.get<int32_t>();
+        int savedTotalItems = in.get<int32_t>();
+        int savedCollectedItems = in.get<int32_t>();
+
+        Position savedPlayerPos;
+        savedPlayerPos.x = in.get<int32_t>();
+        savedPlayerPos.y = in.get<int32_t>();
+        int savedHealth = in.get<int32_t>();
+        int savedOxygen = in.get<int32_t>();
+        int savedBattery = in.get<int32_t>();
+        int savedScore = in.get<int32_t>();
+
+        if (!in.isOk()) {
+            messages() << "Save file is corrupted.\n";
+            return false;
+        }
+
+        if (!loadFromFile(mapPath, false)) {
+            return false;
+        }
+
+        if (savedWidth != width || savedHeight != height) {
+            messages() << "Save file does not match level " << mapPath << ".\n";
+            return false;
+        }
+
+        vector<int32_t> enemyX, enemyY, enemyTurn, itemX, itemY;
+        vector<uint8_t> enemyKind, enemyActive, itemKind;
+        vector<uint64_t> enemyRandom;
+        in.getArray(enemyX);
+        in.getArray(enemyY);
+        in.getArray(enemyKind);
+        in.getArray(enemyActive);
+        in.getArray(enemyTurn);
+        in.getArray(enemyRandom);
+        in.getArray(itemX);
+        in.getArray(itemY);
+        in.getArray(itemKind);
+
+        size_t enemyCount = enemyX.size();
+        size_t itemCount = itemX.size();
+        bool consistent = in.isOk()
+            && enemyY.size() == enemyCount && enemyKind.size() == enemyCount && enemyActive.size() == enemyCount
+            && enemyTurn.size() == enemyCount && enemyRandom.size() == enemyCount
+            && itemY.size() == itemCount && itemKind.size() == itemCount;
+
+        for (size_t i = 0; consistent && i < enemyCount; ++i) {
+            consistent = isWalkableBase(enemyX[i], enemyY[i]) && enemyKind[i] < EnemyTypes::table.size();
+        }
+        for (size_t i = 0; consistent && i < itemCount; ++i) {
+            consistent = isWalkableBase(itemX[i], itemY[i]) && itemKind[i] < ItemTypes::table.size();
+        }
+
+        if (!consistent || !inBounds(savedPlayerPos.x, savedPlayerPos.y)) {
+            messages() << "Save file is corrupted.\n";
+            return false;
+        }
+
+        clearEntities();
+        worldHash = 0;
+        enemyGrid.assign(static_cast<size_t>(width) * height, static_cast<int>(NO_ENEMY));
+
+        for (size_t i = 0; i < enemyCount; ++i) {
+            Position pos{ enemyX[i], enemyY[i] };
+            Enemy* enemy = enemyPool.create(pos, enemyKind[i], 0);
+            if (enemyActive[i] != 0) {
+                enemy->activate();
+            }
+            enemy->markSimulated(enemyTurn[i]);
+            enemy->setRandomState(enemyRandom[i]);
+
+            enemies.push_back(enemy);
+            int id = static_cast<int>(enemies.size()) - 1;
+            enemyGrid[cellIndex(pos.x, pos.y)] = id;
+            worldHash ^= enemyHashKey(id);
+        }
+
+        for (size_t i = 0; i < itemCount; ++i) {
+            Position pos{ itemX[i], itemY[i] };
+            items.push_back(itemPool.create(pos, itemKind[i]));
+            worldHash ^= Zobrist::key(Zobrist::ItemCell, cellIndex(pos.x, pos.y));
+        }
+
+        clearVisibility();
+        size_t cellCount = static_cast<size_t>(width) * height;
+        size_t cell = 0;
+        bool runVisible = false;
+        while (cell < cellCount && in.isOk()) {
+            uint64_t runLength = in.getVarint();
+            if (runLength > cellCount - cell) {
+                break;
+            }
+            for (uint64_t i = 0; i < runLength; ++i, ++cell) {
+                if (runVisible) {
+                    reveal(static_cast<int>(cell % width), static_cast<int>(cell / width));
+                }
+            }
+            runVisible = !runVisible;
+        }
+
+        if (cell != cellCount || !in.isOk()) {
+            messages() << "Save file is corrupted.\n";
+            return false;
+        }
+
+        player.restore(savedPlayerPos, savedHealth, savedOxygen, savedBattery, savedScore);
+        turn = savedTurn;
+        totalItemsOnLevel = savedTotalItems;
+        collectedItemsOnLevel = savedCollectedItems;
+        // Saves do not hold the ocean; it restarts settled around the items
+        // that are left.
+        resetOcean();
+        return true;
+    }
+
+    Player& getPlayer() {
+        return player;
+    }
+
+    const Player& getPlayer() const {
+        return player;
+    }
+
+    bool isPlayerDead() const {
+        return player.isDead();
+    }
+
+    bool isLevelCompleted() const {
+        return totalItemsOnLevel > 0 && collectedItemsOnLevel == totalItemsOnLevel && !player.isDead();
+    }
+
+    int getCollectedItemsOnLevel() const {
+        return collectedItemsOnLevel;
+    }
+
+    int getTotalItemsOnLevel() const {
+        return totalItemsOnLevel;
+    }
+
+    int getLevelScore() const {
+        return player.getScore();
+    }
+
+    int getWidth() const {
+        return width;
+    }
+
+    int getHeight() const {
+        return height;
+    }
+
+    const AccountedVector<Item*>& getItems() const {
+        return items;
+    }
+
+    const AccountedVector<Enemy*>& getEnemies() const {
+        return enemies;
+    }
+
+    int getTurn() const {
+        return turn;
+    }
+
+    // Marks every cell as seen, as if the whole map had been explored.
+    void revealAll() {
+        resetChanges(true);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                reveal(x, y);
+            }
+        }
+    }
+
+    // Terrain only; entities are kept apart. Row pointers and the
+    // visibility bitmap stay put until the next load.
+    const char* getTileRow(int y) const {
+        return tiles[y].data();
+    }
+
+    const uint64_t* getVisibilityBits() const {
+        return visibleBits.data();
+    }
+
+    size_t getVisibilityWordsPerRow() const {
+        return visibleWordsPerRow;
+    }
+
+    // Shared walking-distance data for the current level.
+    const DistanceCache& getDistances() const {
+        return *distances;
+    }
+
+    // Heap held by this world. Distances is the shared cache it uses, which
+    // counts against the memory budget once however many worlds share it.
+    MemoryUsage getMemoryUsage() const {
+        MemoryUsage usage = ledger.usage();
+        usage.bytes[MemoryUsage::Distances] = distances ? distances->memoryUsage() : 0;
+        return usage;
+    }
+
+    // Walking distance from the player to the closest remaining item of a
+    // kind, or -1 if none is reachable.
+    int distanceToNearestItem(uint8_t kind) const {
+        vector<Position> targets;
+        for (const Item* item : items) {
+            if (item->getKind() == kind) {
+                targets.push_back(item->getPosition());
+            }
+        }
+        return distances->nearestDistance(player.getPosition(), targets);
+    }
+
+    // Oxygen level of the water at a cell, see OceanField.
+    float waterOxygenAt(Position p) const {
+        return ocean.levelAt(p.x, p.y);
+    }
+
+    // Direction the current pushes at a cell, {0, 0} in still water.
+    Position currentAt(Position p) const {
+        return ocean.currentAt(p.x, p.y);
+    }
+
+    // Free for the player to step on right now: inside, no wall, no enemy.
+    bool isPassable(int x, int y) const {
+        return isWalkableBase(x, y) && !isEnemyAt(x, y);
+    }
+
+    // 64-bit fingerprint of the dynamic state: player position and stats,
+    // enemy positions and activation, revealed cells and remaining items.
+    // Maintained incrementally, so reading it is O(1).
+    uint64_t getStateHash() const {
+        return worldHash ^ player.getHash();
+    }
+
+    // Full rescan of the same state, for checking the incremental hash.
+    uint64_t computeStateHash() const {
+        uint64_t hash = player.computeHash();
+
+        for (size_t id = 0; id < enemies.size(); ++id) {
+            hash ^= enemyHashKey(static_cast<int>(id));
+        }
+
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                if (isVisible(x, y)) {
+                    hash ^= Zobrist::key(Zobrist::VisibleCell, cellIndex(x, y));
+                }
+            }
+        }
+
+        for (const Item* item : items) {
+            Position ip = item->getPosition();
+            hash ^= Zobrist::key(Zobrist::ItemCell, cellIndex(ip.x, ip.y));
+        }
+
+        return hash;
+    }
+
+    // When enabled, every enemy turn ends by comparing the incremental hash
+    // against a full recompute and reporting any divergence.
+    void setHashVerification(bool enabled) {
+        verifyHash = enabled;
+    }
+
+    // Builds the whole screen in a buffer and writes it in one call.
+    void render(ostream& out) const {
+        ScreenPatch patch;
+        fillScreen(patch);
+
+        string text;
+        composeScreen(patch.grid, patch.width, patch.height, patch.status, text);
+        out.write(text.data(), static_cast<streamsize>(text.size()));
+    }
+
+    // Adds what the last turn, rewind or load changed on screen to patch;
+    // after a load that is the whole map. Called after every change, this
+    // costs the cells that changed instead of the whole map.
+    void collectScreenChanges(ScreenPatch& patch) const {
+        if (changes.fullRefresh) {
+            fillScreen(patch);
+            return;
+        }
+
+        Position pp = player.getPosition();
+        changes.forEachDirtyCell(pp, [&](Position cell) {
+            if (!inBounds(cell.x, cell.y)) {
+                return;
+            }
+            size_t index = cellIndex(cell.x, cell.y);
+            char symbol = symbolAt(cell.x, cell.y, pp);
+            if (patch.full) {
+                patch.grid[index] = symbol;
+            }
+            else {
+                patch.cells.push_back({ static_cast<uint32_t>(index), symbol });
+            }
+        });
+        patch.status = getScreenStatus();
+    }
+
+    ScreenStatus getScreenStatus() const {
+        ScreenStatus status;
+        status.health = player.getHealth();
+        status.oxygen = player.getOxygen();
+        status.battery = player.getBattery();
+        status.score = player.getScore();
+        status.collectedItems = collectedItemsOnLevel;
+        status.totalItems = totalItemsOnLevel;
+        if (ocean.isEnabled()) {
+            Position pp = player.getPosition();
+            status.waterPercent = static_cast<int>(ocean.levelAt(pp.x, pp.y) * 100 + 0.5f);
+        }
+        return status;
+    }
+
+    // Appends the text render() writes for this map and status; safe to
+    // call from any thread.
+    static void composeScreen(const string& grid, int mapWidth, int mapHeight, const ScreenStatus& status, string& out) {
+        out.reserve(out.size() + grid.size() + mapHeight + 160);
+        out += "\n--- MAP ---\n";
+        for (int y = 0; y < mapHeight; ++y) {
+            out.append(grid, static_cast<size_t>(y) * mapWidth, mapWidth);
+            out += '\n';
+        }
+
+        composeStatus(status, out);
+    }
+
+    // The status lines under the map, as composeScreen writes them.
+    static void composeStatus(const ScreenStatus& status, string& out) {
+        out += "Health:   " + to_string(status.health) + "\n";
+        out += "Oxygen:   " + to_string(status.oxygen) + "%\n";
+        out += "Battery:  " + to_string(status.battery) + "%\n";
+        out += "Score:    " + to_string(status.score) + "\n";
+        out += "Items:    " + to_string(status.collectedItems) + "/" + to_string(status.totalItems) + "\n";
+        if (status.waterPercent >= 0) {
+            out += "Water:    " + to_string(status.waterPercent) + "% oxygen\n";
+        }
+    }
+
+    // Number of turns kept for rewind; older turns are dropped. 0 turns
+    // recording off.
+    void setHistoryCapacity(size_t turns) {
+        history.assign(turns, TurnDelta(history.get_allocator()));
+        history.shrink_to_fit();
+        clearHistory();
+    }
+
+    size_t getHistoryCapacity() const {
+        return history.size();
+    }
+
+    size_t getUndoDepth() const {
+        return historyCount;
+    }
+
+    const ChangeSet& getChanges() const {
+        return changes;
+    }
+
+    // Rule events go to this journal; nullptr (the default) records nothing.
+    // The journal must outlive the world or be detached first.
+    void setJournal(EventJournal* eventJournal) {
+        journal = eventJournal;
+    }
+
+    void recordEvent(EventJournal::Type type, Position at, int amount = 0, int kind = 0) {
+        if (journal == nullptr) {
+            return;
+        }
+
+        EventJournal::Event event = {};
+        event.turn = static_cast<uint32_t>(turn);
+        event.type = type;
+        event.kind = static_cast<uint8_t>(kind);
+        event.amount = amount;
+        event.x = at.x;
+        event.y = at.y;
+        event.health = player.getHealth();
+        event.oxygen = player.getOxygen();
+        journal->record(event);
+    }
+
+    // Undoes up to the given number of turns, newest first, and returns how
+    // many were undone. Each turn only touches what it recorded.
+    int rewind(int turns) {
+        currentDelta = nullptr;
+        resetChanges(false);
+
+        int undone = 0;
+        while (undone < turns && historyCount > 0) {
+            historyCount--;
+            undoTurn(history[(historyStart + historyCount) % history.size()]);
+            undone++;
+        }
+
+        if (verifyHash && undone > 0) {
+            checkStateHash();
+        }
+        if (undone > 0) {
+            recordEvent(EventJournal::Rewind, player.getPosition(), undone);
+        }
+        return undone;
+    }
+
+    // Cell codes for observeWindow.
+    enum ObservedCell : uint8_t {
+        ObservedHidden = 0,
+        ObservedFloor = 1,
+        ObservedWall = 2,
+        ObservedEnemy = 3,
+        ObservedItem = 4 // + item kind
+    };
+
+    // Writes the (2 * radius + 1)^2 cells around the player, row by row,
+    // as seen on screen: unrevealed cells are hidden, cells outside the map
+    // count as walls.
+    void observeWindow(int radius, uint8_t* out) const {
+        Position pp = player.getPosition();
+        for (int y = pp.y - radius; y <= pp.y + radius; ++y) {
+            for (int x = pp.x - radius; x <= pp.x + radius; ++x) {
+                *out++ = observeCell(x, y);
+            }
+        }
+    }
+
+    bool requestPlayerMove(int dx, int dy) {
+        resetChanges(false);
+        beginTurnRecord();
+        player.consumeOxygen(ocean.oxygenCost(config.moveOxygenCost, player.getPosition()));
+
+        Position oldPos = player.getPosition();
+        Position newPos{ oldPos.x + dx, oldPos.y + dy };
+
+        if (!inBounds(newPos.x, newPos.y)) {
+            return false;
+        }
+
+        if (!isWalkableBase(newPos.x, newPos.y)) {
+            return false;
+        }
+
+        Enemy* enemy = getEnemyAtMutable(newPos.x, newPos.y);
+        if (enemy != nullptr) {
+            player.takeDamage(enemy->giveDamage(config));
+            activateEnemy(*enemy);
+            messages() << "You bumped into an enemy! -" << enemy->giveDamage(config) << " HP\n";
+            recordEvent(EventJournal::Bump, newPos, enemy->giveDamage(config), enemy->getKind());
+            return false;
+        }
+
+        player.setPosition(newPos);
+        reveal(newPos.x, newPos.y);
+        handleItemPickup();
+        advanceOcean();
+        activateSeenEnemies();
+        moveEnemies();
+        return true;
+    }
+
+    bool illuminateTile(int dx, int dy) {
+        resetChanges(false);
+        beginTurnRecord();
+        player.consumeOxygen(ocean.oxygenCost(config.illuminateOxygenCost, player.getPosition()));
+
+        Position pp = player.getPosition();
+        int tx = pp.x + dx;
+        int ty = pp.y + dy;
+
+        if (!inBounds(tx, ty)) {
+            messages() << "Can't illuminate outside the map.\n";
+            return false;
+        }
+
+        if (!player.canSpendBattery(config.illuminateBatteryCost)) {
+            messages() << "Battery empty!\n";
+            return false;
+        }
+
+        player.spendBattery(config.illuminateBatteryCost);
+        reveal(tx, ty);
+        messages() << "Illuminated tile (" << tx << "," << ty << ") -" << config.illuminateBatteryCost << "% battery\n";
+        recordEvent(EventJournal::Illuminate, Position{ tx, ty }, config.illuminateBatteryCost);
+
+        advanceOcean();
+        activateSeenEnemies();
+        moveEnemies();
+        return true;
+    }
+
+    bool inBounds(int x, int y) const {
+        return x >= 0 && x < width && y >= 0 && y < height;
+    }
+
+    // Shorthand for the simulation_radius setting; see GameConfig.
+    void setSimulationRadius(int radius) {
+        config.simulationRadius = max(0, radius);
+    }
+
+    int getSimulationRadius() const {
+        return max(0, config.simulationRadius);
+    }
+
+    // Checked against the state at the start of the enemy turn. The player's
+    // cell counts as enterable: moving there is an attack.
+    bool canEnemyEnter(int x, int y) const {
+        if (!inBounds(x, y)) {
+            return false;
+        }
+
+        if (!isWalkableBase(x, y)) {
+            return false;
+        }
+
+        return !isEnemyAt(x, y);
+    }
+
+private:
+    bool extractObjectsFromMap() {
+        Position playerPos{ -1, -1 };
+        vector<vector<Position>> enemyCells(EnemyTypes::table.size());
+        vector<Position> randomEnemyCells;
+        vector<vector<Position>> itemCells(ItemTypes::table.size());
+
+        wallWordsPerRow = (static_cast<size_t>(width) + 63) / 64;
+        wallBits.assign(wallWordsPerRow * height, 0);
+
+        vector<int> special;
+        for (int y = 0; y < height; ++y) {
+            special.clear();
+            MapScanner::scanRow(tiles[y].data(), width, &wallBits[y * wallWordsPerRow], special);
+
+            for (int x : special) {
+                char c = tiles[y][x];
+                switch (MapScanner::classify(c)) {
+                case SymbolPlayer:
+                    if (playerPos.x == -1) {
+                        playerPos = { x, y };
+                    }
+                    break;
+                case SymbolEnemy:
+                    if (MapScanner::kindOf(c) == Enemy::RANDOM_KIND) {
+                        randomEnemyCells.push_back({ x, y });
+                    }
+                    else {
+                        enemyCells[MapScanner::kindOf(c)].push_back({ x, y });
+                    }
+                    break;
+                case SymbolItem:
+                    itemCells[MapScanner::kindOf(c)].push_back({ x, y });
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+
+        if (playerPos.x == -1) {
+            messages() << "No 'P' found on the map!\n";
+            return false;
+        }
+
+        player.setPosition(playerPos);
+        reveal(playerPos.x, playerPos.y);
+        setTile(playerPos.x, playerPos.y, 'o');
+
+        enemyGrid.assign(static_cast<size_t>(width) * height, static_cast<int>(NO_ENEMY));
+
+        // Enemies of a random kind come first, with the kind rolled before
+        // the enemy's seed, so a map written only with 'M' loads as it
+        // always did.
+        size_t enemyCount = randomEnemyCells.size();
+        for (const vector<Position>& cells : enemyCells) {
+            enemyCount += cells.size();
+        }
+        enemies.reserve(enemyCount);
+        enemyPool.reserve(enemyCount);
+
+        uniform_int_distribution<int> anyKind(0, static_cast<int>(EnemyTypes::table.size()) - 1);
+        for (const Position& pos : randomEnemyCells) {
+            addEnemy(pos, static_cast<uint8_t>(anyKind(random)));
+        }
+        for (size_t kind = 0; kind < EnemyTypes::table.size(); ++kind) {
+            for (const Position& pos : enemyCells[kind]) {
+                addEnemy(pos, static_cast<uint8_t>(kind));
+            }
+        }
+
+        for (size_t kind = 0; kind < ItemTypes::table.size(); ++kind) {
+            items.reserve(items.size() + itemCells[kind].size());
+            itemPool.reserve(items.size() + itemCells[kind].size());
+
+            for (const Position& pos : itemCells[kind]) {
+                items.push_back(itemPool.create(pos, static_cast<uint8_t>(kind)));
+                setTile(pos.x, pos.y, 'o');
+                worldHash ^= Zobrist::key(Zobrist::ItemCell, cellIndex(pos.x, pos.y));
+            }
+        }
+
+        totalItemsOnLevel = static_cast<int>(items.size());
+        return true;
+    }
+
+    void addEnemy(Position pos, uint8_t kind) {
+        setTile(pos.x, pos.y, 'o');
+        enemies.push_back(enemyPool.create(pos, kind, nextEnemySeed()));
+        if (config.enemiesStartAwake != 0) {
+            enemies.back()->activate();
+        }
+
+        int id = static_cast<int>(enemies.size()) - 1;
+        enemyGrid[cellIndex(pos.x, pos.y)] = id;
+        worldHash ^= enemyHashKey(id);
+    }
+
+    ostream& messages() const {
+        return *output;
+    }
+
+    void resetOcean() {
+        if (config.oceanEnabled == 0) {
+            ocean.clear();
+            return;
+        }
+
+        vector<Position> sources;
+        for (const Item* item : items) {
+            if (item->info().oxygenSource) {
+                sources.push_back(item->getPosition());
+            }
+        }
+        ocean.reset(width, height, wallBits.data(), wallWordsPerRow, sources, config);
+    }
+
+    // The diver's breathing drains its cell, the water takes one step and
+    // the current may carry the diver on by a cell.
+    void advanceOcean() {
+        if (!ocean.isEnabled()) {
+            return;
+        }
+
+        Position pp = player.getPosition();
+        ocean.breathe(pp);
+        ocean.advance(currentDelta != nullptr ? &currentDelta->oceanTiles : nullptr);
+
+        Position push = ocean.currentAt(pp.x, pp.y);
+        Position target{ pp.x + push.x, pp.y + push.y };
+        if ((push.x != 0 || push.y != 0) && isPassable(target.x, target.y)) {
+            player.setPosition(target);
+            reveal(target.x, target.y);
+            messages() << "The current carries you along.\n";
+            recordEvent(EventJournal::Drift, target);
+            handleItemPickup();
+        }
+    }
+
+    uint64_t nextEnemySeed() {
+        uint64_t high = random();
+        return high << 32 | random();
+    }
+
+    void clearEntities() {
+        enemies.clear();
+        enemyGrid.clear();
+        items.clear();
+        enemyPool.clear();
+        itemPool.clear();
+    }
+
+    // Keeps the wall bitmask in step with terrain edits.
+    void setTile(int x, int y, char c) {
+        if (inBounds(x, y)) {
+            tiles[y][x] = c;
+
+            uint64_t bit = uint64_t(1) << (x & 63);
+            uint64_t& word = wallBits[y * wallWordsPerRow + (x >> 6)];
+            word = (MapScanner::classify(c) & SymbolWall) ? (word | bit) : (word & ~bit);
+        }
+    }
+
+    char getTile(int x, int y) const {
+        if (!inBounds(x, y)) {
+            return '\0';
+        }
+        return tiles[y][x];
+    }
+
+    bool isWalkableBase(int x, int y) const {
+        if (!inBounds(x, y)) {
+            return false;
+        }
+        return ((wallBits[y * wallWordsPerRow + (x >> 6)] >> (x & 63)) & 1) == 0;
+    }
+
+    bool isVisible(int x, int y) const {
+        if (!inBounds(x, y)) {
+            return false;
+        }
+        return ((visibleBits[y * visibleWordsPerRow + (x >> 6)] >> (x & 63)) & 1) != 0;
+    }
+
+    void setVisible(int x, int y, bool value) {
+        uint64_t bit = uint64_t(1) << (x & 63);
+        uint64_t& word = visibleBits[y * visibleWordsPerRow + (x >> 6)];
+        word = value ? (word | bit) : (word & ~bit);
+    }
+
+    void clearVisibility() {
+        visibleWordsPerRow = (static_cast<size_t>(width) + 63) / 64;
+        visibleBits.assign(visibleWordsPerRow * height, 0);
+    }
+
+    void reveal(int x, int y) {
+        if (inBounds(x, y) && !isVisible(x, y)) {
+            setVisible(x, y, true);
+            worldHash ^= Zobrist::key(Zobrist::VisibleCell, cellIndex(x, y));
+            if (currentDelta != nullptr) {
+                currentDelta->revealed.push_back(cellIndex(x, y));
+            }
+            if (!changes.fullRefresh) {
+                changes.revealedCells.push_back({ x, y });
+            }
+        }
+    }
+
+    size_t cellIndex(int x, int y) const {
+        return static_cast<size_t>(y) * width + x;
+    }
+
+    const Enemy* getEnemyAt(int x, int y) const {
+        if (!inBounds(x, y)) {
+            return nullptr;
+        }
+        int id = enemyGrid[cellIndex(x, y)];
+        return id == NO_ENEMY ? nullptr : enemies[id];
+    }
+
+    Enemy* getEnemyAtMutable(int x, int y) {
+        if (!inBounds(x, y)) {
+            return nullptr;
+        }
+        int id = enemyGrid[cellIndex(x, y)];
+        return id == NO_ENEMY ? nullptr : enemies[id];
+    }
+
+    bool isEnemyAt(int x, int y) const {
+        return getEnemyAt(x, y) != nullptr;
+    }
+
+    uint8_t observeCell(int x, int y) const {
+        if (!inBounds(x, y)) {
+            return ObservedWall;
+        }
+        if (!isVisible(x, y)) {
+            return ObservedHidden;
+        }
+        if (isEnemyAt(x, y)) {
+            return ObservedEnemy;
+        }
+        const Item* item = getItemAt(x, y);
+        if (item != nullptr) {
+            return static_cast<uint8_t>(ObservedItem + item->getKind());
+        }
+        return isWalkableBase(x, y) ? ObservedFloor : ObservedWall;
+    }
+
+    void fillScreen(ScreenPatch& patch) const {
+        Position pp = player.getPosition();
+        patch.full = true;
+        patch.width = width;
+        patch.height = height;
+        patch.cells.clear();
+        patch.grid.resize(static_cast<size_t>(width) * height);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                patch.grid[cellIndex(x, y)] = symbolAt(x, y, pp);
+            }
+        }
+        patch.status = getScreenStatus();
+    }
+
+    char symbolAt(int x, int y, Position playerPos) const {
+        if (playerPos.x == x && playerPos.y == y) {
+            return 'P';
+        }
+
+        if (!isVisible(x, y)) {
+            return ' ';
+        }
+
+        const Enemy* enemy = getEnemyAt(x, y);
+        if (enemy != nullptr) {
+            return enemy->getSymbol();
+        }
+
+        const Item* item = getItemAt(x, y);
+        if (item != nullptr) {
+            return item->getSymbol();
+        }
+
+        return tiles[y][x];
+    }
+
+    const Item* getItemAt(int x, int y) const {
+        for (const auto& item : items) {
+            Position ip = item->getPosition();
+            if (ip.x == x && ip.y == y) {
+                return item;
+            }
+        }
+        return nullptr;
+    }
+
+    uint64_t enemyHashKey(int id) const {
+        const Enemy* enemy = enemies[id];
+        Position ep = enemy->getPosition();
+        uint64_t key = Zobrist::key(Zobrist::EnemyCell, Zobrist::pack(id, static_cast<int>(cellIndex(ep.x, ep.y))));
+        if (enemy->isActive()) {
+            key ^= Zobrist::key(Zobrist::EnemyActive, static_cast<uint64_t>(id));
+        }
+        return key;
+    }
+
+    void activateEnemy(Enemy& enemy) {
+        if (!enemy.isActive()) {
+            Position ep = enemy.getPosition();
+            int id = enemyGrid[cellIndex(ep.x, ep.y)];
+            recordEnemy(id);
+            enemy.activate();
+            enemy.markSimulated(turn);
+            changes.activationChanges.push_back(id);
+            worldHash ^= Zobrist::key(Zobrist::EnemyActive, static_cast<uint64_t>(id));
+        }
+    }
+
+    void activateSeenEnemies() {
+        Position pp = player.getPosition();
+
+        for (int y = pp.y - 1; y <= pp.y + 1; ++y) {
+            for (int x = pp.x - 1; x <= pp.x + 1; ++x) {
+                Enemy* enemy = getEnemyAtMutable(x, y);
+                if (enemy != nullptr && isVisible(x, y)) {
+                    activateEnemy(*enemy);
+                }
+            }
+        }
+    }
+
+    // Collects ids of active enemies within the simulation radius, in id
+    // order. Only the window around the player is scanned, so the cost does
+    // not grow with the total number of enemies on the map.
+    void collectAwakeEnemies() {
+        awakeEnemies.clear();
+
+        int radius = getSimulationRadius();
+        if (radius == 0) {
+            for (size_t id = 0; id < enemies.size(); ++id) {
+                if (enemies[id]->isActive()) {
+                    awakeEnemies.push_back(static_cast<int>(id));
+                }
+            }
+            return;
+        }
+
+        Position pp = player.getPosition();
+        int left = max(0, pp.x - radius);
+        int right = min(width - 1, pp.x + radius);
+        int top = max(0, pp.y - radius);
+        int bottom = min(height - 1, pp.y + radius);
+
+        for (int y = top; y <= bottom; ++y) {
+            for (int x = left; x <= right; ++x) {
+                int id = enemyGrid[cellIndex(x, y)];
+                if (id != NO_ENEMY && enemies[id]->isActive()) {
+                    awakeEnemies.push_back(id);
+                }
+            }
+        }
+
+        sort(awakeEnemies.begin(), awakeEnemies.end());
+    }
+
+    // Moves an enemy within the grid if the target is free. Returns false
+    // when the move is blocked or is an attack on the player.
+    bool commitEnemyMove(int id, Position to) {
+        Enemy* enemy = enemies[id];
+        Position from = enemy->getPosition();
+
+        if (to == from || to == player.getPosition()) {
+            return false;
+        }
+
+        size_t target = cellIndex(to.x, to.y);
+        if (enemyGrid[target] != NO_ENEMY) {
+            return false;
+        }
+
+        worldHash ^= enemyHashKey(id);
+        enemyGrid[cellIndex(from.x, from.y)] = NO_ENEMY;
+        enemyGrid[target] = id;
+        enemy->setPosition(to);
+        worldHash ^= enemyHashKey(id);
+        changes.enemyMoves.push_back({ id, from, to });
+        return true;
+    }
+
+    // Replays the turns a dormant enemy missed, on its own and without
+    // attacking. Its random stream makes the result deterministic.
+    void fastForwardEnemy(int id) {
+        Enemy* enemy = enemies[id];
+        int missed = turn - 1 - enemy->getLastSimulatedTurn();
+        if (config.fastForwardTurns > 0) {
+            missed = min(missed, config.fastForwardTurns);
+        }
+
+        for (int i = 0; i < missed; ++i) {
+            commitEnemyMove(id, enemy->planMove(*this).target);
+        }
+    }
+
+    // Two phases: every awake enemy plans its move in parallel against the
+    // start-of-turn state, then moves are committed in enemy id order. A
+    // target cell goes to the lowest id that wants it, so the outcome does
+    // not depend on the number of threads. An enemy's attacks land before
+    // its move, as when enemies moved one at a time.
+    void moveEnemies() {
+        turn++;
+        collectAwakeEnemies();
+
+        for (int id : awakeEnemies) {
+            recordEnemy(id);
+            fastForwardEnemy(id);
+        }
+
+        size_t count = awakeEnemies.size();
+        enemyIntents.resize(count);
+
+        Parallel::forRange(count, ENEMY_PLAN_CHUNK, [this](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                enemyIntents[i] = enemies[awakeEnemies[i]]->planMove(*this);
+            }
+        });
+
+        for (size_t i = 0; i < count; ++i) {
+            Enemy* enemy = enemies[awakeEnemies[i]];
+            enemy->markSimulated(turn);
+
+            for (int attack = 0; attack < enemyIntents[i].attacks; ++attack) {
+                player.takeDamage(enemy->giveDamage(config));
+                messages() << "Enemy hit you! -" << enemy->giveDamage(config) << " HP\n";
+                recordEvent(EventJournal::EnemyHit, enemy->getPosition(), enemy->giveDamage(config), enemy->getKind());
+            }
+
+            commitEnemyMove(awakeEnemies[i], enemyIntents[i].target);
+        }
+
+        if (verifyHash) {
+            checkStateHash();
+        }
+    }
+
+    void checkStateHash() const {
+        uint64_t expected = computeStateHash();
+        if (expected != getStateHash()) {
+            messages() << "State hash mismatch on turn " << turn << ": incremental " << hex << getStateHash()
+                << ", recomputed " << expected << dec << "\n";
+        }
+    }
+
+    void handleItemPickup() {
+        Position pp = player.getPosition();
+
+        auto it = find_if(items.begin(), items.end(),
+            [&](const Item* item) {
+                return item->getPosition() == pp;
+            });
+
+        if (it != items.end()) {
+            (*it)->apply(player, config);
+            collectedItemsOnLevel++;
+            messages() << (*it)->info().pickupText << " +" << (*it)->getScoreValue(config) << " score\n";
+            messages() << "Collected items: " << collectedItemsOnLevel << "/" << totalItemsOnLevel << "\n";
+            recordEvent(EventJournal::Pickup, pp, (*it)->getScoreValue(config), (*it)->getKind());
+            worldHash ^= Zobrist::key(Zobrist::ItemCell, cellIndex(pp.x, pp.y));
+            if (currentDelta != nullptr) {
+                // The pool keeps the item alive until the level is unloaded,
+                // which also clears the history.
+                currentDelta->pickedItems.push_back({ *it, it - items.begin() });
+            }
+            if ((*it)->info().oxygenSource) {
+                ocean.setSource(pp.x, pp.y, false);
+            }
+            changes.removedItems.push_back(pp);
+            items.erase(it);
+
+            if (collectedItemsOnLevel == totalItemsOnLevel && totalItemsOnLevel > 0) {
+                messages() << "\nAll items on this level collected!\n";
+            }
+        }
+    }
+
+    // Enemy state before its first change in a turn.
+    struct EnemyRecord {
+        int id;
+        Position pos;
+        bool active;
+        int lastSimulatedTurn;
+        uint64_t randomState;
+    };
+
+    // Everything one turn changed, enough to put it back. Slots are reused,
+    // so the vectors keep their capacity between turns.
+    struct TurnDelta {
+        explicit TurnDelta(const AccountedAllocator<TurnDelta>& allocator)
+            : enemies(allocator), revealed(allocator), pickedItems(allocator), oceanTiles(allocator),
+              oceanActive(allocator) {
+        }
+
+        // Hands the buffers back, for a turn dropped to stay within the
+        // memory budget.
+        void release() {
+            enemies = AccountedVector<EnemyRecord>(enemies.get_allocator());
+            revealed = AccountedVector<size_t>(revealed.get_allocator());
+            pickedItems = AccountedVector<pair<Item*, ptrdiff_t>>(pickedItems.get_allocator());
+            oceanTiles = AccountedVector<OceanField::TileBackup>(oceanTiles.get_allocator());
+            oceanActive = AccountedVector<int>(oceanActive.get_allocator());
+        }
+
+        int turn = 0;
+        int collectedItems = 0;
+        Position playerPos;
+        int health = 0;
+        int oxygen = 0;
+        int battery = 0;
+        int score = 0;
+        AccountedVector<EnemyRecord> enemies;
+        AccountedVector<size_t> revealed;
+        // Item and its index in items; the current can add a second one.
+        AccountedVector<pair<Item*, ptrdiff_t>> pickedItems;
+        AccountedVector<OceanField::TileBackup> oceanTiles;
+        AccountedVector<int> oceanActive;
+    };
+
+    // Empties the change set and snapshots the player.
+    void resetChanges(bool fullRefresh) {
+        changes.fullRefresh = fullRefresh;
+        changes.revealedCells.clear();
+        changes.hiddenCells.clear();
+        changes.enemyMoves.clear();
+        changes.activationChanges.clear();
+        changes.removedItems.clear();
+        changes.restoredItems.clear();
+        changes.playerFrom = player.getPosition();
+        changes.healthBefore = player.getHealth();
+        changes.oxygenBefore = player.getOxygen();
+        changes.batteryBefore = player.getBattery();
+        changes.scoreBefore = player.getScore();
+    }
+
+    void clearHistory() {
+        historyStart = 0;
+        historyCount = 0;
+        currentDelta = nullptr;
+    }
+
+    // Opens the next ring slot, dropping the oldest turn when full. Slots
+    // keep their buffers for reuse, so the ring grows whenever a turn needs
+    // more than its slot had; over the memory budget the oldest turns hand
+    // theirs back first.
+    void beginTurnRecord() {
+        if (history.empty()) {
+            currentDelta = nullptr;
+            return;
+        }
+
+        while (historyCount > 0 && !MemoryBudget::fits(0)) {
+            history[historyStart].release();
+            historyStart = (historyStart + 1) % history.size();
+            historyCount--;
+        }
+        if (historyCount == history.size()) {
+            historyStart = (historyStart + 1) % history.size();
+            historyCount--;
+        }
+
+        TurnDelta& delta = history[(historyStart + historyCount) % history.size()];
+        historyCount++;
+
+        delta.turn = turn;
+        delta.collectedItems = collectedItemsOnLevel;
+        delta.playerPos = player.getPosition();
+        delta.health = player.getHealth();
+        delta.oxygen = player.getOxygen();
+        delta.battery = player.getBattery();
+        delta.score = player.getScore();
+        delta.enemies.clear();
+        delta.revealed.clear();
+        delta.pickedItems.clear();
+        delta.oceanTiles.clear();
+        delta.oceanActive = ocean.getActiveTiles();
+        currentDelta = &delta;
+    }
+
+    void recordEnemy(int id) {
+        if (currentDelta != nullptr) {
+            const Enemy* enemy = enemies[id];
+            currentDelta->enemies.push_back({ id, enemy->getPosition(), enemy->isActive(),
+                enemy->getLastSimulatedTurn(), enemy->getRandomState() });
+        }
+    }
+
+    void undoTurn(const TurnDelta& delta) {
+        // An enemy may be recorded more than once and may have moved into a
+        // cell another recorded enemy left, so lift them all off the grid,
+        // restore the oldest record of each, then put them back.
+        size_t firstMove = changes.enemyMoves.size();
+        liftedActive.clear();
+        for (const EnemyRecord& record : delta.enemies) {
+            const Enemy* enemy = enemies[record.id];
+            Position ep = enemy->getPosition();
+            size_t cell = cellIndex(ep.x, ep.y);
+            if (enemyGrid[cell] == record.id) {
+                worldHash ^= enemyHashKey(record.id);
+                enemyGrid[cell] = NO_ENEMY;
+                changes.enemyMoves.push_back({ record.id, ep, ep });
+                liftedActive.push_back(enemy->isActive());
+            }
+        }
+        for (auto it = delta.enemies.rbegin(); it != delta.enemies.rend(); ++it) {
+            enemies[it->id]->restore(it->pos, it->active, it->lastSimulatedTurn, it->randomState);
+        }
+        for (size_t i = firstMove; i < changes.enemyMoves.size(); ++i) {
+            ChangeSet::EnemyMove& move = changes.enemyMoves[i];
+            const Enemy* enemy = enemies[move.id];
+            if (liftedActive[i - firstMove] != enemy->isActive()) {
+                changes.activationChanges.push_back(move.id);
+            }
+            move.to = enemy->getPosition();
+            enemyGrid[cellIndex(move.to.x, move.to.y)] = move.id;
+            worldHash ^= enemyHashKey(move.id);
+        }
+
+        for (size_t cell : delta.revealed) {
+            Position p{ static_cast<int>(cell % width), static_cast<int>(cell / width) };
+            setVisible(p.x, p.y, false);
+            worldHash ^= Zobrist::key(Zobrist::VisibleCell, cell);
+            changes.hiddenCells.push_back(p);
+        }
+
+        for (auto it = delta.pickedItems.rbegin(); it != delta.pickedItems.rend(); ++it) {
+            Item* item = it->first;
+            Position ip = item->getPosition();
+            items.insert(items.begin() + it->second, item);
+            worldHash ^= Zobrist::key(Zobrist::ItemCell, cellIndex(ip.x, ip.y));
+            changes.restoredItems.push_back(ip);
+            if (item->info().oxygenSource) {
+                ocean.setSource(ip.x, ip.y, true);
+            }
+        }
+
+        // Last, so the active tiles are exactly those of the turn start.
+        ocean.restore(delta.oceanTiles, delta.oceanActive);
+
+        player.restore(delta.playerPos, delta.health, delta.oxygen, delta.battery, delta.score);
+        collectedItemsOnLevel = delta.collectedItems;
+        turn = delta.turn;
+    }
+
+private:
+    static constexpr int NO_ENEMY = -1;
+    static constexpr size_t ENEMY_PLAN_CHUNK = 16384;
+    static constexpr size_t DEFAULT_HISTORY_TURNS = 256;
+
+    // First, so it exists when the containers below take its allocators.
+    MemoryLedger ledger;
+
+    GameConfig config;
+    mt19937 random{ random_device{}() };
+    ostream* output = &cout;
+
+    string originalMapPath;
+    AccountedVector<AccountedString> tiles{ ledger.allocatorFor<AccountedString>(MemoryUsage::Terrain) };
+    // One bit per cell, rows padded to whole words.
+    AccountedVector<uint64_t> wallBits{ ledger.allocatorFor<uint64_t>(MemoryUsage::Terrain) };
+    size_t wallWordsPerRow = 0;
+    shared_ptr<const DistanceCache> distances;
+    OceanField ocean{ ledger.allocatorFor<float>(MemoryUsage::Ocean) };
+    EventJournal* journal = nullptr;
+    // Revealed cells, laid out like wallBits.
+    AccountedVector<uint64_t> visibleBits{ ledger.allocatorFor<uint64_t>(MemoryUsage::Visibility) };
+    size_t visibleWordsPerRow = 0;
+    int width = 0;
+    int height = 0;
+    int turn = 0;
+
+    // Hash of everything except the player, which keeps its own.
+    uint64_t worldHash = 0;
+    bool verifyHash = false;
+
+    int totalItemsOnLevel = 0;
+    int collectedItemsOnLevel = 0;
+
+    Player player;
+
+    // Entities are owned by the pools; the vectors only reference them.
+    ObjectPool<Enemy> enemyPool{ ledger.allocatorFor<Enemy>(MemoryUsage::Entities) };
+    ObjectPool<Item> itemPool{ ledger.allocatorFor<Item>(MemoryUsage::Entities) };
+    AccountedVector<Enemy*> enemies{ ledger.allocatorFor<Enemy*>(MemoryUsage::Entities) };
+    AccountedVector<Item*> items{ ledger.allocatorFor<Item*>(MemoryUsage::Entities) };
+
+    // Enemy id (index into enemies) per cell, NO_ENEMY when empty.
+    AccountedVector<int> enemyGrid{ ledger.allocatorFor<int>(MemoryUsage::Entities) };
+    AccountedVector<int> awakeEnemies{ ledger.allocatorFor<int>(MemoryUsage::Entities) };
+    AccountedVector<EnemyPlan> enemyIntents{ ledger.allocatorFor<EnemyPlan>(MemoryUsage::Entities) };
+
+    // Ring buffer of the last turns, oldest at historyStart. Sized by the
+    // constructor.
+    AccountedVector<TurnDelta> history{ ledger.allocatorFor<TurnDelta>(MemoryUsage::History) };
+    size_t historyStart = 0;
+    size_t historyCount = 0;
+    TurnDelta* currentDelta = nullptr;
+    AccountedVector<bool> liftedActive{ ledger.allocatorFor<bool>(MemoryUsage::Entities) };
+
+    ChangeSet changes;
+};
+
+// Up to four random directions. One that reaches the diver is an attack
+// and the enemy keeps trying, so it may attack more than once, or attack
+// and then move.
+inline EnemyPlan MovingEnemy::planMove(Position current, RandomStream& rng, const World& world) {
+    Position diver = world.getPlayer().getPosition();
+
+    // A current carries the enemy whatever it had in mind.
+    Position push = world.currentAt(current);
+    if (push.x != 0 || push.y != 0) {
+        Position target{ current.x + push.x, current.y + push.y };
+        if (target == diver) {
+            return { current, 1 };
+        }
+        if (world.canEnemyEnter(target.x, target.y)) {
+            return { target, 0 };
+        }
+    }
+
+    EnemyPlan plan{ current, 0 };
+    if (rng.nextInt(0, 99) < world.getConfig().movingEnemyIdlePercent) {
+        return plan;
+    }
+
+    static const int dirs[4][2] = {
+        {0, -1},
+        {0, 1},
+        {-1, 0},
+        {1, 0}
+    };
+
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        int index = rng.nextInt(0, 3);
+        Position target{ current.x + dirs[index][0], current.y + dirs[index][1] };
+
+        if (target == diver) {
+            plan.attacks++;
+        }
+        else if (world.canEnemyEnter(target.x, target.y)) {
+            plan.target = target;
+            return plan;
+        }
+    }
+
+    return plan;
+}
+
+#endif